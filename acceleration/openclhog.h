@@ -0,0 +1,360 @@
+/**
+ * @file:   openclhog.h
+ * @brief:  Optional OpenCL backend for the HOG calculation, running the OpenCL kernels of cv::HOGDescriptor (transparent API, cv::UMat)
+ * with OpenCV 3.0 or newer, or of cv::ocl::HOGDescriptor (ocl module, opencv_ocl) with OpenCV 2.4.8 or newer.
+ * Selected at runtime (@see enable), everything falls back to the CPU path if OpenCL is not available, the ocl module of OpenCV 2.4
+ * only implements the default block layout (16x16 blocks of 8x8 cells, block stride 8x8, 9 bins), other HOG parameters stay on the CPU.
+ *
+ * The OpenCL kernels calculate all windows of an image at the window stride, without padding and without window locations,
+ * and reflect the image border like the CPU path. Two uses are built on this:
+ * - Window-sized samples (e.g. training samples) are queued and uploaded as one mosaic image per batch: the samples side by side,
+ *   separated by a gap of one block stride holding the reflected border pixels of the neighbouring samples, so that one kernel run
+ *   calculates the descriptors of all samples of the batch as they would be calculated for the single samples.
+ * - Block histogram grids of complete images (@see detection/detectionengine.h) are calculated from the image padded on the host
+ *   (as the CPU path pads it) by one block stride more than requested, so that the gradients of the outermost used pixels are
+ *   calculated from the padding as on the CPU, the blocks of the extra border are dropped.
+ * The device buffers are owned by the object and reused as long as the image size does not change, use one object per thread.
+ * The kernels calculate in a different order and precision than the CPU path, so the results are not bit-identical:
+ * verify compares both paths, the backend must only be used if the difference is within a tolerance.
+ */
+
+#ifndef OPENCLHOG_H
+#define	OPENCLHOG_H
+
+#include <stdio.h>
+#include <math.h>
+#include <vector>
+#include <string>
+#include <algorithm>
+#include <opencv2/core/core.hpp>
+#include <opencv2/imgproc/imgproc.hpp>
+#include <opencv2/objdetect/objdetect.hpp>
+
+// The transparent API (cv::UMat, cv::ocl) exists since OpenCV 3.0, OpenCV 2.4 has the separate ocl module (device enumeration since 2.4.8)
+#if CV_MAJOR_VERSION >= 3
+#include <opencv2/core/ocl.hpp>
+#define OPENCLHOG_AVAILABLE 1
+#elif CV_MAJOR_VERSION == 2 && CV_MINOR_VERSION == 4 && CV_SUBMINOR_VERSION >= 8
+#include <opencv2/opencv_modules.hpp>
+#ifdef HAVE_OPENCV_OCL
+#include <opencv2/ocl/ocl.hpp>
+#define OPENCLHOG_AVAILABLE 1
+#else
+#define OPENCLHOG_AVAILABLE 0
+#endif
+#else
+#define OPENCLHOG_AVAILABLE 0
+#endif
+
+class OpenCLHog {
+private:
+#if OPENCLHOG_AVAILABLE && CV_MAJOR_VERSION >= 3
+    typedef cv::UMat DeviceMat;
+#elif OPENCLHOG_AVAILABLE
+    typedef cv::ocl::oclMat DeviceMat;
+#endif
+    cv::HOGDescriptor hog;
+    cv::HOGDescriptor blockHog; // HOG with a window of a single block, calculating block histogram grids
+    size_t descriptorSize;
+    size_t batchSize; // Maximum number of samples per mosaic
+    int tileStride; // Horizontal distance of neighbouring samples in the mosaic, 0 if the HOG parameters do not allow a mosaic
+    cv::Mat mosaic; // Host mosaic of the queued samples
+    std::vector<std::vector<float>*> queuedDescriptors; // Destination per queued sample
+    std::vector<float> mosaicDescriptors;
+    cv::Mat paddedImage;
+    std::vector<float> paddedHistograms;
+#if OPENCLHOG_AVAILABLE
+    DeviceMat deviceMosaic;
+    DeviceMat deviceImage;
+#endif
+#if OPENCLHOG_AVAILABLE && CV_MAJOR_VERSION < 3
+    cv::ocl::HOGDescriptor* deviceHog; // NULL if the ocl module does not implement the HOG parameters
+    cv::ocl::HOGDescriptor* deviceBlockHog;
+    cv::ocl::oclMat deviceDescriptors;
+    cv::Mat hostDescriptors;
+#endif
+
+    // Non-copyable, the object owns the device buffers
+    OpenCLHog(const OpenCLHog&);
+    OpenCLHog& operator=(const OpenCLHog&);
+
+    static bool& getEnabled() {
+        static bool enabled = false;
+        return enabled;
+    }
+
+    static void updateDifference(const std::vector<float>& a, const std::vector<float>& b, double& maxDifference) {
+        if (a.size() != b.size()) {
+            maxDifference = HUGE_VAL;
+            return;
+        }
+        for (size_t i = 0; i < a.size(); ++i) {
+            maxDifference = std::max(maxDifference, (double) fabs(a[i] - b[i]));
+        }
+    }
+
+#if OPENCLHOG_AVAILABLE
+    /**
+     * Calculates the descriptors of all windows of an image at the window stride on the device, without padding
+     * @param blocks true for the block histograms (window of a single block), false for the window descriptors
+     * @param image 8-bit grayscale image, uploaded to buffer
+     * @param winStride window stride, a multiple of the block stride
+     * @param buffer device buffer of the image, reused while the image size does not change
+     * @param descriptors resulting descriptors of all windows in row-major window order, empty if not supported
+     */
+    void computeOnDevice(bool blocks, const cv::Mat& image, const cv::Size& winStride, DeviceMat& buffer, std::vector<float>& descriptors) {
+#if CV_MAJOR_VERSION >= 3
+        image.copyTo(buffer);
+        (blocks ? blockHog : hog).compute(buffer, descriptors, winStride, cv::Size(0, 0));
+#else
+        cv::ocl::HOGDescriptor* device = blocks ? deviceBlockHog : deviceHog;
+        descriptors.clear();
+        if (device == NULL) {
+            return;
+        }
+        buffer.upload(image);
+        // Blocks column by column within a window, as the CPU path orders them
+        device->getDescriptors(buffer, winStride, deviceDescriptors, cv::ocl::HOGDescriptor::DESCR_FORMAT_COL_BY_COL);
+        deviceDescriptors.download(hostDescriptors);
+        descriptors.assign(hostDescriptors.ptr<float>(), hostDescriptors.ptr<float>() + hostDescriptors.total());
+#endif
+    }
+#endif
+
+public:
+
+    /**
+     * @param _hog HOG parameters
+     * @param _batchSize maximum number of window-sized samples uploaded and calculated together
+     */
+    OpenCLHog(const cv::HOGDescriptor& _hog, size_t _batchSize = 64) : hog(_hog), blockHog(_hog), batchSize(std::max(_batchSize, (size_t) 1)) {
+        hog.svmDetector.clear();
+        blockHog.svmDetector.clear();
+        blockHog.winSize = hog.blockSize;
+        descriptorSize = hog.getDescriptorSize();
+        // The windows of the mosaic must lie on the block grid, and the gap needs one column for each of both neighbours
+        bool tiled = (hog.blockStride.width >= 2 && hog.winSize.width % hog.blockStride.width == 0);
+#if OPENCLHOG_AVAILABLE && CV_MAJOR_VERSION < 3
+        // The ocl module initializes the device on construction, so only if enabled
+        const bool implemented = isEnabled() && hog.blockSize == cv::Size(16, 16) && hog.cellSize == cv::Size(8, 8) && hog.blockStride == cv::Size(8, 8)
+                && hog.nbins == 9 && hog.histogramNormType == cv::HOGDescriptor::L2Hys;
+        deviceHog = implemented ? new cv::ocl::HOGDescriptor(hog.winSize, hog.blockSize, hog.blockStride, hog.cellSize, hog.nbins, hog.getWinSigma(), hog.L2HysThreshold, hog.gammaCorrection) : NULL;
+        deviceBlockHog = implemented ? new cv::ocl::HOGDescriptor(blockHog.winSize, hog.blockSize, hog.blockStride, hog.cellSize, hog.nbins, hog.getWinSigma(), hog.L2HysThreshold, hog.gammaCorrection) : NULL;
+        tiled = tiled && (deviceHog != NULL);
+#endif
+        tileStride = tiled ? hog.winSize.width + hog.blockStride.width : 0;
+        if (tiled) {
+            mosaic.create(hog.winSize.height, (int) (batchSize - 1) * tileStride + hog.winSize.width, CV_8UC1);
+        }
+    }
+
+    virtual ~OpenCLHog() {
+#if OPENCLHOG_AVAILABLE && CV_MAJOR_VERSION < 3
+        delete deviceBlockHog;
+        delete deviceHog;
+#endif
+    }
+
+    /**
+     * Switches the OpenCL backend on or off for all objects, must be called before any worker thread uses it
+     * @param _enable
+     * @return true if the OpenCL backend is in use
+     */
+    static bool enable(bool _enable) {
+#if OPENCLHOG_AVAILABLE && CV_MAJOR_VERSION >= 3
+        if (_enable && !cv::ocl::haveOpenCL()) {
+            fprintf(stderr, "Warning: No OpenCL device available, HOG is calculated on the CPU\n");
+        }
+        cv::ocl::setUseOpenCL(_enable);
+        getEnabled() = _enable && cv::ocl::useOpenCL();
+#elif OPENCLHOG_AVAILABLE
+        cv::ocl::DevicesInfo devices;
+        getEnabled() = false;
+        if (_enable) {
+            if (cv::ocl::getOpenCLDevices(devices, cv::ocl::CVCL_DEVICE_TYPE_ALL) > 0) {
+                cv::ocl::setDevice(devices[0]);
+                getEnabled() = true;
+            } else {
+                fprintf(stderr, "Warning: No OpenCL device available, HOG is calculated on the CPU\n");
+            }
+        }
+#else
+        if (_enable) {
+            fprintf(stderr, "Warning: OpenCL requires OpenCV 3.0 or newer, or OpenCV 2.4.8 or newer with the ocl module, HOG is calculated on the CPU\n");
+        }
+        getEnabled() = false;
+#endif
+        return getEnabled();
+    }
+
+    static bool isEnabled() {
+        return getEnabled();
+    }
+
+    /**
+     * @return name of the OpenCL device in use, empty if the backend is disabled
+     */
+    static std::string getDeviceName() {
+#if OPENCLHOG_AVAILABLE
+        if (isEnabled()) {
+#if CV_MAJOR_VERSION >= 3
+            return std::string(cv::ocl::Device::getDefault().name().c_str());
+#else
+            return cv::ocl::Context::getContext()->getDeviceInfo().deviceName;
+#endif
+        }
+#endif
+        return std::string();
+    }
+
+    size_t getDescriptorSize() const {
+        return descriptorSize;
+    }
+
+    /**
+     * Queues a window-sized sample for calculation with the next batch, the descriptor is set by flush (called when the batch is full).
+     * Samples not matching the window size and all samples while the backend is disabled are calculated on the CPU immediately
+     * @param window 8-bit grayscale image of the window size, copied
+     * @param descriptor resulting descriptor, must stay valid until the next flush
+     */
+    void enqueue(const cv::Mat& window, std::vector<float>& descriptor) {
+        if (!isEnabled() || tileStride == 0 || window.type() != CV_8UC1 || window.size() != hog.winSize) {
+            hog.compute(window, descriptor);
+            return;
+        }
+        if (queuedDescriptors.size() >= batchSize) {
+            flush();
+        }
+        const int x = (int) queuedDescriptors.size() * tileStride;
+        const int width = hog.winSize.width;
+        window.copyTo(mosaic(cv::Rect(x, 0, width, hog.winSize.height)));
+        // Gap columns next to the sample hold its reflected border (BORDER_REFLECT_101), which the gradient at its border is calculated from
+        if (x > 0) {
+            window.col(1).copyTo(mosaic.col(x - 1));
+        }
+        if (x + width < mosaic.cols) {
+            window.col(width - 2).copyTo(mosaic.col(x + width));
+        }
+        queuedDescriptors.push_back(&descriptor);
+    }
+
+    /**
+     * Uploads the queued samples as one image and calculates their descriptors with one kernel run
+     */
+    void flush() {
+        const size_t windows = queuedDescriptors.size();
+        if (windows == 0) {
+            return;
+        }
+#if OPENCLHOG_AVAILABLE
+        // Only the filled part of the mosaic, its right border is reflected by the kernels as the gap would be
+        computeOnDevice(false, mosaic(cv::Rect(0, 0, (int) (windows - 1) * tileStride + hog.winSize.width, hog.winSize.height)),
+                cv::Size(tileStride, hog.blockStride.height), deviceMosaic, mosaicDescriptors);
+#endif
+        const bool valid = (mosaicDescriptors.size() == windows * descriptorSize);
+        if (!valid) {
+            printf("Error: Unexpected descriptor size %lu for a batch of %lu samples!\n", (unsigned long) mosaicDescriptors.size(), (unsigned long) windows);
+        }
+        for (size_t window = 0; window < windows; ++window) {
+            std::vector<float>& descriptor = *queuedDescriptors[window];
+            if (valid) {
+                descriptor.assign(mosaicDescriptors.begin() + window * descriptorSize, mosaicDescriptors.begin() + (window + 1) * descriptorSize);
+            } else {
+                descriptor.clear();
+            }
+        }
+        queuedDescriptors.clear();
+    }
+
+    /**
+     * Calculates the block histogram grid of an image, as blockHog.compute(image, histograms, blockHog.blockStride, padding) does on the CPU
+     * @param _blockHog HOGDescriptor with a window of a single block, as set up from the HOG parameters of this object
+     * @param image 8-bit grayscale image (or region of an image)
+     * @param padding padding around the image, a multiple of the block stride
+     * @param histograms resulting row-major grid of block histograms
+     * @return false if the OpenCL backend does not apply, the grid has to be calculated on the CPU
+     */
+    bool computeBlockGrid(const cv::HOGDescriptor& _blockHog, const cv::Mat& image, const cv::Size& padding, std::vector<float>& histograms) {
+        const cv::Size stride = blockHog.blockStride;
+        if (!isEnabled() || image.type() != CV_8UC1 || padding.width % stride.width != 0 || padding.height % stride.height != 0
+                || _blockHog.winSize != blockHog.winSize || _blockHog.blockStride != stride) {
+            return false;
+        }
+#if OPENCLHOG_AVAILABLE && CV_MAJOR_VERSION < 3
+        if (deviceBlockHog == NULL) {
+            return false;
+        }
+#endif
+        const cv::Size border(padding.width + stride.width, padding.height + stride.height);
+        // Padded on the host like the CPU path does, which reflects at the borders of the complete image if image is a region
+        cv::copyMakeBorder(image, paddedImage, border.height, border.height, border.width, border.width, cv::BORDER_REFLECT_101);
+#if OPENCLHOG_AVAILABLE
+        computeOnDevice(true, paddedImage, stride, deviceImage, paddedHistograms);
+#endif
+        const size_t blockHistogramSize = blockHog.getDescriptorSize();
+        const int paddedBlocksX = (paddedImage.cols - blockHog.winSize.width) / stride.width + 1;
+        const int paddedBlocksY = (paddedImage.rows - blockHog.winSize.height) / stride.height + 1;
+        const int blocksX = (image.cols + 2 * padding.width - blockHog.winSize.width) / stride.width + 1;
+        const int blocksY = (image.rows + 2 * padding.height - blockHog.winSize.height) / stride.height + 1;
+        if (paddedHistograms.size() != (size_t) paddedBlocksX * paddedBlocksY * blockHistogramSize || paddedBlocksX < blocksX + 1 || paddedBlocksY < blocksY + 1) {
+            return false;
+        }
+        // Drop the first row and column of blocks, which cover the extra border
+        histograms.resize((size_t) blocksX * blocksY * blockHistogramSize);
+        for (int by = 0; by < blocksY; ++by) {
+            const std::vector<float>::const_iterator row = paddedHistograms.begin() + ((size_t) (by + 1) * paddedBlocksX + 1) * blockHistogramSize;
+            std::copy(row, row + blocksX * blockHistogramSize, histograms.begin() + (size_t) by * blocksX * blockHistogramSize);
+        }
+        return true;
+    }
+
+    /**
+     * Compares the OpenCL backend with the CPU path on a synthetic test image (smoothed noise), for window descriptors and block histogram grids
+     * @param _hog HOG parameters
+     * @param gridPadding padding of the block histogram grids, as used for detection
+     * @return maximum absolute difference of all compared values, 0 if the backend is disabled
+     */
+    static double verify(const cv::HOGDescriptor& _hog, const cv::Size& gridPadding) {
+        if (!isEnabled()) {
+            return 0.0;
+        }
+        const cv::Size winSize = _hog.winSize;
+        cv::Mat image(2 * winSize.height, 3 * winSize.width, CV_8UC1);
+        cv::RNG rng(0x5eed);
+        rng.fill(image, cv::RNG::UNIFORM, cv::Scalar(0), cv::Scalar(256));
+        cv::GaussianBlur(image, image, cv::Size(5, 5), 1.5);
+        double maxDifference = 0.0;
+
+        // Window descriptors, some windows of the test image as one batch
+        OpenCLHog accelerator(_hog, 4);
+        const cv::Point corners[] = {cv::Point(0, 0), cv::Point(winSize.width, 0), cv::Point(winSize.width / 2, winSize.height / 3), cv::Point(2 * winSize.width, winSize.height)};
+        const size_t windows = sizeof (corners) / sizeof (corners[0]);
+        std::vector<cv::Mat> windowImages(windows);
+        std::vector< std::vector<float> > acceleratedDescriptors(windows);
+        std::vector<float> descriptor;
+        for (size_t window = 0; window < windows; ++window) {
+            windowImages[window] = image(cv::Rect(corners[window], winSize)).clone();
+            accelerator.enqueue(windowImages[window], acceleratedDescriptors[window]);
+        }
+        accelerator.flush();
+        for (size_t window = 0; window < windows; ++window) {
+            _hog.compute(windowImages[window], descriptor);
+            updateDifference(descriptor, acceleratedDescriptors[window], maxDifference);
+        }
+
+        // Block histogram grid of the complete test image
+        cv::HOGDescriptor blockHog(_hog);
+        blockHog.winSize = _hog.blockSize;
+        blockHog.svmDetector.clear();
+        const cv::Size padding((int) cv::alignSize(std::max(gridPadding.width, 0), _hog.blockStride.width), (int) cv::alignSize(std::max(gridPadding.height, 0), _hog.blockStride.height));
+        std::vector<float> histograms, acceleratedHistograms;
+        blockHog.compute(image, histograms, blockHog.blockStride, padding);
+        if (!accelerator.computeBlockGrid(blockHog, image, padding, acceleratedHistograms)) {
+            return HUGE_VAL;
+        }
+        updateDifference(histograms, acceleratedHistograms, maxDifference);
+        return maxDifference;
+    }
+};
+
+#endif	/* OPENCLHOG_H */
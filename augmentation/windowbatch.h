@@ -0,0 +1,181 @@
+/**
+ * @file:   windowbatch.h
+ * @brief:  Batched calculation of the descriptors of many windows of one image, e.g. augmented variants (mirrored, shifted
+ * and scaled crops) of a positive sample, returned as one contiguous row-major descriptor matrix.
+ *
+ * Windows whose positions are multiples of the block stride (relative to the padded image) are gathered from the block histogram grid,
+ * which is calculated once per image (@see detection/detectionengine.h). Other windows are calculated by a single hog.compute call
+ * with all window locations, sharing one gradient calculation. Variants are grouped by their image transform (mirroring, scale),
+ * so every distinct transformed image is calculated only once.
+ */
+
+#ifndef WINDOWBATCH_H
+#define	WINDOWBATCH_H
+
+#include <stdio.h>
+#include <vector>
+#include <algorithm>
+#include <opencv2/core/core.hpp>
+#include <opencv2/imgproc/imgproc.hpp>
+#include <opencv2/objdetect/objdetect.hpp>
+
+/**
+ * A variant of the centered window of an image
+ */
+struct WindowVariant {
+    cv::Point shift; // Offset of the window from the center of the (scaled) image in pixels
+    bool mirror; // Mirror the image horizontally, the shift applies to the mirrored image
+    double scale; // Resize the image by this factor before taking the window, 1 for the original size
+
+    WindowVariant(const cv::Point& _shift = cv::Point(0, 0), bool _mirror = false, double _scale = 1.0) : shift(_shift), mirror(_mirror), scale(_scale) {
+    }
+};
+
+class WindowBatchExtractor {
+private:
+    cv::HOGDescriptor hog;
+    cv::HOGDescriptor blockHog; // HOGDescriptor with a window of a single block, calculating the block histogram grid
+    cv::Size padding; // Aligned to the block stride, as openCV does
+    size_t descriptorSize;
+    int blockHistogramSize;
+    int blocksPerWindowX, blocksPerWindowY;
+    std::vector<float> histograms; // Row-major block histogram grid of the current image
+    std::vector<float> windowDescriptors;
+    std::vector<cv::Point> unalignedLocations;
+    std::vector<size_t> unalignedRows;
+    // Buffers of computeVariants, kept to avoid allocations per image
+    std::vector<char> variantDone;
+    std::vector<cv::Point> variantLocations;
+    std::vector<size_t> variantRows;
+    std::vector<float> groupDescriptors;
+    cv::Mat scaled, transformed;
+
+    bool isAligned(const cv::Point& location) const {
+        return (location.x + padding.width) % hog.blockStride.width == 0 && (location.y + padding.height) % hog.blockStride.height == 0;
+    }
+
+public:
+
+    /**
+     * @param _hog HOG parameters
+     * @param _padding padding around the image, windows may extend into it, e.g. by the maximum shift
+     */
+    WindowBatchExtractor(const cv::HOGDescriptor& _hog, cv::Size _padding = cv::Size(0, 0)) : hog(_hog), blockHog(_hog) {
+        hog.svmDetector.clear();
+        blockHog.svmDetector.clear();
+        blockHog.winSize = hog.blockSize;
+        descriptorSize = hog.getDescriptorSize();
+        blockHistogramSize = (int) blockHog.getDescriptorSize();
+        blocksPerWindowX = (hog.winSize.width - hog.blockSize.width) / hog.blockStride.width + 1;
+        blocksPerWindowY = (hog.winSize.height - hog.blockSize.height) / hog.blockStride.height + 1;
+        padding = cv::Size((int) cv::alignSize(std::max(_padding.width, 0), hog.blockStride.width), (int) cv::alignSize(std::max(_padding.height, 0), hog.blockStride.height));
+    }
+
+    size_t getDescriptorSize() const {
+        return descriptorSize;
+    }
+
+    /**
+     * Calculates the descriptors of windows of one image
+     * @param image grayscale image
+     * @param locations top left corners of the windows, clamped to the padded image
+     * @param descriptors resulting row-major matrix of locations.size() x getDescriptorSize() values, appended
+     */
+    void computeWindows(const cv::Mat& image, const std::vector<cv::Point>& locations, std::vector<float>& descriptors) {
+        const size_t firstRow = descriptors.size() / descriptorSize;
+        descriptors.resize((firstRow + locations.size()) * descriptorSize, 0.0f);
+        if (image.cols + 2 * padding.width < hog.winSize.width || image.rows + 2 * padding.height < hog.winSize.height) {
+            printf("Error: Image of %d x %d px is smaller than the HOG window, descriptors left empty!\n", image.cols, image.rows);
+            return;
+        }
+        unalignedLocations.clear();
+        unalignedRows.clear();
+        int blocksX = 0;
+        bool gridCalculated = false;
+        for (size_t window = 0; window < locations.size(); ++window) {
+            const cv::Point location(std::min(std::max(locations[window].x, -padding.width), image.cols + padding.width - hog.winSize.width),
+                    std::min(std::max(locations[window].y, -padding.height), image.rows + padding.height - hog.winSize.height));
+            if (!isAligned(location)) {
+                unalignedLocations.push_back(location);
+                unalignedRows.push_back(firstRow + window);
+                continue;
+            }
+            if (!gridCalculated) {
+                // Block histograms of the complete padded image, shared by all aligned windows
+                blocksX = (image.cols + 2 * padding.width - blockHog.winSize.width) / blockHog.blockStride.width + 1;
+                blockHog.compute(image, histograms, blockHog.blockStride, padding);
+                gridCalculated = true;
+            }
+            // Copy the blocks of the window in openCV order (block by block, column by column)
+            const int firstBlockX = (location.x + padding.width) / hog.blockStride.width;
+            const int firstBlockY = (location.y + padding.height) / hog.blockStride.height;
+            float* descriptor = &descriptors[(firstRow + window) * descriptorSize];
+            for (int bx = 0; bx < blocksPerWindowX; ++bx) {
+                for (int by = 0; by < blocksPerWindowY; ++by) {
+                    const size_t block = (size_t) (firstBlockY + by) * blocksX + firstBlockX + bx;
+                    if ((block + 1) * blockHistogramSize <= histograms.size()) {
+                        std::copy(&histograms[block * blockHistogramSize], &histograms[block * blockHistogramSize] + blockHistogramSize, descriptor);
+                    }
+                    descriptor += blockHistogramSize;
+                }
+            }
+        }
+        if (unalignedLocations.empty()) {
+            return;
+        }
+        // One gradient calculation for all remaining windows
+        hog.compute(image, windowDescriptors, hog.blockStride, padding, unalignedLocations);
+        if (windowDescriptors.size() != unalignedLocations.size() * descriptorSize) {
+            printf("Error: Unexpected descriptor size %lu for %lu windows!\n", (unsigned long) windowDescriptors.size(), (unsigned long) unalignedLocations.size());
+            return;
+        }
+        for (size_t window = 0; window < unalignedRows.size(); ++window) {
+            std::copy(&windowDescriptors[window * descriptorSize], &windowDescriptors[window * descriptorSize] + descriptorSize, &descriptors[unalignedRows[window] * descriptorSize]);
+        }
+    }
+
+    /**
+     * Calculates the descriptors of variants of the centered window of an image, each transformed image is calculated once
+     * @param image grayscale image, at least of the window size minus the padding
+     * @param variants
+     * @param descriptors resulting row-major matrix of variants.size() x getDescriptorSize() values in the order of the variants, appended
+     */
+    void computeVariants(const cv::Mat& image, const std::vector<WindowVariant>& variants, std::vector<float>& descriptors) {
+        const size_t firstRow = descriptors.size() / descriptorSize;
+        descriptors.resize((firstRow + variants.size()) * descriptorSize, 0.0f);
+        variantDone.assign(variants.size(), 0);
+        for (size_t first = 0; first < variants.size(); ++first) {
+            if (variantDone[first]) {
+                continue;
+            }
+            // All variants sharing the image transform of the first one not done yet
+            variantLocations.clear();
+            variantRows.clear();
+            const cv::Size scaledSize(cvRound(image.cols * variants[first].scale), cvRound(image.rows * variants[first].scale));
+            for (size_t variant = first; variant < variants.size(); ++variant) {
+                if (!variantDone[variant] && variants[variant].mirror == variants[first].mirror && variants[variant].scale == variants[first].scale) {
+                    variantLocations.push_back(cv::Point((scaledSize.width - hog.winSize.width) / 2 + variants[variant].shift.x, (scaledSize.height - hog.winSize.height) / 2 + variants[variant].shift.y));
+                    variantRows.push_back(firstRow + variant);
+                    variantDone[variant] = 1;
+                }
+            }
+            // The buffers never share the data of the input image, which would be flipped in place otherwise
+            const cv::Mat* source = &image;
+            if (scaledSize != image.size()) {
+                cv::resize(image, scaled, scaledSize, 0, 0, cv::INTER_LINEAR);
+                source = &scaled;
+            }
+            if (variants[first].mirror) {
+                cv::flip(*source, transformed, 1);
+                source = &transformed;
+            }
+            groupDescriptors.clear();
+            computeWindows(*source, variantLocations, groupDescriptors);
+            for (size_t row = 0; row < variantRows.size(); ++row) {
+                std::copy(&groupDescriptors[row * descriptorSize], &groupDescriptors[row * descriptorSize] + descriptorSize, &descriptors[variantRows[row] * descriptorSize]);
+            }
+        }
+    }
+};
+
+#endif	/* WINDOWBATCH_H */
@@ -0,0 +1,699 @@
+/**
+ * @file:   benchmark.cpp
+ * @brief:  Reproducible benchmark suite for feature extraction, feature serialization, SVM training and detection
+ * on synthetic data (fixed random seed), with the sample counts of a small synthetic set or of the INRIA person dataset.
+ *
+ * Suites:
+ * extraction: HOG compute throughput per 64x128 image, single-threaded and in parallel
+ * serialization: writing and parsing the features in binary feature store format and in SVMlight text format
+ * training: read_problem and training time of the SVM backend selected by TRAINHOG_USEDSVM at the given sample counts,
+ *   sample counts whose training data would exceed the memory budget are skipped, the dense backends train on the benchmark data in place
+ *   (1000000 samples of dimension 3780 need about 14.1 GB)
+ * detection: detectMultiScale (and the shared-pyramid DetectionEngine) frames per second at common resolutions,
+ *   and windows per second scoring HOG descriptors with the float32 and the quantized (float16, int8) detector
+ *
+ * Every measurement is the best of several repetitions. Results are written as JSON report and compared against a baseline file
+ * (lines of "name value"), the program exits with 1 if a result is worse than the baseline by more than the tolerance,
+ * or if the baseline file does not exist (record it with --update-baseline).
+ * The SVM backend is chosen at compile time, build one binary per backend (@see nbproject/Makefile-Benchmark.mk).
+ * Results of several binaries can share one baseline file, only the results produced by a run are compared and updated.
+ *
+ * Usage:
+ * benchmark [--suite all|extraction,serialization,training,detection] [--dataset synthetic|inria] [--training-sizes 10000,100000,1000000]
+ *   [--training-dimension 3780] [--max-memory-mb 16384] [--frames 10] [--repeat 3] [--threads 0] [--work-dir genfiles/]
+ *   [--output genfiles/benchmark.json] [--baseline benchmark/baseline.txt] [--tolerance 0.2] [--update-baseline]
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <sys/stat.h>
+#include <string>
+#include <vector>
+#include <map>
+#include <algorithm>
+#include <opencv2/core/core.hpp>
+#include <opencv2/imgproc/imgproc.hpp>
+#include <opencv2/objdetect/objdetect.hpp>
+#include "../featurestore/featurestore.h"
+#include "../featurestore/svmlightwriter.h"
+#include "../linearsvm/densevector.h"
+#include "../detection/detectionengine.h"
+#include "../detection/quantizeddetector.h"
+#include "../metrics/runmetrics.h"
+
+#define SVMLIGHT 1
+#define LIBSVM 2
+#define LINEARSVM 3
+#define SGDSVM 4
+
+#ifndef TRAINHOG_USEDSVM
+#define TRAINHOG_USEDSVM LINEARSVM
+#endif
+
+#if TRAINHOG_USEDSVM == SVMLIGHT
+    #include "../svmlight/svmlight.h"
+    #define TRAINHOG_SVM_TO_TRAIN SVMlight
+    #define TRAINHOG_SVM_NAME "svmlight"
+    // Bytes per feature value held by the backend in addition to the benchmark data (sparse WORD of index and value)
+    #define TRAINHOG_SVM_BYTES_PER_VALUE 8
+    // The backend trains on the benchmark data in place (setSharedProblem) instead of copying it with read_problem
+    #define TRAINHOG_SVM_SHARES_PROBLEM 0
+#elif TRAINHOG_USEDSVM == LIBSVM
+    #include "../libsvm/libsvm.h"
+    #define TRAINHOG_SVM_TO_TRAIN libSVM
+    #define TRAINHOG_SVM_NAME "libsvm"
+    #define TRAINHOG_SVM_BYTES_PER_VALUE 16 // svm_node of index and double value
+    #define TRAINHOG_SVM_SHARES_PROBLEM 0
+#elif TRAINHOG_USEDSVM == LINEARSVM
+    #include "../linearsvm/linearsvm.h"
+    #define TRAINHOG_SVM_TO_TRAIN LinearSVM
+    #define TRAINHOG_SVM_NAME "linearsvm"
+    #define TRAINHOG_SVM_BYTES_PER_VALUE 0
+    #define TRAINHOG_SVM_SHARES_PROBLEM 1
+#elif TRAINHOG_USEDSVM == SGDSVM
+    #include "../sgdsvm/sgdsvm.h"
+    #define TRAINHOG_SVM_TO_TRAIN SgdSVM
+    #define TRAINHOG_SVM_NAME "sgdsvm"
+    #define TRAINHOG_SVM_BYTES_PER_VALUE 0
+    #define TRAINHOG_SVM_SHARES_PROBLEM 1
+#endif
+
+using namespace std;
+using namespace cv;
+
+
+// Benchmark suites to run, comma separated or "all"
+static string suites = "all";
+// Sample counts of the extraction and serialization suites, "synthetic" (small, quick) or "inria" (2416 positive and 12180 negative training windows)
+static string dataset = "synthetic";
+// Sample counts of the training suite
+static string trainingSizes = "10000,100000,1000000";
+// Feature dimension of the training suite, 3780 is the descriptor size of the default 64x128 HOG window
+static int trainingDimension = 3780;
+// Training data exceeding this budget (benchmark data and backend structures) is skipped
+static long maxMemoryMegabytes = 16384;
+// Number of frames per resolution of the detection suite
+static int detectionFrames = 10;
+// Every measurement is repeated and the best run is taken, reducing the noise of other processes
+static int repetitions = 3;
+// Number of threads used by openCV (parallel extraction and detection), 0 for the openCV default
+static int threads = 0;
+// Directory for the temporary feature files of the serialization suite
+static string workDir = "genfiles/";
+// JSON report of all results
+static string outputFile = "genfiles/benchmark.json";
+// Baseline results to compare against, empty to disable the comparison
+static string baselineFile = "";
+// Allowed relative regression against the baseline, e.g. 0.2 for 20 %
+static double tolerance = 0.2;
+// Write the results of this run to the baseline file instead of comparing
+static bool updateBaseline = false;
+// Fixed seed of the synthetic data, so every run measures the same data
+static const uint64_t syntheticSeed = 0x5eed;
+
+struct BenchmarkResult {
+    string name;
+    double value;
+    string unit;
+    bool higherIsBetter;
+};
+
+static vector<BenchmarkResult> results;
+static RunMetrics runMetrics;
+
+
+// <editor-fold defaultstate="collapsed" desc="Helpers">
+static void addResult(const string& name, double value, const string& unit, bool higherIsBetter) {
+    BenchmarkResult result;
+    result.name = name;
+    result.value = value;
+    result.unit = unit;
+    result.higherIsBetter = higherIsBetter;
+    results.push_back(result);
+    runMetrics.setValue(name, value);
+    printf("\t%-48s %14.3f %s\n", name.c_str(), value, unit.c_str());
+}
+
+static bool hasSuite(const string& suite) {
+    return (suites == "all" || ("," + suites + ",").find("," + suite + ",") != string::npos);
+}
+
+static bool parseSizes(const string& text, vector<long>& sizes) {
+    sizes.clear();
+    const char* position = text.c_str();
+    while (*position != '\0') {
+        char* end;
+        const long size = strtol(position, &end, 10);
+        if (end == position || size <= 0 || (*end != ',' && *end != '\0')) {
+            return false;
+        }
+        sizes.push_back(size);
+        position = (*end == ',') ? end + 1 : end;
+    }
+    return !sizes.empty();
+}
+
+/**
+ * Synthetic grayscale image of smooth noise with random lines and rectangles, giving gradients of all orientations
+ * @param size
+ * @param rng
+ * @return
+ */
+static Mat makeSyntheticImage(const Size& size, RNG& rng) {
+    Mat image(size, CV_8UC1);
+    rng.fill(image, RNG::UNIFORM, Scalar(0), Scalar(256));
+    GaussianBlur(image, image, Size(5, 5), 1.5);
+    const int shapes = std::max(4, size.area() / 2048);
+    for (int shape = 0; shape < shapes; ++shape) {
+        const Point p1(rng.uniform(0, size.width), rng.uniform(0, size.height));
+        const Point p2(rng.uniform(0, size.width), rng.uniform(0, size.height));
+        const Scalar color(rng.uniform(0, 256));
+        if (shape % 2 == 0) {
+            line(image, p1, p2, color, rng.uniform(1, 4));
+        } else {
+            rectangle(image, p1, p2, color, rng.uniform(1, 3));
+        }
+    }
+    return image;
+}
+
+/**
+ * Synthetic training data, the classes differ by a shift along a fixed random direction and a part of the labels is flipped
+ * @param sampleCount
+ * @param dimension
+ * @param labels
+ * @param features row-major, sampleCount x dimension
+ */
+static void makeTrainingData(long sampleCount, int dimension, vector<float>& labels, vector<float>& features) {
+    RNG rng(syntheticSeed);
+    vector<float> direction(dimension);
+    for (int i = 0; i < dimension; ++i) {
+        direction[i] = (rng.uniform(0.0f, 1.0f) < 0.5f) ? 0.02f : -0.02f;
+    }
+    labels.resize(sampleCount);
+    features.resize((size_t) sampleCount * dimension);
+    for (long sample = 0; sample < sampleCount; ++sample) {
+        const bool positive = (sample % 2 == 0);
+        labels[sample] = ((rng.uniform(0.0f, 1.0f) < 0.05f) != positive) ? 1.0f : -1.0f; // 5 % label noise
+        float* values = &features[(size_t) sample * dimension];
+        for (int i = 0; i < dimension; ++i) {
+            values[i] = std::max(0.0f, rng.uniform(0.0f, 0.2f) + (positive ? direction[i] : 0.0f));
+        }
+    }
+}
+
+/**
+ * Parses a SVMlight text file into dense features
+ * @param fileName
+ * @param dimension expected number of features per sample
+ * @param labels
+ * @param features row-major, labels.size() x dimension
+ * @return false if the file could not be read or contains invalid lines
+ */
+static bool parseSvmLightFile(const string& fileName, size_t dimension, vector<float>& labels, vector<float>& features) {
+    FILE* fp = fopen(fileName.c_str(), "r");
+    if (fp == NULL) {
+        printf("Error opening file '%s'!\n", fileName.c_str());
+        return false;
+    }
+    labels.clear();
+    features.clear();
+    vector<char> line(1 << 20);
+    bool success = true;
+    while (success && fgets(&line[0], (int) line.size(), fp) != NULL) {
+        size_t length = strlen(&line[0]);
+        while (length == line.size() - 1 && line[length - 1] != '\n') {
+            // Line longer than the buffer, continue reading into the enlarged buffer
+            line.resize(line.size() * 2);
+            if (fgets(&line[length], (int) (line.size() - length), fp) == NULL) {
+                break;
+            }
+            length += strlen(&line[length]);
+        }
+        if (line[0] == '#' || line[0] == '\n') {
+            continue;
+        }
+        char* position = &line[0];
+        labels.push_back((float) strtod(position, &position));
+        features.resize(labels.size() * dimension, 0.0f);
+        float* values = &features[(labels.size() - 1) * dimension];
+        while (*position == ' ') {
+            char* end;
+            const unsigned long index = strtoul(position + 1, &end, 10);
+            if (end == position + 1 || *end != ':' || index == 0 || index > dimension) {
+                success = (*end == '\0' || *end == '\n' || *end == '#');
+                break;
+            }
+            values[index - 1] = (float) strtod(end + 1, &position);
+        }
+    }
+    fclose(fp);
+    if (!success) {
+        printf("Error: Invalid line %lu in '%s'!\n", (unsigned long) labels.size(), fileName.c_str());
+    }
+    return success;
+}
+
+static long fileSize(const string& fileName) {
+    struct stat status;
+    return (stat(fileName.c_str(), &status) == 0) ? (long) status.st_size : 0;
+}
+// </editor-fold>
+
+// <editor-fold defaultstate="collapsed" desc="Parallel loop bodies">
+/**
+ * Calculates the descriptors of a range of images, one HOGDescriptor::compute call per image
+ */
+class HogComputeBody : public ParallelLoopBody {
+private:
+    const HOGDescriptor& hog;
+    const vector<Mat>& images;
+
+public:
+
+    HogComputeBody(const HOGDescriptor& _hog, const vector<Mat>& _images) : hog(_hog), images(_images) {
+    }
+
+    void operator()(const Range& range) const {
+        vector<float> descriptors;
+        for (int image = range.start; image < range.end; ++image) {
+            hog.compute(images[image], descriptors, Size(8, 8), Size(0, 0));
+        }
+    }
+};
+// </editor-fold>
+
+// <editor-fold defaultstate="collapsed" desc="Suites">
+static void benchmarkExtraction(const vector<Mat>& images) {
+    printf("Extraction: HOG compute of %lu images of 64x128 px\n", (unsigned long) images.size());
+    const HOGDescriptor hog;
+    double bestSerial = 0.0, bestParallel = 0.0;
+    for (int repetition = 0; repetition < repetitions; ++repetition) {
+        const HogComputeBody serialBody(hog, images);
+        double start = RunMetrics::now();
+        serialBody(Range(0, (int) images.size()));
+        const double serial = RunMetrics::now() - start;
+        runMetrics.addStage("extraction_serial", serial, images.size());
+        start = RunMetrics::now();
+        parallel_for_(Range(0, (int) images.size()), HogComputeBody(hog, images));
+        const double parallel = RunMetrics::now() - start;
+        runMetrics.addStage("extraction_parallel", parallel, images.size());
+        bestSerial = (repetition == 0) ? serial : std::min(bestSerial, serial);
+        bestParallel = (repetition == 0) ? parallel : std::min(bestParallel, parallel);
+    }
+    addResult("hog_compute_images_per_second", images.size() / bestSerial, "images/s", true);
+    addResult("hog_compute_parallel_images_per_second", images.size() / bestParallel, "images/s", true);
+}
+
+static void benchmarkSerialization(const vector<Mat>& images) {
+    const HOGDescriptor hog;
+    const size_t dimension = hog.getDescriptorSize();
+    printf("Serialization: %lu samples of dimension %lu\n", (unsigned long) images.size(), (unsigned long) dimension);
+    vector<float> labels(images.size());
+    vector<float> features(images.size() * dimension);
+    vector<float> descriptors;
+    for (size_t sample = 0; sample < images.size(); ++sample) {
+        labels[sample] = (sample % 2 == 0) ? 1.0f : -1.0f;
+        hog.compute(images[sample], descriptors, Size(8, 8), Size(0, 0));
+        std::copy(descriptors.begin(), descriptors.end(), &features[sample * dimension]);
+    }
+    FeatureStoreHogParams hogParams;
+    memset(&hogParams, 0, sizeof (hogParams)); // The benchmark files are never checked against HOG settings
+    const string binaryFile = workDir + "benchmark_features.dat";
+    const string textFile = workDir + "benchmark_features.txt";
+    const double sampleCount = (double) images.size();
+    double best[4] = {0.0, 0.0, 0.0, 0.0};
+    for (int repetition = 0; repetition < repetitions; ++repetition) {
+        double seconds[4];
+        double start = RunMetrics::now();
+        FeatureStoreWriter binaryWriter;
+        bool success = binaryWriter.open(binaryFile, dimension, images.size(), hogParams);
+        for (size_t sample = 0; success && sample < images.size(); ++sample) {
+            success = binaryWriter.addSample(labels[sample], &features[sample * dimension]);
+        }
+        if (!binaryWriter.close() || !success) {
+            printf("Error: Serialization benchmark could not write '%s'!\n", binaryFile.c_str());
+            return;
+        }
+        seconds[0] = RunMetrics::now() - start;
+
+        start = RunMetrics::now();
+        FeatureStoreMapping mapping;
+        if (!mapping.open(binaryFile.c_str()) || mapping.getCount() != images.size()) {
+            printf("Error: Serialization benchmark could not read '%s'!\n", binaryFile.c_str());
+            return;
+        }
+        // Touch every value, the mapping itself does not read the file
+        double checksum = 0.0;
+        for (uint64_t firstSample = 0; firstSample < mapping.getCount(); firstSample += FEATURESTORE_CHUNK_SAMPLES) {
+            const uint64_t chunkSamples = std::min((uint64_t) FEATURESTORE_CHUNK_SAMPLES, mapping.getCount() - firstSample);
+            const float* values = mapping.getSample(firstSample);
+            for (uint64_t i = 0; i < chunkSamples * dimension; ++i) {
+                checksum += values[i];
+            }
+            mapping.releaseSamples(firstSample, chunkSamples);
+        }
+        seconds[1] = RunMetrics::now() - start;
+
+        start = RunMetrics::now();
+        SvmLightWriter textWriter;
+        success = textWriter.open(textFile);
+        for (size_t sample = 0; success && sample < images.size(); ++sample) {
+            textWriter.writeSample(labels[sample], &features[sample * dimension], dimension);
+        }
+        if (!textWriter.close() || !success) {
+            printf("Error: Serialization benchmark could not write '%s'!\n", textFile.c_str());
+            return;
+        }
+        seconds[2] = RunMetrics::now() - start;
+
+        start = RunMetrics::now();
+        vector<float> parsedLabels, parsedFeatures;
+        if (!parseSvmLightFile(textFile, dimension, parsedLabels, parsedFeatures) || parsedLabels.size() != images.size()) {
+            printf("Error: Serialization benchmark could not parse '%s'!\n", textFile.c_str());
+            return;
+        }
+        seconds[3] = RunMetrics::now() - start;
+        if (repetition == 0 && parsedFeatures != features) {
+            printf("Warning: Parsed text features differ from the written features (checksum %.3f)\n", checksum);
+        }
+        for (int measurement = 0; measurement < 4; ++measurement) {
+            best[measurement] = (repetition == 0) ? seconds[measurement] : std::min(best[measurement], seconds[measurement]);
+        }
+        runMetrics.addStage("serialization_binary_write", seconds[0], images.size(), fileSize(binaryFile));
+        runMetrics.addStage("serialization_binary_read", seconds[1], images.size(), fileSize(binaryFile));
+        runMetrics.addStage("serialization_text_write", seconds[2], images.size(), fileSize(textFile));
+        runMetrics.addStage("serialization_text_parse", seconds[3], images.size(), fileSize(textFile));
+    }
+    addResult("binary_write_samples_per_second", sampleCount / best[0], "samples/s", true);
+    addResult("binary_read_samples_per_second", sampleCount / best[1], "samples/s", true);
+    addResult("text_write_samples_per_second", sampleCount / best[2], "samples/s", true);
+    addResult("text_parse_samples_per_second", sampleCount / best[3], "samples/s", true);
+    addResult("binary_bytes_per_sample", fileSize(binaryFile) / sampleCount, "bytes", false);
+    addResult("text_bytes_per_sample", fileSize(textFile) / sampleCount, "bytes", false);
+    remove(binaryFile.c_str());
+    remove(textFile.c_str());
+}
+
+static void benchmarkTraining(const vector<long>& sizes) {
+    for (size_t size = 0; size < sizes.size(); ++size) {
+        const long sampleCount = sizes[size];
+        const double megabytes = (double) sampleCount * trainingDimension * (sizeof (float) + TRAINHOG_SVM_BYTES_PER_VALUE) / (1024.0 * 1024.0);
+        if (megabytes > maxMemoryMegabytes) {
+            printf("Training: Skipping %ld samples, needing about %.0f MB of the %ld MB budget\n", sampleCount, megabytes, maxMemoryMegabytes);
+            continue;
+        }
+        printf("Training: %s with %ld samples of dimension %d\n", TRAINHOG_SVM_NAME, sampleCount, trainingDimension);
+        vector<float> labels, features;
+        makeTrainingData(sampleCount, trainingDimension, labels, features);
+        char prefix[64];
+        snprintf(prefix, sizeof (prefix), "train_%s_%ld_", TRAINHOG_SVM_NAME, sampleCount);
+        double bestRead = 0.0, bestTrain = 0.0;
+        for (int repetition = 0; repetition < repetitions; ++repetition) {
+            double start = RunMetrics::now();
+#if TRAINHOG_SVM_SHARES_PROBLEM
+            TRAINHOG_SVM_TO_TRAIN::getInstance()->setSharedProblem(&labels[0], &features[0], sampleCount, trainingDimension);
+#else
+            TRAINHOG_SVM_TO_TRAIN::getInstance()->read_problem(labels, features);
+#endif
+            const double readSeconds = RunMetrics::now() - start;
+            start = RunMetrics::now();
+            TRAINHOG_SVM_TO_TRAIN::getInstance()->train();
+            const double trainSeconds = RunMetrics::now() - start;
+            runMetrics.addStage(string(prefix) + "read_problem", readSeconds, sampleCount);
+            runMetrics.addStage(string(prefix) + "train", trainSeconds, sampleCount);
+            bestRead = (repetition == 0) ? readSeconds : std::min(bestRead, readSeconds);
+            bestTrain = (repetition == 0) ? trainSeconds : std::min(bestTrain, trainSeconds);
+        }
+        // Training accuracy of the resulting detector, guarding against a faster but broken solver
+        vector<float> detector;
+        vector<unsigned int> detectorIndices;
+        TRAINHOG_SVM_TO_TRAIN::getInstance()->getSingleDetectingVector(detector, detectorIndices);
+        const double threshold = TRAINHOG_SVM_TO_TRAIN::getInstance()->getThreshold();
+        long correct = 0;
+        if (detector.size() >= (size_t) trainingDimension) {
+            const double rho = (detector.size() > (size_t) trainingDimension) ? detector[trainingDimension] : 0.0;
+            vector<double> scores(sampleCount);
+            denseGemv(&features[0], sampleCount, trainingDimension, &detector[0], rho - threshold, &scores[0]);
+            for (long sample = 0; sample < sampleCount; ++sample) {
+                correct += ((scores[sample] > 0.0) == (labels[sample] > 0.0f));
+            }
+        }
+        addResult(string(prefix) + "read_problem_seconds", bestRead, "s", false);
+        addResult(string(prefix) + "seconds", bestTrain, "s", false);
+        addResult(string(prefix) + "accuracy", (double) correct / sampleCount, "", true);
+    }
+}
+
+static void benchmarkDetection() {
+    const Size resolutions[] = {Size(640, 480), Size(1280, 720), Size(1920, 1080)};
+    HOGDescriptor hog;
+    hog.setSVMDetector(HOGDescriptor::getDefaultPeopleDetector());
+    RNG rng(syntheticSeed);
+    for (size_t resolution = 0; resolution < sizeof (resolutions) / sizeof (resolutions[0]); ++resolution) {
+        const Size& size = resolutions[resolution];
+        printf("Detection: %d frames of %d x %d px\n", detectionFrames, size.width, size.height);
+        vector<Mat> frames;
+        for (int frame = 0; frame < detectionFrames; ++frame) {
+            frames.push_back(makeSyntheticImage(size, rng));
+        }
+        DetectionEngine engine(hog, 0.0, Size(8, 8), Size(8, 8), 1.05);
+        double bestDetect = 0.0, bestEngine = 0.0;
+        for (int repetition = 0; repetition < repetitions; ++repetition) {
+            vector<Rect> found;
+            vector<double> foundWeights;
+            double start = RunMetrics::now();
+            for (int frame = 0; frame < detectionFrames; ++frame) {
+                hog.detectMultiScale(frames[frame], found, foundWeights, 0.0, Size(8, 8), Size(8, 8), 1.05, 0.0);
+            }
+            const double detectSeconds = RunMetrics::now() - start;
+            vector< vector<Rect> > engineFound;
+            vector< vector<double> > engineWeights;
+            start = RunMetrics::now();
+            for (int frame = 0; frame < detectionFrames; ++frame) {
+                engine.setImage(frames[frame]);
+                engine.detect(engineFound, engineWeights);
+            }
+            const double engineSeconds = RunMetrics::now() - start;
+            runMetrics.addStage("detection_detectmultiscale", detectSeconds, detectionFrames, (uint64_t) detectionFrames * size.area());
+            runMetrics.addStage("detection_engine", engineSeconds, detectionFrames, (uint64_t) detectionFrames * size.area());
+            bestDetect = (repetition == 0) ? detectSeconds : std::min(bestDetect, detectSeconds);
+            bestEngine = (repetition == 0) ? engineSeconds : std::min(bestEngine, engineSeconds);
+        }
+        char prefix[64];
+        snprintf(prefix, sizeof (prefix), "detect_%dx%d_", size.width, size.height);
+        addResult(string(prefix) + "detectmultiscale_fps", detectionFrames / bestDetect, "fps", true);
+        addResult(string(prefix) + "engine_fps", detectionFrames / bestEngine, "fps", true);
+    }
+}
+
+static void benchmarkWindowScoring() {
+    const int windows = 4096;
+    HOGDescriptor hog;
+    const vector<float> detector = HOGDescriptor::getDefaultPeopleDetector();
+    const long dimension = (long) hog.getDescriptorSize();
+    printf("Detection: Scoring %d windows with the float32, float16 and int8 detector\n", windows);
+    RNG rng(syntheticSeed);
+    vector<float> descriptors((size_t) windows * dimension);
+    vector<float> descriptor;
+    for (int window = 0; window < windows; ++window) {
+        hog.compute(makeSyntheticImage(hog.winSize, rng), descriptor);
+        copy(descriptor.begin(), descriptor.end(), descriptors.begin() + (size_t) window * dimension);
+    }
+    FeatureStoreHogParams hogParams;
+    memset(&hogParams, 0, sizeof (hogParams));
+    const uint32_t blockLength = (uint32_t) (hog.nbins * (hog.blockSize.width / hog.cellSize.width) * (hog.blockSize.height / hog.cellSize.height));
+    QuantizedDetector halfDetector, int8Detector;
+    halfDetector.quantize(detector, dimension, QUANTIZED_FLOAT16, blockLength, 0.0, hogParams);
+    int8Detector.quantize(detector, dimension, QUANTIZED_INT8, blockLength, 0.0, hogParams);
+    const char* names[] = {"float32", "float16", "int8"};
+    double best[3] = {0.0, 0.0, 0.0};
+    double checksum = 0.0; // Keeps the compiler from dropping the scoring
+    for (int repetition = 0; repetition < repetitions; ++repetition) {
+        for (int format = 0; format < 3; ++format) {
+            const double start = RunMetrics::now();
+            for (int window = 0; window < windows; ++window) {
+                const float* features = &descriptors[(size_t) window * dimension];
+                checksum += (format == 0) ? denseDot(&detector[0], features, dimension) : (format == 1 ? halfDetector : int8Detector).score(features);
+            }
+            const double seconds = RunMetrics::now() - start;
+            runMetrics.addStage(string("scoring_") + names[format], seconds, windows);
+            best[format] = (repetition == 0) ? seconds : std::min(best[format], seconds);
+        }
+    }
+    for (int format = 0; format < 3; ++format) {
+        addResult(string("score_") + names[format] + "_windows_per_second", windows / best[format], "windows/s", true);
+    }
+    printf("\tScore checksum %g\n", checksum);
+}
+// </editor-fold>
+
+// <editor-fold defaultstate="collapsed" desc="Baseline">
+static bool readBaseline(const string& fileName, map<string, double>& baseline) {
+    baseline.clear();
+    FILE* fp = fopen(fileName.c_str(), "r");
+    if (fp == NULL) {
+        return false;
+    }
+    char line[512];
+    while (fgets(line, sizeof (line), fp) != NULL) {
+        char name[256];
+        double value;
+        if (line[0] != '#' && sscanf(line, "%255s %lf", name, &value) == 2) {
+            baseline[name] = value;
+        }
+    }
+    fclose(fp);
+    return true;
+}
+
+/**
+ * Adds the results of this run to the baseline file, keeping the results of other benchmark binaries
+ * @param fileName
+ * @return true on success
+ */
+static bool writeBaseline(const string& fileName) {
+    map<string, double> baseline;
+    readBaseline(fileName, baseline);
+    for (size_t result = 0; result < results.size(); ++result) {
+        baseline[results[result].name] = results[result].value;
+    }
+    FILE* fp = fopen(fileName.c_str(), "w");
+    if (fp == NULL) {
+        printf("Error opening file '%s'!\n", fileName.c_str());
+        return false;
+    }
+    fprintf(fp, "# Benchmark baseline, written by benchmark --update-baseline\n");
+    for (map<string, double>::const_iterator entry = baseline.begin(); entry != baseline.end(); ++entry) {
+        fprintf(fp, "%s %.6g\n", entry->first.c_str(), entry->second);
+    }
+    return (fclose(fp) == 0);
+}
+
+/**
+ * Compares the results against the baseline
+ * @param baseline
+ * @return number of results worse than the baseline by more than the tolerance
+ */
+static int countRegressions(const map<string, double>& baseline) {
+    int regressions = 0;
+    printf("Comparing against baseline '%s' with a tolerance of %.0f %%\n", baselineFile.c_str(), tolerance * 100.0);
+    for (size_t r = 0; r < results.size(); ++r) {
+        const BenchmarkResult& result = results[r];
+        map<string, double>::const_iterator entry = baseline.find(result.name);
+        if (entry == baseline.end() || entry->second <= 0.0) {
+            printf("\t%-48s no baseline\n", result.name.c_str());
+            continue;
+        }
+        const double change = result.value / entry->second - 1.0;
+        const bool regression = result.higherIsBetter ? (change < -tolerance) : (change > tolerance);
+        printf("\t%-48s %+7.1f %%%s\n", result.name.c_str(), change * 100.0, regression ? "  REGRESSION" : "");
+        regressions += regression;
+    }
+    return regressions;
+}
+// </editor-fold>
+
+int main(int argc, char** argv) {
+    for (int arg = 1; arg < argc; ++arg) {
+        const string option = argv[arg];
+        const bool hasValue = (arg + 1 < argc);
+        if (option == "--suite" && hasValue) {
+            suites = argv[++arg];
+        } else if (option == "--dataset" && hasValue) {
+            dataset = argv[++arg];
+        } else if (option == "--training-sizes" && hasValue) {
+            trainingSizes = argv[++arg];
+        } else if (option == "--training-dimension" && hasValue) {
+            trainingDimension = atoi(argv[++arg]);
+        } else if (option == "--max-memory-mb" && hasValue) {
+            maxMemoryMegabytes = atol(argv[++arg]);
+        } else if (option == "--frames" && hasValue) {
+            detectionFrames = atoi(argv[++arg]);
+        } else if (option == "--repeat" && hasValue) {
+            repetitions = atoi(argv[++arg]);
+        } else if (option == "--threads" && hasValue) {
+            threads = atoi(argv[++arg]);
+        } else if (option == "--work-dir" && hasValue) {
+            workDir = argv[++arg];
+        } else if (option == "--output" && hasValue) {
+            outputFile = argv[++arg];
+        } else if (option == "--baseline" && hasValue) {
+            baselineFile = argv[++arg];
+        } else if (option == "--tolerance" && hasValue) {
+            tolerance = atof(argv[++arg]);
+        } else if (option == "--update-baseline") {
+            updateBaseline = true;
+        } else {
+            printf("Error: Unknown or incomplete option '%s'!\n", option.c_str());
+            return EXIT_FAILURE;
+        }
+    }
+    vector<long> sizes;
+    if (!parseSizes(trainingSizes, sizes) || trainingDimension <= 0 || detectionFrames <= 0 || repetitions <= 0 || (dataset != "synthetic" && dataset != "inria")) {
+        printf("Error: Invalid benchmark settings!\n");
+        return EXIT_FAILURE;
+    }
+    if (!workDir.empty() && workDir[workDir.size() - 1] != '/') {
+        workDir += '/';
+    }
+    if (threads > 0) {
+        setNumThreads(threads);
+    }
+    runMetrics.setValue("backend", string(TRAINHOG_SVM_NAME));
+    runMetrics.setValue("dataset", dataset);
+    runMetrics.setValue("threads", (long) getNumThreads());
+
+    if (hasSuite("extraction") || hasSuite("serialization")) {
+        // INRIA person training set: 2416 positive windows and 12180 negative windows
+        const int imageCount = (dataset == "inria") ? 2416 + 12180 : 1000;
+        RNG rng(syntheticSeed);
+        vector<Mat> images;
+        images.reserve(imageCount);
+        for (int image = 0; image < imageCount; ++image) {
+            images.push_back(makeSyntheticImage(Size(64, 128), rng));
+        }
+        if (hasSuite("extraction")) {
+            benchmarkExtraction(images);
+        }
+        if (hasSuite("serialization")) {
+            benchmarkSerialization(images);
+        }
+    }
+    if (hasSuite("training")) {
+        benchmarkTraining(sizes);
+    }
+    if (hasSuite("detection")) {
+        benchmarkDetection();
+        benchmarkWindowScoring();
+    }
+
+    runMetrics.printSummary();
+    if (!outputFile.empty() && runMetrics.writeJson(outputFile)) {
+        printf("Benchmark report written to '%s'\n", outputFile.c_str());
+    }
+    if (baselineFile.empty()) {
+        return EXIT_SUCCESS;
+    }
+    if (updateBaseline) {
+        if (!writeBaseline(baselineFile)) {
+            return EXIT_FAILURE;
+        }
+        printf("Baseline '%s' updated\n", baselineFile.c_str());
+        return EXIT_SUCCESS;
+    }
+    map<string, double> baseline;
+    if (!readBaseline(baselineFile, baseline)) {
+        printf("Error: No baseline '%s' found, create one with --update-baseline!\n", baselineFile.c_str());
+        return EXIT_FAILURE;
+    }
+    const int regressions = countRegressions(baseline);
+    if (regressions > 0) {
+        printf("Error: %d benchmark results regressed beyond the tolerance!\n", regressions);
+        return EXIT_FAILURE;
+    }
+    printf("No regressions\n");
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,343 @@
+/**
+ * @file:   filelist.h
+ * @brief:  Collects the sample image files of a training run, either by enumerating directories (optionally recursively,
+ * e.g. datasets sharded into subdirectories, with several threads listing directories in parallel) or from a manifest file
+ * listing every sample with its label, so that large datasets can skip the file system scan entirely.
+ *
+ * Manifest format: one "<path> <label>" line per sample, the label is the last token of the line (1, +1, pos or positive;
+ * -1, 0, neg or negative), lines starting with # are comments. Relative paths are relative to the directory of the manifest.
+ *
+ * The file lists can be collected into a FileNameList, storing all paths in one contiguous buffer instead of one heap string per file.
+ */
+
+#ifndef FILELIST_H
+#define	FILELIST_H
+
+#include <stdio.h>
+#include <string.h>
+#include <strings.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <pthread.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <string>
+#include <vector>
+#include <deque>
+#include <algorithm>
+
+/**
+ * Contiguous list of file names (an arena of 0-terminated paths and their offsets), two allocations for any number of files
+ */
+class FileNameList {
+private:
+    std::vector<char> names;
+    std::vector<size_t> offsets;
+
+public:
+
+    void push_back(const std::string& fileName) {
+        offsets.push_back(names.size());
+        names.insert(names.end(), fileName.begin(), fileName.end());
+        names.push_back('\0');
+    }
+
+    /**
+     * @param index
+     * @return 0-terminated path, valid until the next push_back
+     */
+    const char* operator[](size_t index) const {
+        return &names[offsets[index]];
+    }
+
+    const char* at(size_t index) const {
+        return &names[offsets.at(index)];
+    }
+
+    size_t size() const {
+        return offsets.size();
+    }
+
+    bool empty() const {
+        return offsets.empty();
+    }
+
+    void clear() {
+        names.clear();
+        offsets.clear();
+    }
+};
+
+class DirectoryScanner {
+private:
+    std::vector<std::string> extensions; // Valid file extensions in lower case
+    bool recursive;
+    int threads;
+    bool verbose;
+    std::deque<std::string> pendingDirectories;
+    size_t activeWorkers; // Workers currently listing a directory, that may add subdirectories
+    std::vector<std::string> files; // Found files of the running scan
+    size_t fileCount;
+    unsigned long skippedFiles;
+    unsigned long scannedDirectories;
+    bool rootOpened;
+    pthread_mutex_t mutex;
+    pthread_cond_t workChanged;
+
+    // Non-copyable, the scanner owns the synchronization primitives
+    DirectoryScanner(const DirectoryScanner&);
+    DirectoryScanner& operator=(const DirectoryScanner&);
+
+    bool hasValidExtension(const char* name) const {
+        const char* dot = strrchr(name, '.'); // Assume the last point marks beginning of extension like file.ext
+        const char* extension = (dot != NULL) ? dot + 1 : name;
+        for (size_t i = 0; i < extensions.size(); ++i) {
+            if (strcasecmp(extension, extensions[i].c_str()) == 0) {
+                return true;
+            }
+        }
+        return false;
+    }
+
+    /**
+     * Lists a single directory
+     * @param dirName directory path ending with '/'
+     * @param foundFiles matching files are appended
+     * @param subdirectories subdirectories are appended if scanning recursively
+     * @param skipped number of skipped files is added
+     * @return false if the directory could not be opened
+     */
+    bool listDirectory(const std::string& dirName, std::vector<std::string>& foundFiles, std::vector<std::string>& subdirectories, unsigned long& skipped) const {
+        DIR* dp = opendir(dirName.c_str());
+        if (dp == NULL) {
+            printf("Error opening directory '%s'!\n", dirName.c_str());
+            return false;
+        }
+        struct dirent* ep;
+        while ((ep = readdir(dp))) {
+            const char* name = ep->d_name;
+            if (strcmp(name, ".") == 0 || strcmp(name, "..") == 0) {
+                continue;
+            }
+            bool isDirectory;
+#ifdef __MINGW32__
+            // No d_type on MinGW, the entry has to be stat'ed with its directory
+            struct stat s;
+            isDirectory = (stat((dirName + name).c_str(), &s) == 0 && (s.st_mode & S_IFDIR));
+#else
+            bool isLink = (ep->d_type == DT_LNK);
+            if (ep->d_type == DT_UNKNOWN || isLink) {
+                // Some file systems do not report the type
+                const std::string path = dirName + name;
+                struct stat s;
+                isLink = isLink || (lstat(path.c_str(), &s) == 0 && S_ISLNK(s.st_mode));
+                isDirectory = (stat(path.c_str(), &s) == 0 && S_ISDIR(s.st_mode));
+            } else {
+                isDirectory = (ep->d_type == DT_DIR);
+            }
+            if (isDirectory && isLink) {
+                continue; // Symbolic links to directories are not followed, avoiding cycles
+            }
+#endif
+            if (isDirectory) {
+                // Hidden directories like .svn or .git are never scanned
+                if (recursive && name[0] != '.') {
+                    subdirectories.push_back(dirName + name + "/");
+                }
+                continue;
+            }
+            if (hasValidExtension(name)) {
+                if (verbose) {
+                    printf("Found matching data file '%s%s'\n", dirName.c_str(), name);
+                }
+                foundFiles.push_back(dirName + name);
+            } else {
+                if (verbose) {
+                    printf("Found file does not match required file type, skipping: '%s%s'\n", dirName.c_str(), name);
+                }
+                ++skipped;
+            }
+        }
+        (void) closedir(dp);
+        return true;
+    }
+
+    /**
+     * Takes directories from the pending list until all directories (including the subdirectories found meanwhile) are listed
+     */
+    void work() {
+        std::vector<std::string> foundFiles, subdirectories;
+        pthread_mutex_lock(&mutex);
+        while (true) {
+            while (pendingDirectories.empty() && activeWorkers > 0) {
+                pthread_cond_wait(&workChanged, &mutex);
+            }
+            if (pendingDirectories.empty()) {
+                break; // No worker left that could add directories
+            }
+            const std::string dirName = pendingDirectories.front();
+            pendingDirectories.pop_front();
+            const bool isRoot = (scannedDirectories == 0);
+            ++scannedDirectories;
+            ++activeWorkers;
+            pthread_mutex_unlock(&mutex);
+
+            foundFiles.clear();
+            subdirectories.clear();
+            unsigned long skipped = 0;
+            const bool opened = listDirectory(dirName, foundFiles, subdirectories, skipped);
+
+            pthread_mutex_lock(&mutex);
+            rootOpened = rootOpened || (isRoot && opened);
+            files.insert(files.end(), foundFiles.begin(), foundFiles.end());
+            pendingDirectories.insert(pendingDirectories.end(), subdirectories.begin(), subdirectories.end());
+            skippedFiles += skipped;
+            --activeWorkers;
+            pthread_cond_broadcast(&workChanged);
+        }
+        pthread_mutex_unlock(&mutex);
+    }
+
+    static void* workerThread(void* _scanner) {
+        static_cast<DirectoryScanner*> (_scanner)->work();
+        return NULL;
+    }
+
+public:
+
+    /**
+     * @param validExtensions file extensions to collect, compared case-insensitively
+     * @param _recursive also scan all subdirectories (except hidden ones)
+     * @param _threads number of threads listing directories in parallel when scanning recursively, 0 for the number of cores
+     * @param _verbose print every found and skipped file instead of a summary only
+     */
+    DirectoryScanner(const std::vector<std::string>& validExtensions, bool _recursive = false, int _threads = 0, bool _verbose = false)
+        : extensions(validExtensions), recursive(_recursive), threads(_threads), verbose(_verbose), activeWorkers(0), fileCount(0), skippedFiles(0), scannedDirectories(0), rootOpened(false) {
+        if (threads <= 0) {
+            threads = std::max((int) sysconf(_SC_NPROCESSORS_ONLN), 1);
+        }
+        pthread_mutex_init(&mutex, NULL);
+        pthread_cond_init(&workChanged, NULL);
+    }
+
+    virtual ~DirectoryScanner() {
+        pthread_cond_destroy(&workChanged);
+        pthread_mutex_destroy(&mutex);
+    }
+
+    /**
+     * Collects the files with a valid extension, in sorted order independent of the number of threads
+     * @param dirName directory to scan
+     * @param fileNames path+name of the found files are appended (std::vector<std::string> or FileNameList)
+     * @return false if the directory could not be opened
+     */
+    template <typename FileList>
+    bool scan(const std::string& dirName, FileList& fileNames) {
+        pendingDirectories.assign(1, (!dirName.empty() && dirName[dirName.size() - 1] != '/') ? dirName + "/" : dirName);
+        files.clear();
+        skippedFiles = 0;
+        scannedDirectories = 0;
+        rootOpened = false;
+        std::vector<pthread_t> workers;
+        for (int thread = 1; recursive && thread < threads; ++thread) {
+            pthread_t worker;
+            if (pthread_create(&worker, NULL, workerThread, this) == 0) {
+                workers.push_back(worker);
+            }
+        }
+        work();
+        for (size_t worker = 0; worker < workers.size(); ++worker) {
+            pthread_join(workers[worker], NULL);
+        }
+        std::sort(files.begin(), files.end());
+        for (size_t file = 0; file < files.size(); ++file) {
+            fileNames.push_back(files[file]);
+        }
+        fileCount = files.size();
+        std::vector<std::string>().swap(files); // The paths are kept by the caller only
+        return rootOpened;
+    }
+
+    /**
+     * @return number of matching files found by the last scan
+     */
+    size_t getFileCount() const {
+        return fileCount;
+    }
+
+    /**
+     * @return number of files of the last scan skipped due to their extension
+     */
+    unsigned long getSkippedCount() const {
+        return skippedFiles;
+    }
+
+    /**
+     * @return number of directories listed by the last scan
+     */
+    unsigned long getDirectoryCount() const {
+        return scannedDirectories;
+    }
+};
+
+/**
+ * Reads the samples listed in a manifest file
+ * @param fileName manifest of "<path> <label>" lines
+ * @param positiveFiles paths of positive samples are appended (std::vector<std::string> or FileNameList)
+ * @param negativeFiles paths of negative samples are appended
+ * @return false if the manifest could not be read or contains an invalid line
+ */
+template <typename FileList>
+bool readManifest(const std::string& fileName, FileList& positiveFiles, FileList& negativeFiles) {
+    FILE* fp = fopen(fileName.c_str(), "r");
+    if (fp == NULL) {
+        printf("Error opening manifest '%s'!\n", fileName.c_str());
+        return false;
+    }
+    const size_t separator = fileName.find_last_of('/');
+    const std::string baseDir = (separator != std::string::npos) ? fileName.substr(0, separator + 1) : "";
+    std::string line;
+    unsigned long lineNumber = 0;
+    bool success = true;
+    char buffer[4096];
+    while (success && fgets(buffer, sizeof (buffer), fp) != NULL) {
+        line += buffer;
+        if (line[line.size() - 1] != '\n' && !feof(fp)) {
+            continue; // Line longer than the buffer
+        }
+        ++lineNumber;
+        // Strip the line ending and trailing white space
+        size_t end = line.find_last_not_of(" \t\r\n");
+        const size_t begin = line.find_first_not_of(" \t");
+        if (end == std::string::npos || line[begin] == '#') {
+            line.clear();
+            continue;
+        }
+        const size_t labelStart = line.find_last_of(" \t", end);
+        const size_t pathEnd = (labelStart != std::string::npos) ? line.find_last_not_of(" \t", labelStart) : std::string::npos;
+        if (labelStart == std::string::npos || pathEnd == std::string::npos || pathEnd < begin) {
+            success = false;
+            break;
+        }
+        const std::string label = line.substr(labelStart + 1, end - labelStart);
+        std::string path = line.substr(begin, pathEnd - begin + 1);
+        if (path[0] != '/') {
+            path = baseDir + path;
+        }
+        if (label == "1" || label == "+1" || strcasecmp(label.c_str(), "pos") == 0 || strcasecmp(label.c_str(), "positive") == 0) {
+            positiveFiles.push_back(path);
+        } else if (label == "-1" || label == "0" || strcasecmp(label.c_str(), "neg") == 0 || strcasecmp(label.c_str(), "negative") == 0) {
+            negativeFiles.push_back(path);
+        } else {
+            success = false;
+        }
+        line.clear();
+    }
+    fclose(fp);
+    if (!success) {
+        printf("Error: Invalid line %lu in manifest '%s', expected '<path> <label>'!\n", lineNumber, fileName.c_str());
+    }
+    return success;
+}
+
+#endif	/* FILELIST_H */
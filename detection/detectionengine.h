@@ -0,0 +1,248 @@
+/**
+ * @file:   detectionengine.h
+ * @brief:  Multi-scale sliding window detection of several detectors (trained with the same HOG parameters) on the same image,
+ * building the image pyramid and the per-level grid of block histograms only once.
+ *
+ * The descriptor of a detection window is the concatenation of the normalized histograms of the blocks it covers,
+ * so instead of calculating every window descriptor (for every detector) as HOGDescriptor::detectMultiScale does,
+ * the block histograms of each pyramid level are calculated once by a HOGDescriptor whose window is a single block
+ * and the windows are gathered from that grid batch by batch and scored against all detectors, stacked as K x D matrix,
+ * by one matrix product (GEMM) per batch.
+ * The scores equal those of detectMultiScale (with the same scale, window stride and padding) as long as the window stride
+ * is a multiple of the block stride. Detection can be restricted to regions of interest, then only the pyramid
+ * around these regions is calculated and only windows centered inside a region are scored.
+ * The block histogram grids can be calculated by the OpenCL backend (@see acceleration/openclhog.h), the scoring stays on the CPU.
+ */
+
+#ifndef DETECTIONENGINE_H
+#define	DETECTIONENGINE_H
+
+#include <stdio.h>
+#include <vector>
+#include <algorithm>
+#include <opencv2/core/core.hpp>
+#include <opencv2/imgproc/imgproc.hpp>
+#include <opencv2/objdetect/objdetect.hpp>
+#include "../linearsvm/densevector.h"
+#include "../acceleration/openclhog.h"
+
+class DetectionEngine {
+private:
+
+    /**
+     * Block histogram grid of one pyramid level (or of the part of it around a region of interest)
+     */
+    struct GridRegion {
+        double scale; // Pyramid level scale
+        cv::Point offset; // Top left corner of the region within the pyramid level
+        cv::Rect regionOfInterest; // Windows must be centered inside (in image coordinates), empty for the complete image
+        int blocksX, blocksY; // Number of block positions
+        std::vector<float> histograms; // Row-major grid of block histograms
+    };
+
+    cv::HOGDescriptor blockHog; // HOGDescriptor with a window of a single block, calculating the block histogram grid
+    cv::Size winSize;
+    cv::Size winStride;
+    cv::Size padding; // Aligned to the block stride, as openCV does
+    double scale0; // Scale factor between pyramid levels
+    int levels; // Maximum number of pyramid levels
+    int blockHistogramSize;
+    int blocksPerWindowX, blocksPerWindowY;
+    int blockStepX, blockStepY; // Window stride in blocks
+    size_t descriptorSize;
+    size_t windowBatchSize; // Number of windows gathered and scored at once
+    std::vector<float> modelMatrix; // Row-major, one row of window weights (in openCV descriptor order) per model
+    std::vector<double> modelOffsets; // Bias rho per model
+    std::vector<double> hitThresholds; // Detection threshold per model
+    std::vector<cv::Rect> regionsOfInterest;
+    std::vector<GridRegion> regions;
+    OpenCLHog* accelerator; // Calculates the block histogram grids if the OpenCL backend is enabled, NULL for the CPU only
+
+    void addRegion(const cv::Mat& image, double levelScale, const cv::Point& offset, const cv::Rect& regionOfInterest) {
+        GridRegion region;
+        region.scale = levelScale;
+        region.offset = offset;
+        region.regionOfInterest = regionOfInterest;
+        region.blocksX = (image.cols + 2 * padding.width - blockHog.winSize.width) / blockHog.blockStride.width + 1;
+        region.blocksY = (image.rows + 2 * padding.height - blockHog.winSize.height) / blockHog.blockStride.height + 1;
+        if (accelerator == NULL || !accelerator->computeBlockGrid(blockHog, image, padding, region.histograms)) {
+            blockHog.compute(image, region.histograms, blockHog.blockStride, padding);
+        }
+        if (region.histograms.size() != (size_t) region.blocksX * region.blocksY * blockHistogramSize) {
+            printf("Error: Unexpected block histogram grid size %lu at scale %.3f, level skipped!\n", (unsigned long) region.histograms.size(), levelScale);
+            return;
+        }
+        regions.push_back(region);
+    }
+
+    /**
+     * Copies the blocks of a window from the grid into a descriptor in openCV order (block by block, column by column)
+     * @param region
+     * @param wx window column
+     * @param wy window row
+     * @param descriptor resulting descriptor of descriptorSize values
+     */
+    void gatherWindow(const GridRegion& region, int wx, int wy, float* descriptor) const {
+        for (int bx = 0; bx < blocksPerWindowX; ++bx) {
+            for (int by = 0; by < blocksPerWindowY; ++by) {
+                const float* histogram = &region.histograms[((size_t) (wy * blockStepY + by) * region.blocksX + wx * blockStepX + bx) * blockHistogramSize];
+                std::copy(histogram, histogram + blockHistogramSize, descriptor);
+                descriptor += blockHistogramSize;
+            }
+        }
+    }
+
+public:
+
+    /**
+     * @param _hog HOG parameters of the detectors, its detector (if set) is added as first model
+     * @param _hitThreshold detection threshold of the detector of _hog
+     * @param _winStride window stride, rounded to a multiple of the block stride
+     * @param _padding
+     * @param _scale0 scale factor between pyramid levels
+     * @param _windowBatchSize number of windows scored by one matrix product
+     */
+    DetectionEngine(const cv::HOGDescriptor& _hog, double _hitThreshold = 0.0, cv::Size _winStride = cv::Size(8, 8), cv::Size _padding = cv::Size(8, 8), double _scale0 = 1.05,
+            size_t _windowBatchSize = 64)
+        : blockHog(_hog), winSize(_hog.winSize), scale0(_scale0), levels(_hog.nlevels), windowBatchSize(std::max(_windowBatchSize, (size_t) 1)), accelerator(NULL) {
+        blockHog.winSize = _hog.blockSize;
+        blockHog.svmDetector.clear();
+        blockHistogramSize = (int) blockHog.getDescriptorSize();
+        blocksPerWindowX = (winSize.width - _hog.blockSize.width) / _hog.blockStride.width + 1;
+        blocksPerWindowY = (winSize.height - _hog.blockSize.height) / _hog.blockStride.height + 1;
+        descriptorSize = (size_t) blocksPerWindowX * blocksPerWindowY * blockHistogramSize;
+        blockStepX = std::max(_winStride.width / _hog.blockStride.width, 1);
+        blockStepY = std::max(_winStride.height / _hog.blockStride.height, 1);
+        winStride = cv::Size(blockStepX * _hog.blockStride.width, blockStepY * _hog.blockStride.height);
+        if (winStride != _winStride) {
+            printf("Warning: Window stride %d x %d is no multiple of the block stride, using %d x %d\n", _winStride.width, _winStride.height, winStride.width, winStride.height);
+        }
+        padding = cv::Size((int) cv::alignSize(std::max(_padding.width, 0), _hog.blockStride.width), (int) cv::alignSize(std::max(_padding.height, 0), _hog.blockStride.height));
+        if (!_hog.svmDetector.empty()) {
+            addModel(_hog.svmDetector, _hitThreshold);
+        }
+    }
+
+    /**
+     * Adds a detector trained with the same HOG parameters
+     * @param detector single detecting vector (optionally followed by the bias rho, as used by openCV)
+     * @param hitThreshold detection threshold of this detector
+     * @return false if the detector does not match the HOG parameters
+     */
+    bool addModel(const std::vector<float>& detector, double hitThreshold) {
+        if (detector.size() != descriptorSize && detector.size() != descriptorSize + 1) {
+            printf("Error: Detector size %lu does not match the descriptor size %lu!\n", (unsigned long) detector.size(), (unsigned long) descriptorSize);
+            return false;
+        }
+        modelMatrix.insert(modelMatrix.end(), detector.begin(), detector.begin() + descriptorSize);
+        modelOffsets.push_back((detector.size() > descriptorSize) ? detector[descriptorSize] : 0.0);
+        hitThresholds.push_back(hitThreshold);
+        return true;
+    }
+
+    /**
+     * @param _accelerator OpenCL backend calculating the block histogram grids (owned by the caller, one per thread), NULL for the CPU only
+     */
+    void setAccelerator(OpenCLHog* _accelerator) {
+        accelerator = _accelerator;
+    }
+
+    size_t getModelCount() const {
+        return hitThresholds.size();
+    }
+
+    /**
+     * Restricts detection to windows centered inside the given regions, takes effect with the next setImage()
+     * @param _regionsOfInterest regions in image coordinates, empty to detect on the complete image
+     */
+    void setRegionsOfInterest(const std::vector<cv::Rect>& _regionsOfInterest) {
+        regionsOfInterest = _regionsOfInterest;
+    }
+
+    /**
+     * Builds the image pyramid and the block histogram grid of every level, shared by all models
+     * @param image grayscale image
+     */
+    void setImage(const cv::Mat& image) {
+        regions.clear();
+        cv::Mat levelImage;
+        double levelScale = 1.0;
+        for (int level = 0; level < std::max(levels, 1); ++level) {
+            const cv::Size levelSize(cvRound(image.cols / levelScale), cvRound(image.rows / levelScale));
+            if (levelSize.width < winSize.width || levelSize.height < winSize.height) {
+                break;
+            }
+            if (levelSize == image.size()) {
+                levelImage = image;
+            } else {
+                cv::resize(image, levelImage, levelSize, 0, 0, cv::INTER_LINEAR);
+            }
+            if (regionsOfInterest.empty()) {
+                addRegion(levelImage, levelScale, cv::Point(0, 0), cv::Rect());
+            }
+            for (size_t roi = 0; roi < regionsOfInterest.size(); ++roi) {
+                // All windows centered inside the region of interest, scaled to the level
+                const cv::Rect& r = regionsOfInterest[roi];
+                const cv::Rect levelRegion = cv::Rect(cvRound(r.x / levelScale) - winSize.width / 2, cvRound(r.y / levelScale) - winSize.height / 2,
+                        cvRound(r.width / levelScale) + winSize.width, cvRound(r.height / levelScale) + winSize.height) & cv::Rect(cv::Point(0, 0), levelSize);
+                if (levelRegion.width >= winSize.width && levelRegion.height >= winSize.height) {
+                    addRegion(levelImage(levelRegion), levelScale, levelRegion.tl(), r);
+                }
+            }
+            if (scale0 <= 1.0) {
+                break;
+            }
+            levelScale *= scale0;
+        }
+    }
+
+    /**
+     * Scores all windows of the current image with all models
+     * @param found resulting raw (ungrouped) detection windows per model, scoring >= the hit threshold of the model
+     * @param foundWeights resulting score per detection window per model
+     */
+    void detect(std::vector< std::vector<cv::Rect> >& found, std::vector< std::vector<double> >& foundWeights) const {
+        const size_t models = getModelCount();
+        found.assign(models, std::vector<cv::Rect>());
+        foundWeights.assign(models, std::vector<double>());
+        if (models == 0) {
+            return;
+        }
+        std::vector<float> windowMatrix(windowBatchSize * descriptorSize);
+        std::vector<double> scores(windowBatchSize * models);
+        std::vector<cv::Rect> windows;
+        windows.reserve(windowBatchSize);
+        for (size_t r = 0; r < regions.size(); ++r) {
+            const GridRegion& region = regions[r];
+            const int windowsX = (region.blocksX - blocksPerWindowX) / blockStepX + 1;
+            const int windowsY = (region.blocksY - blocksPerWindowY) / blockStepY + 1;
+            const cv::Size scaledWinSize(cvRound(winSize.width * region.scale), cvRound(winSize.height * region.scale));
+            for (int window = 0; window < windowsX * windowsY; ++window) {
+                const int wx = window % windowsX;
+                const int wy = window / windowsX;
+                const cv::Point windowOffset(wx * winStride.width - padding.width + region.offset.x, wy * winStride.height - padding.height + region.offset.y);
+                if (region.regionOfInterest.area() == 0 || region.regionOfInterest.contains(cv::Point(cvRound((windowOffset.x + winSize.width / 2) * region.scale),
+                        cvRound((windowOffset.y + winSize.height / 2) * region.scale)))) {
+                    gatherWindow(region, wx, wy, &windowMatrix[windows.size() * descriptorSize]);
+                    windows.push_back(cv::Rect(cvRound(windowOffset.x * region.scale), cvRound(windowOffset.y * region.scale), scaledWinSize.width, scaledWinSize.height));
+                }
+                if (windows.size() < windowBatchSize && window + 1 < windowsX * windowsY) {
+                    continue;
+                }
+                // Batch complete (or end of region): windows x models scores
+                denseGemmTransposed(&windowMatrix[0], (long) windows.size(), &modelMatrix[0], (long) models, (long) descriptorSize, &modelOffsets[0], &scores[0]);
+                for (size_t w = 0; w < windows.size(); ++w) {
+                    for (size_t model = 0; model < models; ++model) {
+                        if (scores[w * models + model] >= hitThresholds[model]) {
+                            found[model].push_back(windows[w]);
+                            foundWeights[model].push_back(scores[w * models + model]);
+                        }
+                    }
+                }
+                windows.clear();
+            }
+        }
+    }
+};
+
+#endif	/* DETECTIONENGINE_H */
@@ -0,0 +1,105 @@
+/**
+ * @file:   nms.h
+ * @brief:  Greedy non-maximum suppression of scored detection windows:
+ * windows are visited by descending score and kept unless they overlap (intersection over union) an already kept window too much.
+ * With the optional spatial grid, a window is only compared against the kept windows in the grid cells it covers
+ * instead of against all kept windows, which pays off for many (low threshold) detections in large images.
+ */
+
+#ifndef NMS_H
+#define	NMS_H
+
+#include <vector>
+#include <algorithm>
+#include <opencv2/core/core.hpp>
+
+/**
+ * Sorts detection indices by descending score
+ */
+struct DescendingDetectionScoreOrder {
+
+    DescendingDetectionScoreOrder(const std::vector<double>& _scores) : scores(_scores) {
+    }
+
+    bool operator()(size_t a, size_t b) const {
+        return scores[a] > scores[b];
+    }
+
+    const std::vector<double>& scores;
+};
+
+/**
+ * Intersection over union of two rectangles
+ * @param a
+ * @param b
+ * @return 0 (disjoint) .. 1 (identical)
+ */
+inline double intersectionOverUnion(const cv::Rect& a, const cv::Rect& b) {
+    const double intersection = (a & b).area();
+    const double united = (double) a.area() + b.area() - intersection;
+    return (united > 0.0) ? intersection / united : 0.0;
+}
+
+/**
+ * Greedy non-maximum suppression
+ * @param found detection windows
+ * @param foundWeights score per detection window
+ * @param overlapThreshold windows overlapping a higher scoring kept window with an intersection over union above this are suppressed
+ * @param keep resulting indices of the kept windows, by descending score
+ * @param useGrid look up possibly overlapping kept windows in a spatial grid
+ */
+inline void nonMaximumSuppression(const std::vector<cv::Rect>& found, const std::vector<double>& foundWeights, const double overlapThreshold, std::vector<size_t>& keep, bool useGrid = true) {
+    keep.clear();
+    if (found.empty()) {
+        return;
+    }
+    std::vector<size_t> order(found.size());
+    for (size_t i = 0; i < order.size(); ++i) {
+        order[i] = i;
+    }
+    std::sort(order.begin(), order.end(), DescendingDetectionScoreOrder(foundWeights));
+
+    // Grid over the bounding box of all windows, with cells of the mean window size
+    cv::Rect extent = found[0];
+    double meanWidth = 0.0;
+    double meanHeight = 0.0;
+    for (size_t i = 0; i < found.size(); ++i) {
+        extent |= found[i];
+        meanWidth += found[i].width;
+        meanHeight += found[i].height;
+    }
+    const int cellWidth = std::max((int) (meanWidth / found.size()), 1);
+    const int cellHeight = std::max((int) (meanHeight / found.size()), 1);
+    const int gridCols = useGrid ? extent.width / cellWidth + 1 : 1;
+    const int gridRows = useGrid ? extent.height / cellHeight + 1 : 1;
+    std::vector< std::vector<size_t> > grid(gridCols * gridRows); // Kept windows per cell
+
+    for (size_t i = 0; i < order.size(); ++i) {
+        const cv::Rect& candidate = found[order[i]];
+        const int firstCol = useGrid ? std::max((candidate.x - extent.x) / cellWidth, 0) : 0;
+        const int lastCol = useGrid ? std::min((candidate.x + candidate.width - 1 - extent.x) / cellWidth, gridCols - 1) : 0;
+        const int firstRow = useGrid ? std::max((candidate.y - extent.y) / cellHeight, 0) : 0;
+        const int lastRow = useGrid ? std::min((candidate.y + candidate.height - 1 - extent.y) / cellHeight, gridRows - 1) : 0;
+        bool suppressed = false;
+        // Overlapping windows share at least one cell
+        for (int row = firstRow; row <= lastRow && !suppressed; ++row) {
+            for (int col = firstCol; col <= lastCol && !suppressed; ++col) {
+                const std::vector<size_t>& cell = grid[row * gridCols + col];
+                for (size_t k = 0; k < cell.size() && !suppressed; ++k) {
+                    suppressed = (intersectionOverUnion(candidate, found[cell[k]]) > overlapThreshold);
+                }
+            }
+        }
+        if (suppressed) {
+            continue;
+        }
+        keep.push_back(order[i]);
+        for (int row = firstRow; row <= lastRow; ++row) {
+            for (int col = firstCol; col <= lastCol; ++col) {
+                grid[row * gridCols + col].push_back(order[i]);
+            }
+        }
+    }
+}
+
+#endif	/* NMS_H */
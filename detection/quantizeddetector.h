@@ -0,0 +1,385 @@
+/**
+ * @file:   quantizeddetector.h
+ * @brief:  Quantized linear detector (float16, or int8 with one scale per block of weights) in a compact binary format
+ * for inference on embedded devices, together with the matching window scoring kernel.
+ *
+ * File layout (native byte order):
+ * 1. QuantizedDetectorHeader, containing format, dimension, bias, detection threshold and the HOG parameters used
+ * 2. float16: <code>dimension</code> uint16 half precision weights
+ *    int8: ceil(dimension / blockLength) float32 scales, followed by <code>dimension</code> int8 weights,
+ *    weight i is scale[i / blockLength] * q[i]
+ *
+ * Scoring converts the quantized weights in registers (SSE2, F16C if enabled by the compiler flags) and accumulates the int8 weights
+ * of a block unscaled, so that only the compact weights are read from memory and one multiplication per block applies the scale.
+ */
+
+#ifndef QUANTIZEDDETECTOR_H
+#define	QUANTIZEDDETECTOR_H
+
+#include <stdio.h>
+#include <string.h>
+#include <stdint.h>
+#include <math.h>
+#include <string>
+#include <vector>
+#include <algorithm>
+#include "../featurestore/featurestore.h"
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+#ifdef __F16C__
+#include <immintrin.h>
+#endif
+
+#define QUANTIZEDDETECTOR_MAGIC "HOGQDET"
+#define QUANTIZEDDETECTOR_VERSION 1
+
+enum QuantizedDetectorFormat {
+    QUANTIZED_FLOAT16 = 16,
+    QUANTIZED_INT8 = 8
+};
+
+struct QuantizedDetectorHeader {
+    char magic[8];
+    uint32_t version;
+    uint32_t headerSize;
+    uint32_t format; // QuantizedDetectorFormat
+    uint32_t blockLength; // Number of weights sharing one int8 scale
+    uint64_t dimension; // Number of weights
+    double bias; // rho, the score of a window is w*x + bias
+    double hitThreshold; // Windows scoring >= hitThreshold are detections
+    FeatureStoreHogParams hogParams;
+};
+
+/**
+ * Converts a float to half precision, rounding to nearest even
+ * @param value
+ * @return IEEE 754 binary16 bits
+ */
+inline uint16_t floatToHalf(float value) {
+    uint32_t bits;
+    memcpy(&bits, &value, sizeof (bits));
+    const uint32_t sign = (bits >> 16) & 0x8000;
+    const int32_t exponent = (int32_t) ((bits >> 23) & 0xff) - 127 + 15;
+    uint32_t mantissa = bits & 0x7fffff;
+    if (((bits >> 23) & 0xff) == 0xff) {
+        return (uint16_t) (sign | 0x7c00 | (mantissa ? 0x200 : 0)); // Infinity / NaN
+    }
+    if (exponent >= 31) {
+        return (uint16_t) (sign | 0x7c00); // Overflow
+    }
+    if (exponent <= 0) {
+        if (exponent < -10) {
+            return (uint16_t) sign; // Underflow
+        }
+        // Subnormal half precision value
+        mantissa |= 0x800000;
+        const uint32_t shift = (uint32_t) (14 - exponent);
+        uint32_t half = mantissa >> shift;
+        const uint32_t remainder = mantissa & ((1u << shift) - 1);
+        const uint32_t halfway = 1u << (shift - 1);
+        if (remainder > halfway || (remainder == halfway && (half & 1))) {
+            ++half;
+        }
+        return (uint16_t) (sign | half);
+    }
+    uint32_t half = ((uint32_t) exponent << 10) | (mantissa >> 13);
+    const uint32_t remainder = mantissa & 0x1fff;
+    if (remainder > 0x1000 || (remainder == 0x1000 && (half & 1))) {
+        ++half; // A carry into the exponent is the correct rounding
+    }
+    return (uint16_t) (sign | half);
+}
+
+/**
+ * Converts half precision to float
+ * @param half IEEE 754 binary16 bits
+ * @return
+ */
+inline float halfToFloat(uint16_t half) {
+    const uint32_t sign = (uint32_t) (half & 0x8000) << 16;
+    const uint32_t exponent = (half >> 10) & 0x1f;
+    const uint32_t mantissa = half & 0x3ff;
+    uint32_t bits;
+    if (exponent == 0) {
+        const float value = ldexpf((float) mantissa, -24); // Zero or subnormal
+        return sign ? -value : value;
+    } else if (exponent == 31) {
+        bits = sign | 0x7f800000 | (mantissa << 13);
+    } else {
+        bits = sign | ((exponent + 127 - 15) << 23) | (mantissa << 13);
+    }
+    float value;
+    memcpy(&value, &bits, sizeof (value));
+    return value;
+}
+
+/**
+ * Dot product of int8 weights and float features
+ * @param weights
+ * @param features
+ * @param n number of components
+ * @return sum_i weights[i]*features[i], accumulated in four (SSE2) lanes
+ */
+inline float int8Dot(const int8_t* weights, const float* features, long n) {
+    long i = 0;
+    float result = 0.0f;
+#ifdef __SSE2__
+    __m128 sum0 = _mm_setzero_ps();
+    __m128 sum1 = _mm_setzero_ps();
+    for (; i + 8 <= n; i += 8) {
+        // Sign extension by unpacking each value into the upper half of a wider lane and shifting back arithmetically
+        const __m128i bytes = _mm_loadl_epi64((const __m128i*) (weights + i));
+        const __m128i words = _mm_srai_epi16(_mm_unpacklo_epi8(bytes, bytes), 8);
+        const __m128 low = _mm_cvtepi32_ps(_mm_srai_epi32(_mm_unpacklo_epi16(words, words), 16));
+        const __m128 high = _mm_cvtepi32_ps(_mm_srai_epi32(_mm_unpackhi_epi16(words, words), 16));
+        sum0 = _mm_add_ps(sum0, _mm_mul_ps(low, _mm_loadu_ps(features + i)));
+        sum1 = _mm_add_ps(sum1, _mm_mul_ps(high, _mm_loadu_ps(features + i + 4)));
+    }
+    float lanes[4];
+    _mm_storeu_ps(lanes, _mm_add_ps(sum0, sum1));
+    result = (lanes[0] + lanes[1]) + (lanes[2] + lanes[3]);
+#endif
+    for (; i < n; ++i) {
+        result += weights[i] * features[i];
+    }
+    return result;
+}
+
+#ifdef __SSE2__
+/**
+ * Converts four half precision values to float
+ * @param halves four IEEE 754 binary16 values in the lower 64 bits
+ * @return
+ */
+inline __m128 halfToFloat4(__m128i halves) {
+#ifdef __F16C__
+    return _mm_cvtph_ps(halves);
+#else
+    // Exponent and mantissa shifted into place, the multiplication by 2^112 rebiases the exponent and normalizes subnormal values
+    const __m128i bits = _mm_unpacklo_epi16(halves, _mm_setzero_si128());
+    const __m128i sign = _mm_slli_epi32(_mm_and_si128(bits, _mm_set1_epi32(0x8000)), 16);
+    const __m128i magnitude = _mm_slli_epi32(_mm_and_si128(bits, _mm_set1_epi32(0x7fff)), 13);
+    __m128 value = _mm_mul_ps(_mm_castsi128_ps(magnitude), _mm_castsi128_ps(_mm_set1_epi32(0x77800000)));
+    // Infinity and NaN keep the maximum exponent
+    const __m128 infNaN = _mm_cmpge_ps(value, _mm_set1_ps(65536.0f));
+    value = _mm_or_ps(value, _mm_and_ps(infNaN, _mm_castsi128_ps(_mm_set1_epi32(0x7f800000))));
+    return _mm_or_ps(value, _mm_castsi128_ps(sign));
+#endif
+}
+#endif
+
+/**
+ * Dot product of half precision weights and float features
+ * @param weights IEEE 754 binary16 values
+ * @param features
+ * @param n number of components
+ * @return sum_i weights[i]*features[i], partial sums are accumulated in four (SSE2) lanes and added in double precision
+ */
+inline double halfDot(const uint16_t* weights, const float* features, long n) {
+    long i = 0;
+    double result = 0.0;
+#ifdef __SSE2__
+    __m128 sum0 = _mm_setzero_ps();
+    __m128 sum1 = _mm_setzero_ps();
+    for (; i + 8 <= n; i += 8) {
+        const __m128i halves = _mm_loadu_si128((const __m128i*) (weights + i));
+        sum0 = _mm_add_ps(sum0, _mm_mul_ps(halfToFloat4(halves), _mm_loadu_ps(features + i)));
+        sum1 = _mm_add_ps(sum1, _mm_mul_ps(halfToFloat4(_mm_srli_si128(halves, 8)), _mm_loadu_ps(features + i + 4)));
+    }
+    float lanes[4];
+    _mm_storeu_ps(lanes, _mm_add_ps(sum0, sum1));
+    result = (double) lanes[0] + lanes[1] + lanes[2] + lanes[3];
+#endif
+    for (; i < n; ++i) {
+        result += halfToFloat(weights[i]) * features[i];
+    }
+    return result;
+}
+
+class QuantizedDetector {
+private:
+    QuantizedDetectorHeader header;
+    std::vector<uint16_t> halfWeights; // float16 format
+    std::vector<int8_t> weights; // int8 format
+    std::vector<float> scales; // int8 format, one per block
+
+    size_t blockCount() const {
+        return (size_t) ((header.dimension + header.blockLength - 1) / header.blockLength);
+    }
+
+public:
+
+    QuantizedDetector() {
+        memset(&header, 0, sizeof (header));
+    }
+
+    /**
+     * Quantizes a float detector
+     * @param detector single detecting vector, optionally followed by the bias rho (as used by openCV)
+     * @param dimension number of weights
+     * @param format QUANTIZED_FLOAT16 or QUANTIZED_INT8
+     * @param blockLength number of weights sharing one int8 scale, e.g. the HOG block histogram size
+     * @param hitThreshold detection threshold
+     * @param hogParams HOG parameters the detector was trained with
+     * @return false for an unknown format or a detector shorter than the dimension
+     */
+    bool quantize(const std::vector<float>& detector, uint64_t dimension, QuantizedDetectorFormat format, uint32_t blockLength, double hitThreshold, const FeatureStoreHogParams& hogParams) {
+        if ((format != QUANTIZED_FLOAT16 && format != QUANTIZED_INT8) || detector.size() < dimension || dimension == 0) {
+            printf("Error: Cannot quantize detector of dimension %lu to format %d!\n", (unsigned long) detector.size(), (int) format);
+            return false;
+        }
+        memset(&header, 0, sizeof (header));
+        memcpy(header.magic, QUANTIZEDDETECTOR_MAGIC, sizeof (header.magic));
+        header.version = QUANTIZEDDETECTOR_VERSION;
+        header.headerSize = sizeof (QuantizedDetectorHeader);
+        header.format = format;
+        header.blockLength = std::max(blockLength, 1u);
+        header.dimension = dimension;
+        header.bias = (detector.size() > dimension) ? detector[dimension] : 0.0;
+        header.hitThreshold = hitThreshold;
+        header.hogParams = hogParams;
+        halfWeights.clear();
+        weights.clear();
+        scales.clear();
+        if (format == QUANTIZED_FLOAT16) {
+            halfWeights.resize(dimension);
+            for (uint64_t i = 0; i < dimension; ++i) {
+                halfWeights[i] = floatToHalf(detector[i]);
+            }
+            return true;
+        }
+        // Symmetric int8 quantization, the largest magnitude of each block maps to 127
+        weights.resize(dimension);
+        scales.resize(blockCount());
+        for (size_t block = 0; block < scales.size(); ++block) {
+            const uint64_t first = block * header.blockLength;
+            const uint64_t last = std::min(first + header.blockLength, dimension);
+            float maxMagnitude = 0.0f;
+            for (uint64_t i = first; i < last; ++i) {
+                maxMagnitude = std::max(maxMagnitude, fabsf(detector[i]));
+            }
+            scales[block] = (maxMagnitude > 0.0f) ? maxMagnitude / 127.0f : 1.0f;
+            for (uint64_t i = first; i < last; ++i) {
+                weights[i] = (int8_t) std::max(-127.0f, std::min(127.0f, floorf(detector[i] / scales[block] + 0.5f)));
+            }
+        }
+        return true;
+    }
+
+    /**
+     * Scores a window with the quantized weights
+     * @param features window descriptor of dimension values
+     * @return w*x + bias
+     */
+    double score(const float* features) const {
+        double result = header.bias;
+        if (header.format == QUANTIZED_FLOAT16) {
+            return result + halfDot(&halfWeights[0], features, (long) header.dimension);
+        }
+        for (size_t block = 0; block < scales.size(); ++block) {
+            const uint64_t first = block * header.blockLength;
+            const long length = (long) (std::min(first + header.blockLength, header.dimension) - first);
+            // Integer weights are accumulated per block and scaled once
+            result += scales[block] * int8Dot(&weights[first], features + first, length);
+        }
+        return result;
+    }
+
+    /**
+     * Expands the quantized weights, e.g. for use with hog.setSVMDetector
+     * @param detector resulting single detecting vector followed by the bias
+     */
+    void dequantize(std::vector<float>& detector) const {
+        detector.resize(header.dimension + 1);
+        for (uint64_t i = 0; i < header.dimension; ++i) {
+            detector[i] = (header.format == QUANTIZED_FLOAT16) ? halfToFloat(halfWeights[i]) : scales[i / header.blockLength] * weights[i];
+        }
+        detector[header.dimension] = (float) header.bias;
+    }
+
+    /**
+     * @param fileName
+     * @return true on success
+     */
+    bool save(const std::string& fileName) const {
+        FILE* fp = fopen(fileName.c_str(), "wb");
+        if (fp == NULL) {
+            printf("Error opening file '%s'!\n", fileName.c_str());
+            return false;
+        }
+        bool success = (header.dimension > 0 && fwrite(&header, sizeof (header), 1, fp) == 1);
+        if (success && header.format == QUANTIZED_FLOAT16) {
+            success = (fwrite(&halfWeights[0], sizeof (uint16_t), halfWeights.size(), fp) == halfWeights.size());
+        } else if (success) {
+            success = (fwrite(&scales[0], sizeof (float), scales.size(), fp) == scales.size() && fwrite(&weights[0], sizeof (int8_t), weights.size(), fp) == weights.size());
+        }
+        if (fclose(fp) != 0 || !success) {
+            printf("Error writing quantized detector '%s'!\n", fileName.c_str());
+            return false;
+        }
+        return true;
+    }
+
+    /**
+     * @param fileName
+     * @return true on success
+     */
+    bool load(const std::string& fileName) {
+        FILE* fp = fopen(fileName.c_str(), "rb");
+        if (fp == NULL) {
+            printf("Error opening file '%s'!\n", fileName.c_str());
+            return false;
+        }
+        bool success = (fread(&header, sizeof (header), 1, fp) == 1 && memcmp(header.magic, QUANTIZEDDETECTOR_MAGIC, sizeof (header.magic)) == 0
+                && header.version == QUANTIZEDDETECTOR_VERSION && header.headerSize == sizeof (QuantizedDetectorHeader) && header.blockLength > 0 && header.dimension > 0
+                && (header.format == QUANTIZED_FLOAT16 || header.format == QUANTIZED_INT8));
+        halfWeights.clear();
+        weights.clear();
+        scales.clear();
+        if (success && header.format == QUANTIZED_FLOAT16) {
+            halfWeights.resize(header.dimension);
+            success = (fread(&halfWeights[0], sizeof (uint16_t), halfWeights.size(), fp) == halfWeights.size());
+        } else if (success) {
+            scales.resize(blockCount());
+            weights.resize(header.dimension);
+            success = (fread(&scales[0], sizeof (float), scales.size(), fp) == scales.size() && fread(&weights[0], sizeof (int8_t), weights.size(), fp) == weights.size());
+        }
+        fclose(fp);
+        if (!success) {
+            printf("Error: '%s' is no valid quantized detector!\n", fileName.c_str());
+            memset(&header, 0, sizeof (header));
+        }
+        return success;
+    }
+
+    QuantizedDetectorFormat getFormat() const {
+        return (QuantizedDetectorFormat) header.format;
+    }
+
+    uint64_t getDimension() const {
+        return header.dimension;
+    }
+
+    double getBias() const {
+        return header.bias;
+    }
+
+    double getHitThreshold() const {
+        return header.hitThreshold;
+    }
+
+    const FeatureStoreHogParams& getHogParams() const {
+        return header.hogParams;
+    }
+
+    /**
+     * @return size of the quantized weights (and scales) in bytes
+     */
+    size_t getWeightBytes() const {
+        return halfWeights.size() * sizeof (uint16_t) + weights.size() * sizeof (int8_t) + scales.size() * sizeof (float);
+    }
+};
+
+#endif	/* QUANTIZEDDETECTOR_H */
@@ -0,0 +1,194 @@
+/**
+ * @file:   evaluation.h
+ * @brief:  Threshold independent evaluation of detector scores: score histogram, ROC and DET curves over all thresholds,
+ * calculated in one pass over the scores sorted in descending order (O(n log n)) and written as CSV files for plotting.
+ */
+
+#ifndef EVALUATION_H
+#define	EVALUATION_H
+
+#include <stdio.h>
+#include <math.h>
+#include <string>
+#include <vector>
+#include <algorithm>
+
+/**
+ * Operating point of a detector, counting all samples scoring >= threshold as detections
+ */
+struct RocPoint {
+    double threshold;
+    unsigned long truePositives;
+    unsigned long falsePositives;
+};
+
+/**
+ * Sorts sample indices by descending score
+ */
+struct DescendingScoreOrder {
+
+    DescendingScoreOrder(const std::vector<double>& _scores) : scores(_scores) {
+    }
+
+    bool operator()(size_t a, size_t b) const {
+        return scores[a] > scores[b];
+    }
+
+    const std::vector<double>& scores;
+};
+
+/**
+ * Calculates the operating points for all thresholds, one point per distinct score
+ * @param scores score per sample
+ * @param positive flag per sample, set for positive samples
+ * @param curve resulting operating points in order of descending threshold
+ */
+inline void computeRocCurve(const std::vector<double>& scores, const std::vector<char>& positive, std::vector<RocPoint>& curve) {
+    std::vector<size_t> order(scores.size());
+    for (size_t i = 0; i < order.size(); ++i) {
+        order[i] = i;
+    }
+    std::sort(order.begin(), order.end(), DescendingScoreOrder(scores));
+    curve.clear();
+    RocPoint point;
+    point.truePositives = 0;
+    point.falsePositives = 0;
+    for (size_t i = 0; i < order.size(); ++i) {
+        if (positive[order[i]]) {
+            ++point.truePositives;
+        } else {
+            ++point.falsePositives;
+        }
+        // Samples with equal scores are detected (or not) together
+        if (i + 1 == order.size() || scores[order[i + 1]] != scores[order[i]]) {
+            point.threshold = scores[order[i]];
+            curve.push_back(point);
+        }
+    }
+}
+
+/**
+ * Area under the ROC curve (trapezoidal rule)
+ * @param curve operating points as calculated by computeRocCurve
+ * @param positives overall number of positive samples
+ * @param negatives overall number of negative samples
+ * @return
+ */
+inline double rocAreaUnderCurve(const std::vector<RocPoint>& curve, unsigned long positives, unsigned long negatives) {
+    if (positives == 0 || negatives == 0) {
+        return 0.0;
+    }
+    double area = 0.0;
+    unsigned long previousTruePositives = 0;
+    unsigned long previousFalsePositives = 0;
+    for (size_t i = 0; i < curve.size(); ++i) {
+        area += (double) (curve[i].falsePositives - previousFalsePositives) * (curve[i].truePositives + previousTruePositives) / 2.0;
+        previousTruePositives = curve[i].truePositives;
+        previousFalsePositives = curve[i].falsePositives;
+    }
+    return area / ((double) positives * negatives);
+}
+
+/**
+ * Writes the ROC curve as CSV file, including the miss rate for plotting the DET curve (miss rate vs. false positive rate)
+ * @param fileName
+ * @param curve operating points as calculated by computeRocCurve
+ * @param positives overall number of positive samples
+ * @param negatives overall number of negative samples
+ * @return true on success
+ */
+inline bool writeRocCurve(const std::string& fileName, const std::vector<RocPoint>& curve, unsigned long positives, unsigned long negatives) {
+    FILE* fp = fopen(fileName.c_str(), "w");
+    if (fp == NULL) {
+        printf("Error opening file '%s'!\n", fileName.c_str());
+        return false;
+    }
+    fprintf(fp, "threshold,true_positives,false_positives,true_positive_rate,false_positive_rate,miss_rate,precision\n");
+    for (size_t i = 0; i < curve.size(); ++i) {
+        const double truePositiveRate = (positives > 0) ? (double) curve[i].truePositives / positives : 0.0;
+        const double falsePositiveRate = (negatives > 0) ? (double) curve[i].falsePositives / negatives : 0.0;
+        const double precision = (double) curve[i].truePositives / (curve[i].truePositives + curve[i].falsePositives);
+        fprintf(fp, "%.9g,%lu,%lu,%.6f,%.6f,%.6f,%.6f\n", curve[i].threshold, curve[i].truePositives, curve[i].falsePositives,
+                truePositiveRate, falsePositiveRate, 1.0 - truePositiveRate, precision);
+    }
+    return (fclose(fp) == 0);
+}
+
+/**
+ * Writes the DET curve (miss rate vs. false positives per image) as CSV file, as used for evaluating detectors on full images
+ * @param fileName
+ * @param curve operating points as calculated by computeRocCurve, false positives are detection windows on negative images
+ * @param positives overall number of positive objects (including the ones never detected)
+ * @param negativeImages number of negative images scanned for false positives
+ * @return true on success
+ */
+inline bool writeDetCurve(const std::string& fileName, const std::vector<RocPoint>& curve, unsigned long positives, unsigned long negativeImages) {
+    FILE* fp = fopen(fileName.c_str(), "w");
+    if (fp == NULL) {
+        printf("Error opening file '%s'!\n", fileName.c_str());
+        return false;
+    }
+    fprintf(fp, "threshold,true_positives,false_positives,miss_rate,false_positives_per_image\n");
+    for (size_t i = 0; i < curve.size(); ++i) {
+        const double missRate = (positives > 0) ? 1.0 - (double) curve[i].truePositives / positives : 0.0;
+        const double falsePositivesPerImage = (negativeImages > 0) ? (double) curve[i].falsePositives / negativeImages : 0.0;
+        fprintf(fp, "%.9g,%lu,%lu,%.6f,%.6f\n", curve[i].threshold, curve[i].truePositives, curve[i].falsePositives, missRate, falsePositivesPerImage);
+    }
+    return (fclose(fp) == 0);
+}
+
+/**
+ * Looks up the operating point of the lowest threshold not detecting more than the given number of false positives
+ * @param curve operating points as calculated by computeRocCurve
+ * @param maxFalsePositives
+ * @return operating point, all counts 0 if even the highest threshold detects more false positives
+ */
+inline RocPoint rocPointAtFalsePositives(const std::vector<RocPoint>& curve, double maxFalsePositives) {
+    RocPoint result;
+    result.threshold = HUGE_VAL;
+    result.truePositives = 0;
+    result.falsePositives = 0;
+    for (size_t i = 0; i < curve.size() && curve[i].falsePositives <= maxFalsePositives; ++i) {
+        result = curve[i];
+    }
+    return result;
+}
+
+/**
+ * Writes a histogram of the positive and negative sample scores as CSV file
+ * @param fileName
+ * @param scores score per sample
+ * @param positive flag per sample, set for positive samples
+ * @param bins number of equally sized bins between the lowest and the highest score
+ * @return true on success
+ */
+inline bool writeScoreHistogram(const std::string& fileName, const std::vector<double>& scores, const std::vector<char>& positive, int bins) {
+    if (scores.empty() || bins < 1) {
+        return false;
+    }
+    const double minScore = *std::min_element(scores.begin(), scores.end());
+    const double maxScore = *std::max_element(scores.begin(), scores.end());
+    const double binWidth = (maxScore > minScore) ? (maxScore - minScore) / bins : 1.0;
+    std::vector<unsigned long> positiveCounts(bins, 0);
+    std::vector<unsigned long> negativeCounts(bins, 0);
+    for (size_t i = 0; i < scores.size(); ++i) {
+        const int bin = std::min((int) ((scores[i] - minScore) / binWidth), bins - 1);
+        if (positive[i]) {
+            ++positiveCounts[bin];
+        } else {
+            ++negativeCounts[bin];
+        }
+    }
+    FILE* fp = fopen(fileName.c_str(), "w");
+    if (fp == NULL) {
+        printf("Error opening file '%s'!\n", fileName.c_str());
+        return false;
+    }
+    fprintf(fp, "bin_start,bin_end,positives,negatives\n");
+    for (int bin = 0; bin < bins; ++bin) {
+        fprintf(fp, "%.9g,%.9g,%lu,%lu\n", minScore + bin * binWidth, minScore + (bin + 1) * binWidth, positiveCounts[bin], negativeCounts[bin]);
+    }
+    return (fclose(fp) == 0);
+}
+
+#endif	/* EVALUATION_H */
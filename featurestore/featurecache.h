@@ -0,0 +1,284 @@
+/**
+ * @file:   featurecache.h
+ * @brief:  Persistent per-sample cache of calculated HOG feature vectors, so that repeated runs only calculate features of new or changed images.
+ *
+ * Samples are identified by a 64 bit key, either the hash of path, modification time and size of the image file
+ * or the hash of the file content (content-addressed, survives renaming and touching files).
+ * Every set of HOG parameters gets its own cache file <code>hog_<parameter hash>.cache</code> in the cache directory,
+ * so changing e.g. the cell size never returns stale features.
+ *
+ * File layout (native byte order):
+ * 1. FeatureCacheHeader, containing the dimension and the HOG parameters used
+ * 2. records of one uint64 key followed by <code>dimension</code> float32 values, appended in calculation order
+ */
+
+#ifndef FEATURECACHE_H
+#define	FEATURECACHE_H
+
+#include <stdio.h>
+#include <string.h>
+#include <stdint.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <pthread.h>
+#include <string>
+#include <map>
+#include "featurestore.h"
+
+#define FEATURECACHE_MAGIC "HOGCACHE"
+#define FEATURECACHE_VERSION 1
+#define FEATURECACHE_FNV_OFFSET 14695981039346656037ULL
+#define FEATURECACHE_FNV_PRIME 1099511628211ULL
+
+struct FeatureCacheHeader {
+    char magic[8];
+    uint32_t version;
+    uint32_t headerSize;
+    uint64_t dimension; // Number of features per sample
+    FeatureStoreHogParams hogParams;
+};
+
+/**
+ * 64 bit FNV-1a hash, continued from a previous hash value
+ * @param data
+ * @param length number of bytes
+ * @param hash previous hash value, FEATURECACHE_FNV_OFFSET to start a new hash
+ * @return
+ */
+inline uint64_t featureCacheHash(const void* data, size_t length, uint64_t hash = FEATURECACHE_FNV_OFFSET) {
+    const unsigned char* bytes = static_cast<const unsigned char*> (data);
+    for (size_t i = 0; i < length; ++i) {
+        hash ^= bytes[i];
+        hash *= FEATURECACHE_FNV_PRIME;
+    }
+    return hash;
+}
+
+class FeatureCache {
+private:
+    FILE* fp;
+    FeatureCacheHeader header;
+    std::string fileName;
+    std::map<uint64_t, off_t> recordOffsets; // key -> file offset of the feature values
+    uint64_t addedRecords;
+    mutable pthread_mutex_t indexMutex; // Guards recordOffsets, lookups may run concurrently to adding samples
+
+    // Non-copyable, the cache owns the file handle
+    FeatureCache(const FeatureCache&);
+    FeatureCache& operator=(const FeatureCache&);
+
+    size_t recordSize() const {
+        return sizeof (uint64_t) + header.dimension * sizeof (float);
+    }
+
+    /**
+     * Reads the keys of all records of the opened cache file, a truncated last record (e.g. from an aborted run) is cut off
+     * @return true on success
+     */
+    bool readIndex() {
+        if (fseeko(fp, 0, SEEK_END) != 0) {
+            return false;
+        }
+        const off_t fileSize = ftello(fp);
+        off_t offset = sizeof (FeatureCacheHeader);
+        uint64_t key;
+        while (offset + (off_t) recordSize() <= fileSize && fseeko(fp, offset, SEEK_SET) == 0 && fread(&key, sizeof (key), 1, fp) == 1) {
+            recordOffsets[key] = offset + (off_t) sizeof (key);
+            offset += (off_t) recordSize();
+        }
+        fflush(fp);
+        if (ftruncate(fileno(fp), offset) != 0 || fseeko(fp, offset, SEEK_SET) != 0) {
+            printf("Error preparing feature cache '%s' for appending!\n", fileName.c_str());
+            return false;
+        }
+        return true;
+    }
+
+public:
+
+    FeatureCache() : fp(NULL), addedRecords(0) {
+        memset(&header, 0, sizeof (header));
+        pthread_mutex_init(&indexMutex, NULL);
+    }
+
+    virtual ~FeatureCache() {
+        close();
+        pthread_mutex_destroy(&indexMutex);
+    }
+
+    /**
+     * Opens (or creates) the cache file for the given HOG parameters in the cache directory
+     * @param _directory cache directory, created if it does not exist
+     * @param _dimension number of features per sample
+     * @param _hogParams HOG parameters the features are calculated with
+     * @return true on success
+     */
+    bool open(const std::string& _directory, uint64_t _dimension, const FeatureStoreHogParams& _hogParams) {
+        close();
+        if (mkdir(_directory.c_str(), 0755) != 0 && errno != EEXIST) {
+            printf("Error creating feature cache directory '%s'!\n", _directory.c_str());
+            return false;
+        }
+        memset(&header, 0, sizeof (header));
+        memcpy(header.magic, FEATURECACHE_MAGIC, sizeof (header.magic));
+        header.version = FEATURECACHE_VERSION;
+        header.headerSize = sizeof (FeatureCacheHeader);
+        header.dimension = _dimension;
+        header.hogParams = _hogParams;
+
+        char parameterHash[17];
+        snprintf(parameterHash, sizeof (parameterHash), "%016llx", (unsigned long long) featureCacheHash(&header, sizeof (header)));
+        fileName = _directory + ((!_directory.empty() && _directory[_directory.size() - 1] != '/') ? "/" : "") + "hog_" + parameterHash + ".cache";
+
+        fp = fopen(fileName.c_str(), "r+b");
+        if (fp != NULL) {
+            FeatureCacheHeader existingHeader;
+            if (fread(&existingHeader, sizeof (existingHeader), 1, fp) == 1 && memcmp(&existingHeader, &header, sizeof (header)) == 0) {
+                if (!readIndex()) {
+                    close();
+                    return false;
+                }
+                return true;
+            }
+            printf("Warning: Feature cache '%s' does not match the HOG parameters, recreating it\n", fileName.c_str());
+            fclose(fp);
+        }
+        fp = fopen(fileName.c_str(), "w+b");
+        if (fp == NULL || fwrite(&header, sizeof (header), 1, fp) != 1) {
+            printf("Error opening feature cache '%s' for writing!\n", fileName.c_str());
+            close();
+            return false;
+        }
+        return true;
+    }
+
+    /**
+     * Calculates the cache key of an image file
+     * @param _imageFileName
+     * @param _contentHash true to hash the file content, false to hash path, modification time and size
+     * @return key, 0 if the file cannot be accessed
+     */
+    static uint64_t sampleKey(const char* _imageFileName, bool _contentHash) {
+        if (_contentHash) {
+            FILE* image = fopen(_imageFileName, "rb");
+            if (image == NULL) {
+                return 0;
+            }
+            uint64_t hash = FEATURECACHE_FNV_OFFSET;
+            char buffer[65536];
+            size_t length;
+            while ((length = fread(buffer, 1, sizeof (buffer), image)) > 0) {
+                hash = featureCacheHash(buffer, length, hash);
+            }
+            fclose(image);
+            return (hash != 0) ? hash : 1;
+        }
+        struct stat fileStatus;
+        if (stat(_imageFileName, &fileStatus) != 0) {
+            return 0;
+        }
+        const int64_t modificationTime = (int64_t) fileStatus.st_mtime;
+        const int64_t fileSize = (int64_t) fileStatus.st_size;
+        uint64_t hash = featureCacheHash(_imageFileName, strlen(_imageFileName));
+        hash = featureCacheHash(&modificationTime, sizeof (modificationTime), hash);
+        hash = featureCacheHash(&fileSize, sizeof (fileSize), hash);
+        return (hash != 0) ? hash : 1;
+    }
+
+    /**
+     * Calculates the content-addressed cache key of an image file that has already been read into memory,
+     * equal to sampleKey(_imageFileName, true)
+     * @param data file content
+     * @param length number of bytes
+     * @return key
+     */
+    static uint64_t contentKey(const void* data, size_t length) {
+        const uint64_t hash = featureCacheHash(data, length);
+        return (hash != 0) ? hash : 1;
+    }
+
+    /**
+     * Looks up the feature vector of a sample, thread-safe
+     * @param key
+     * @param features resulting feature vector
+     * @return true if the sample was found in the cache
+     */
+    bool lookup(uint64_t key, std::vector<float>& features) const {
+        if (fp == NULL || key == 0) {
+            return false;
+        }
+        pthread_mutex_lock(&indexMutex);
+        std::map<uint64_t, off_t>::const_iterator record = recordOffsets.find(key);
+        const bool found = (record != recordOffsets.end());
+        const off_t offset = found ? record->second : 0;
+        pthread_mutex_unlock(&indexMutex);
+        if (!found) {
+            return false;
+        }
+        features.resize(header.dimension);
+        const ssize_t length = (ssize_t) (header.dimension * sizeof (float));
+        if (pread(fileno(fp), &features[0], length, offset) != length) {
+            features.clear();
+            return false;
+        }
+        return true;
+    }
+
+    /**
+     * Appends the feature vector of a sample, only one thread may add samples
+     * @param key
+     * @param features dimension feature values
+     * @return true on success
+     */
+    bool add(uint64_t key, const float* features) {
+        if (fp == NULL || key == 0) {
+            return false;
+        }
+        pthread_mutex_lock(&indexMutex);
+        const bool known = (recordOffsets.count(key) > 0);
+        pthread_mutex_unlock(&indexMutex);
+        if (known) {
+            return false;
+        }
+        const off_t offset = ftello(fp);
+        // Flushed right away, the sample becomes visible to concurrent lookups as soon as it is indexed
+        if (fwrite(&key, sizeof (key), 1, fp) != 1 || fwrite(features, sizeof (float), header.dimension, fp) != header.dimension || fflush(fp) != 0) {
+            printf("Error writing to feature cache '%s'!\n", fileName.c_str());
+            return false;
+        }
+        pthread_mutex_lock(&indexMutex);
+        recordOffsets[key] = offset + (off_t) sizeof (key);
+        pthread_mutex_unlock(&indexMutex);
+        ++addedRecords;
+        return true;
+    }
+
+    void close() {
+        if (fp != NULL) {
+            fclose(fp);
+            fp = NULL;
+        }
+        recordOffsets.clear();
+        addedRecords = 0;
+    }
+
+    bool isOpen() const {
+        return (fp != NULL);
+    }
+
+    uint64_t getCount() const {
+        return recordOffsets.size();
+    }
+
+    uint64_t getAddedCount() const {
+        return addedRecords;
+    }
+
+    const std::string& getFileName() const {
+        return fileName;
+    }
+};
+
+#endif	/* FEATURECACHE_H */
@@ -0,0 +1,553 @@
+/**
+ * @file:   featurestore.h
+ * @brief:  Dense binary feature store for the calculated HOG feature vectors,
+ * replacing the SVMlight text format as intermediate file between feature calculation and training.
+ *
+ * File layout (native byte order):
+ * 1. FeatureStoreHeader, containing dimension, sample count and the HOG parameters used
+ * 2. label array of <code>capacity</code> float values (+1 / -1), of which the first <code>count</code> are valid
+ * 3. contiguous float32 feature matrix starting at <code>dataOffset</code> (page aligned), one row of <code>dimension</code> values per sample
+ *
+ * For datasets larger than main memory the store can be memory-mapped (FeatureStoreMapping)
+ * and the training structures built from it be placed in a file-backed mapping (FileBackedBuffer),
+ * so that the kernel pages them to disk instead of swapping.
+ */
+
+#ifndef FEATURESTORE_H
+#define	FEATURESTORE_H
+
+#include <stdio.h>
+#include <string.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <string>
+#include <vector>
+#include <algorithm>
+
+#define FEATURESTORE_MAGIC "TRAINHOG"
+#define FEATURESTORE_VERSION 1
+#define FEATURESTORE_ALIGNMENT 4096
+// Number of samples converted at once when building training structures from a mapped feature store
+#define FEATURESTORE_CHUNK_SAMPLES 4096
+
+/**
+ * HOG parameters the features were calculated with, so that a feature store can be checked against the current settings
+ */
+struct FeatureStoreHogParams {
+    int32_t winWidth, winHeight;
+    int32_t blockWidth, blockHeight;
+    int32_t blockStrideWidth, blockStrideHeight;
+    int32_t cellWidth, cellHeight;
+    int32_t nbins;
+    int32_t derivAperture;
+    int32_t histogramNormType;
+    int32_t gammaCorrection;
+    int32_t nlevels;
+    int32_t reserved; // Keeps the struct size a multiple of 8 bytes
+    double winSigma;
+    double L2HysThreshold;
+};
+
+struct FeatureStoreHeader {
+    char magic[8];
+    uint32_t version;
+    uint32_t headerSize;
+    uint64_t dimension; // Number of features per sample
+    uint64_t count; // Number of valid samples
+    uint64_t capacity; // Number of reserved label slots, count <= capacity
+    uint64_t dataOffset; // Byte offset of the feature matrix
+    FeatureStoreHogParams hogParams;
+};
+
+inline uint64_t featureStoreDataOffset(uint64_t capacity) {
+    const uint64_t labelsEnd = sizeof (FeatureStoreHeader) + capacity * sizeof (float);
+    return ((labelsEnd + FEATURESTORE_ALIGNMENT - 1) / FEATURESTORE_ALIGNMENT) * FEATURESTORE_ALIGNMENT;
+}
+
+inline bool isValidFeatureStoreHeader(const FeatureStoreHeader& header) {
+    return (memcmp(header.magic, FEATURESTORE_MAGIC, sizeof (header.magic)) == 0
+            && header.version == FEATURESTORE_VERSION
+            && header.headerSize == sizeof (FeatureStoreHeader)
+            && header.count <= header.capacity
+            && header.dataOffset == featureStoreDataOffset(header.capacity));
+}
+
+/**
+ * Reads and validates the header of a feature store file
+ * @param fp opened file, positioned afterwards behind the header
+ * @param header the read header
+ * @return true if the file is a valid feature store
+ */
+inline bool readFeatureStoreHeader(FILE* fp, FeatureStoreHeader& header) {
+    if (fread(&header, sizeof (FeatureStoreHeader), 1, fp) != 1) {
+        return false;
+    }
+    return isValidFeatureStoreHeader(header);
+}
+
+/**
+ * Checks whether the given file is a binary feature store (and not e.g. a SVMlight text file)
+ * @param fileName
+ * @return true if the file starts with a valid feature store header
+ */
+inline bool isFeatureStore(const char* fileName) {
+    FILE* fp = fopen(fileName, "rb");
+    if (fp == NULL) {
+        return false;
+    }
+    FeatureStoreHeader header;
+    const bool valid = readFeatureStoreHeader(fp, header);
+    fclose(fp);
+    return valid;
+}
+
+/**
+ * Reads a complete feature store into memory
+ * @param fileName
+ * @param header the read header
+ * @param labels resulting sample labels (+1 / -1)
+ * @param features resulting row-major feature matrix of header.count x header.dimension values
+ * @return true on success
+ */
+inline bool readFeatureStore(const char* fileName, FeatureStoreHeader& header, std::vector<float>& labels, std::vector<float>& features) {
+    FILE* fp = fopen(fileName, "rb");
+    if (fp == NULL) {
+        printf("Error opening feature store '%s'!\n", fileName);
+        return false;
+    }
+    if (!readFeatureStoreHeader(fp, header)) {
+        printf("Error: '%s' is not a valid feature store!\n", fileName);
+        fclose(fp);
+        return false;
+    }
+    labels.resize(header.count);
+    features.resize(header.count * header.dimension);
+    bool success = (header.count == 0) || (fread(&labels[0], sizeof (float), header.count, fp) == header.count);
+    if (success && header.count > 0) {
+        success = (fseeko(fp, (off_t) header.dataOffset, SEEK_SET) == 0)
+                && (fread(&features[0], sizeof (float), features.size(), fp) == features.size());
+    }
+    if (!success) {
+        printf("Error: Feature store '%s' is truncated!\n", fileName);
+    }
+    fclose(fp);
+    return success;
+}
+
+/**
+ * Writes samples sequentially to a feature store file.
+ * The labels are kept in memory and written together with the final sample count on close()
+ */
+class FeatureStoreWriter {
+private:
+    FILE* fp;
+    FeatureStoreHeader header;
+    std::vector<float> labels;
+    std::string fileName;
+
+    // Non-copyable, the writer owns the file handle
+    FeatureStoreWriter(const FeatureStoreWriter&);
+    FeatureStoreWriter& operator=(const FeatureStoreWriter&);
+
+    /**
+     * Rewrites an existing feature store with more label slots, moving the feature matrix to the new data offset
+     * @param _fileName
+     * @param oldHeader header of the existing store
+     * @param newCapacity
+     * @return true on success
+     */
+    static bool growCapacity(const std::string& _fileName, const FeatureStoreHeader& oldHeader, uint64_t newCapacity) {
+        const std::string tempFileName = _fileName + ".tmp";
+        FILE* in = fopen(_fileName.c_str(), "rb");
+        FILE* out = fopen(tempFileName.c_str(), "wb");
+        bool success = (in != NULL && out != NULL);
+        FeatureStoreHeader newHeader = oldHeader;
+        newHeader.capacity = newCapacity;
+        newHeader.dataOffset = featureStoreDataOffset(newCapacity);
+        std::vector<char> buffer(1 << 20);
+        // Header and labels
+        success = success && (fwrite(&newHeader, sizeof (FeatureStoreHeader), 1, out) == 1);
+        if (success && oldHeader.count > 0) {
+            std::vector<float> oldLabels(oldHeader.count);
+            success = (fseeko(in, sizeof (FeatureStoreHeader), SEEK_SET) == 0)
+                    && (fread(&oldLabels[0], sizeof (float), oldHeader.count, in) == oldHeader.count)
+                    && (fwrite(&oldLabels[0], sizeof (float), oldHeader.count, out) == oldHeader.count);
+        }
+        // Feature matrix
+        uint64_t remaining = oldHeader.count * oldHeader.dimension * sizeof (float);
+        success = success && (fseeko(in, (off_t) oldHeader.dataOffset, SEEK_SET) == 0) && (fseeko(out, (off_t) newHeader.dataOffset, SEEK_SET) == 0);
+        while (success && remaining > 0) {
+            const size_t chunk = (size_t) std::min((uint64_t) buffer.size(), remaining);
+            success = (fread(&buffer[0], 1, chunk, in) == chunk) && (fwrite(&buffer[0], 1, chunk, out) == chunk);
+            remaining -= chunk;
+        }
+        if (in != NULL) {
+            fclose(in);
+        }
+        if (out != NULL) {
+            success = (fclose(out) == 0) && success;
+        }
+        success = success && (rename(tempFileName.c_str(), _fileName.c_str()) == 0);
+        if (!success) {
+            printf("Error growing capacity of feature store '%s'!\n", _fileName.c_str());
+            remove(tempFileName.c_str());
+        }
+        return success;
+    }
+
+public:
+
+    FeatureStoreWriter() : fp(NULL) {
+        memset(&header, 0, sizeof (header));
+    }
+
+    virtual ~FeatureStoreWriter() {
+        close();
+    }
+
+    /**
+     * Creates a new, empty feature store, overwriting an existing file
+     * @param _fileName
+     * @param _dimension number of features per sample
+     * @param _capacity maximum number of samples that will be added
+     * @param _hogParams HOG parameters the features were calculated with
+     * @return true on success
+     */
+    bool open(const std::string& _fileName, uint64_t _dimension, uint64_t _capacity, const FeatureStoreHogParams& _hogParams) {
+        close();
+        fileName = _fileName;
+        fp = fopen(fileName.c_str(), "wb");
+        if (fp == NULL) {
+            printf("Error opening feature store '%s' for writing!\n", fileName.c_str());
+            return false;
+        }
+        memset(&header, 0, sizeof (header));
+        memcpy(header.magic, FEATURESTORE_MAGIC, sizeof (header.magic));
+        header.version = FEATURESTORE_VERSION;
+        header.headerSize = sizeof (FeatureStoreHeader);
+        header.dimension = _dimension;
+        header.count = 0;
+        header.capacity = _capacity;
+        header.dataOffset = featureStoreDataOffset(_capacity);
+        header.hogParams = _hogParams;
+        labels.clear();
+        labels.reserve(_capacity);
+        // Header and labels are (re-)written on close, skip to the beginning of the feature matrix
+        if (fseeko(fp, (off_t) header.dataOffset, SEEK_SET) != 0) {
+            printf("Error seeking in feature store '%s'!\n", fileName.c_str());
+            fclose(fp);
+            fp = NULL;
+            return false;
+        }
+        return true;
+    }
+
+    /**
+     * Opens an existing feature store for appending further samples
+     * @param _fileName
+     * @param _additionalSamples maximum number of samples that will be appended, the store is rewritten with more capacity if necessary
+     * @return true on success
+     */
+    bool openForAppend(const std::string& _fileName, uint64_t _additionalSamples) {
+        close();
+        fileName = _fileName;
+        fp = fopen(fileName.c_str(), "r+b");
+        if (fp == NULL || !readFeatureStoreHeader(fp, header)) {
+            printf("Error opening feature store '%s' for appending!\n", fileName.c_str());
+            if (fp != NULL) {
+                fclose(fp);
+                fp = NULL;
+            }
+            return false;
+        }
+        if (header.count + _additionalSamples > header.capacity) {
+            fclose(fp);
+            fp = NULL;
+            const uint64_t newCapacity = std::max(2 * header.capacity, header.count + _additionalSamples);
+            if (!growCapacity(fileName, header, newCapacity)) {
+                return false;
+            }
+            fp = fopen(fileName.c_str(), "r+b");
+            if (fp == NULL || !readFeatureStoreHeader(fp, header)) {
+                printf("Error reopening feature store '%s' for appending!\n", fileName.c_str());
+                if (fp != NULL) {
+                    fclose(fp);
+                    fp = NULL;
+                }
+                return false;
+            }
+        }
+        labels.resize(header.count);
+        bool success = (header.count == 0) || (fread(&labels[0], sizeof (float), header.count, fp) == header.count);
+        // Continue writing behind the last sample
+        success = success && (fseeko(fp, (off_t) (header.dataOffset + header.count * header.dimension * sizeof (float)), SEEK_SET) == 0);
+        if (!success) {
+            printf("Error reading feature store '%s' for appending!\n", fileName.c_str());
+            fclose(fp);
+            fp = NULL;
+        }
+        return success;
+    }
+
+    /**
+     * Appends a sample to the store
+     * @param label sample class, +1 for positive and -1 for negative samples
+     * @param features pointer to <code>dimension</code> feature values
+     * @return true on success
+     */
+    bool addSample(float label, const float* features) {
+        if (fp == NULL || header.count >= header.capacity) {
+            printf("Error: Feature store '%s' is not open or its capacity of %lu samples is exceeded!\n", fileName.c_str(), (unsigned long) header.capacity);
+            return false;
+        }
+        if (fwrite(features, sizeof (float), header.dimension, fp) != header.dimension) {
+            printf("Error writing to feature store '%s'!\n", fileName.c_str());
+            return false;
+        }
+        labels.push_back(label);
+        ++header.count;
+        return true;
+    }
+
+    /**
+     * Writes header and labels and closes the file
+     * @return true on success
+     */
+    bool close() {
+        if (fp == NULL) {
+            return true;
+        }
+        bool success = (fseeko(fp, 0, SEEK_SET) == 0)
+                && (fwrite(&header, sizeof (FeatureStoreHeader), 1, fp) == 1)
+                && (labels.empty() || fwrite(&labels[0], sizeof (float), labels.size(), fp) == labels.size());
+        success = (fclose(fp) == 0) && success;
+        fp = NULL;
+        if (!success) {
+            printf("Error finalizing feature store '%s'!\n", fileName.c_str());
+        }
+        return success;
+    }
+
+    uint64_t getCount() const {
+        return header.count;
+    }
+
+    uint64_t getDimension() const {
+        return header.dimension;
+    }
+
+    const FeatureStoreHogParams& getHogParams() const {
+        return header.hogParams;
+    }
+
+};
+
+/**
+ * Read-only memory mapping of a feature store, the feature matrix is accessed in place without copying it to the heap
+ */
+class FeatureStoreMapping {
+private:
+    void* mapping;
+    size_t mappingSize;
+    FeatureStoreHeader header;
+
+    // Non-copyable, the object owns the mapping
+    FeatureStoreMapping(const FeatureStoreMapping&);
+    FeatureStoreMapping& operator=(const FeatureStoreMapping&);
+
+public:
+
+    FeatureStoreMapping() : mapping(NULL), mappingSize(0) {
+        memset(&header, 0, sizeof (header));
+    }
+
+    virtual ~FeatureStoreMapping() {
+        close();
+    }
+
+    /**
+     * Maps the given feature store into memory
+     * @param fileName
+     * @return true on success
+     */
+    bool open(const char* fileName) {
+        close();
+        int fd = ::open(fileName, O_RDONLY);
+        if (fd < 0) {
+            printf("Error opening feature store '%s'!\n", fileName);
+            return false;
+        }
+        struct stat fileStat;
+        if (fstat(fd, &fileStat) != 0 || (size_t) fileStat.st_size < sizeof (FeatureStoreHeader)
+                || pread(fd, &header, sizeof (FeatureStoreHeader), 0) != (ssize_t) sizeof (FeatureStoreHeader)
+                || !isValidFeatureStoreHeader(header)) {
+            printf("Error: '%s' is not a valid feature store!\n", fileName);
+            ::close(fd);
+            return false;
+        }
+        const uint64_t requiredSize = (header.count > 0) ? header.dataOffset + header.count * header.dimension * sizeof (float) : sizeof (FeatureStoreHeader) + header.capacity * sizeof (float);
+        if ((uint64_t) fileStat.st_size < requiredSize) {
+            printf("Error: Feature store '%s' is truncated!\n", fileName);
+            ::close(fd);
+            return false;
+        }
+        mappingSize = (size_t) requiredSize;
+        mapping = mmap(NULL, mappingSize, PROT_READ, MAP_SHARED, fd, 0);
+        ::close(fd); // The mapping stays valid after closing the descriptor
+        if (mapping == MAP_FAILED) {
+            printf("Error mapping feature store '%s' into memory!\n", fileName);
+            mapping = NULL;
+            mappingSize = 0;
+            return false;
+        }
+        madvise(mapping, mappingSize, MADV_SEQUENTIAL);
+        return true;
+    }
+
+    void close() {
+        if (mapping != NULL) {
+            munmap(mapping, mappingSize);
+            mapping = NULL;
+            mappingSize = 0;
+        }
+    }
+
+    /**
+     * Tells the kernel that the pages of the given samples are not needed anymore, e.g. after they have been converted
+     * @param firstSample
+     * @param sampleCount
+     */
+    void releaseSamples(uint64_t firstSample, uint64_t sampleCount) {
+        const long pageSize = sysconf(_SC_PAGESIZE);
+        uint64_t begin = header.dataOffset + firstSample * header.dimension * sizeof (float);
+        uint64_t end = begin + sampleCount * header.dimension * sizeof (float);
+        begin = ((begin + pageSize - 1) / pageSize) * pageSize; // Only release pages completely covered by the samples
+        end = (end / pageSize) * pageSize;
+        if (mapping != NULL && end > begin) {
+            madvise(static_cast<char*> (mapping) + begin, end - begin, MADV_DONTNEED);
+        }
+    }
+
+    const FeatureStoreHeader& getHeader() const {
+        return header;
+    }
+
+    uint64_t getCount() const {
+        return header.count;
+    }
+
+    uint64_t getDimension() const {
+        return header.dimension;
+    }
+
+    const float* getLabels() const {
+        return reinterpret_cast<const float*> (static_cast<const char*> (mapping) + sizeof (FeatureStoreHeader));
+    }
+
+    const float* getSample(uint64_t sample) const {
+        return reinterpret_cast<const float*> (static_cast<const char*> (mapping) + header.dataOffset) + sample * header.dimension;
+    }
+
+};
+
+/**
+ * Memory buffer backed by an anonymous temporary file instead of swap space.
+ * Dirty pages are written back to the file and can be evicted, so that training structures larger than main memory stay usable.
+ */
+class FileBackedBuffer {
+private:
+    void* data;
+    size_t size;
+
+    // Non-copyable, the object owns the mapping
+    FileBackedBuffer(const FileBackedBuffer&);
+    FileBackedBuffer& operator=(const FileBackedBuffer&);
+
+public:
+
+    FileBackedBuffer() : data(NULL), size(0) {
+    }
+
+    virtual ~FileBackedBuffer() {
+        release();
+    }
+
+    /**
+     * Allocates the buffer in a temporary file, which is removed again when the buffer is released
+     * @param directory directory to create the temporary file in, including trailing slash
+     * @param _size size of the buffer in bytes
+     * @return pointer to the buffer or NULL on failure
+     */
+    void* allocate(const std::string& directory, size_t _size) {
+        release();
+        std::string pattern = directory + "trainhog_scratch_XXXXXX";
+        std::vector<char> fileName(pattern.begin(), pattern.end());
+        fileName.push_back('\0');
+        int fd = mkstemp(&fileName[0]);
+        if (fd < 0) {
+            printf("Error creating temporary file in '%s'!\n", directory.c_str());
+            return NULL;
+        }
+        unlink(&fileName[0]); // The file is removed as soon as the mapping is gone
+        if (ftruncate(fd, (off_t) _size) != 0) {
+            printf("Error reserving %lu bytes in temporary file in '%s'!\n", (unsigned long) _size, directory.c_str());
+            ::close(fd);
+            return NULL;
+        }
+        data = mmap(NULL, _size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+        ::close(fd);
+        if (data == MAP_FAILED) {
+            printf("Error mapping temporary file in '%s'!\n", directory.c_str());
+            data = NULL;
+            return NULL;
+        }
+        size = _size;
+        return data;
+    }
+
+    /**
+     * Starts writing back the given range to the file, so that the pages can be evicted without stalling later
+     * @param offset in bytes
+     * @param length in bytes
+     */
+    void flush(size_t offset, size_t length) {
+        const long pageSize = sysconf(_SC_PAGESIZE);
+        const size_t begin = (offset / pageSize) * pageSize;
+        if (data != NULL && begin < size) {
+            msync(static_cast<char*> (data) + begin, std::min(offset + length, size) - begin, MS_ASYNC);
+        }
+    }
+
+    void release() {
+        if (data != NULL) {
+            munmap(data, size);
+            data = NULL;
+            size = 0;
+        }
+    }
+
+    void* getData() const {
+        return data;
+    }
+
+    bool isAllocated() const {
+        return (data != NULL);
+    }
+
+    /**
+     * Exchanges the mappings of two buffers, e.g. when the owning objects are swapped
+     * @param other
+     */
+    void swap(FileBackedBuffer& other) {
+        std::swap(data, other.data);
+        std::swap(size, other.size);
+    }
+
+};
+
+#endif	/* FEATURESTORE_H */
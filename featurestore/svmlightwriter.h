@@ -0,0 +1,423 @@
+/**
+ * @file:   svmlightwriter.h
+ * @brief:  Streaming writer for feature vectors in SVMlight text format (<label> <index>:<value> ...), e.g. for use with the external svm_learn.
+ *
+ * Lines are formatted into a large user-space buffer by a locale independent number formatter
+ * (shortest decimal representation that reads back to the same float), instead of formatting every number with iostreams.
+ * File names ending with .gz or .zst are compressed on the fly if compiled with TRAINHOG_USE_ZLIB (-lz) or TRAINHOG_USE_ZSTD (-lzstd).
+ */
+
+#ifndef SVMLIGHTWRITER_H
+#define	SVMLIGHTWRITER_H
+
+#include <stdio.h>
+#include <string.h>
+#include <stdint.h>
+#include <math.h>
+#include <string>
+#include <vector>
+#ifdef TRAINHOG_USE_ZLIB
+#include <zlib.h>
+#endif
+#ifdef TRAINHOG_USE_ZSTD
+#include <zstd.h>
+#endif
+
+#define SVMLIGHTWRITER_BUFFER_SIZE (4 * 1024 * 1024)
+
+/**
+ * Writes an unsigned integer as decimal digits
+ * @param value
+ * @param out buffer of at least 20 characters
+ * @return number of characters written (not terminated)
+ */
+inline int formatUnsigned(uint64_t value, char* out) {
+    char digits[20];
+    int length = 0;
+    do {
+        digits[length++] = (char) ('0' + value % 10);
+        value /= 10;
+    } while (value > 0);
+    for (int i = 0; i < length; ++i) {
+        out[i] = digits[length - 1 - i];
+    }
+    return length;
+}
+
+/**
+ * @param exponent
+ * @return 10^exponent, exact for |exponent| <= 22
+ */
+inline double powerOfTen(int exponent) {
+    static const double powersOfTen[] = {1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11, 1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22};
+    if (exponent >= 0 && exponent <= 22) {
+        return powersOfTen[exponent];
+    }
+    return (exponent < 0 && exponent >= -22) ? 1.0 / powersOfTen[-exponent] : pow(10.0, exponent);
+}
+
+/**
+ * Rounds a positive float to the given number of significant digits
+ * @param value
+ * @param exponent decimal exponent of the leading digit of value
+ * @param precision number of significant digits
+ * @param digits resulting significant digits, may be 10^precision if rounded up to the next power of ten
+ * @return true if the rounded number reads back to the same float
+ */
+inline bool roundToSignificantDigits(float value, int exponent, int precision, uint64_t& digits) {
+    // digits = round(value * 10^(precision - 1 - exponent)), exact powers of ten keep the double arithmetic within 1 ulp
+    const int shift = precision - 1 - exponent;
+    const int magnitude = (shift >= 0) ? shift : -shift;
+    const double scale = powerOfTen(magnitude);
+    digits = (uint64_t) (((shift >= 0) ? (double) value * scale : (double) value / scale) + 0.5);
+    const double restored = (shift >= 0) ? digits / scale : digits * scale;
+    return ((float) restored == value);
+}
+
+/**
+ * Writes a float as the shortest decimal number (at most 9 significant digits) that reads back to the same float,
+ * in fixed notation for moderate exponents and in scientific notation otherwise, always with a decimal point independent of the locale
+ * @param value
+ * @param out buffer of at least 24 characters
+ * @return number of characters written (not terminated)
+ */
+inline int formatFloat(float value, char* out) {
+    if (value == 0.0f) {
+        out[0] = '0';
+        return 1;
+    }
+    if (value != value) {
+        memcpy(out, "nan", 3);
+        return 3;
+    }
+    int length = 0;
+    if (value < 0.0f) {
+        out[length++] = '-';
+        value = -value;
+    }
+    if (value > 3.4028235e38f) {
+        memcpy(out + length, "inf", 3);
+        return length + 3;
+    }
+    // Decimal exponent of the leading digit, log10 may be off by one next to powers of ten
+    int exponent = (int) floor(log10((double) value));
+    if ((double) value >= powerOfTen(exponent + 1)) {
+        ++exponent;
+    } else if ((double) value < powerOfTen(exponent)) {
+        --exponent;
+    }
+    // Binary search for the fewest significant digits reading back to the same float, 9 digits always do
+    int low = 1;
+    int precision = 9;
+    uint64_t digits;
+    roundToSignificantDigits(value, exponent, precision, digits);
+    while (low < precision) {
+        const int middle = (low + precision) / 2;
+        uint64_t middleDigits;
+        if (roundToSignificantDigits(value, exponent, middle, middleDigits)) {
+            precision = middle;
+            digits = middleDigits;
+        } else {
+            low = middle + 1;
+        }
+    }
+    uint64_t limit = 1;
+    for (int digit = 0; digit < precision; ++digit) {
+        limit *= 10;
+    }
+    if (digits >= limit) {
+        // Rounded up to the next power of ten, e.g. 9.99 -> 10.0
+        digits /= 10;
+        ++exponent;
+    }
+    // Strip trailing zeros of the significand
+    while (precision > 1 && digits % 10 == 0) {
+        digits /= 10;
+        --precision;
+    }
+    char significand[20];
+    formatUnsigned(digits, significand);
+    if (exponent >= -5 && exponent < 9) {
+        if (exponent < 0) {
+            out[length++] = '0';
+            out[length++] = '.';
+            for (int zero = -1; zero > exponent; --zero) {
+                out[length++] = '0';
+            }
+            memcpy(out + length, significand, precision);
+            length += precision;
+        } else if (precision > exponent + 1) {
+            memcpy(out + length, significand, exponent + 1);
+            length += exponent + 1;
+            out[length++] = '.';
+            memcpy(out + length, significand + exponent + 1, precision - exponent - 1);
+            length += precision - exponent - 1;
+        } else {
+            memcpy(out + length, significand, precision);
+            length += precision;
+            for (int zero = precision; zero <= exponent; ++zero) {
+                out[length++] = '0';
+            }
+        }
+        return length;
+    }
+    out[length++] = significand[0];
+    if (precision > 1) {
+        out[length++] = '.';
+        memcpy(out + length, significand + 1, precision - 1);
+        length += precision - 1;
+    }
+    out[length++] = 'e';
+    if (exponent < 0) {
+        out[length++] = '-';
+        exponent = -exponent;
+    }
+    return length + formatUnsigned((uint64_t) exponent, out + length);
+}
+
+class SvmLightWriter {
+private:
+    FILE* fp;
+#ifdef TRAINHOG_USE_ZLIB
+    gzFile gzfp;
+#endif
+#ifdef TRAINHOG_USE_ZSTD
+    ZSTD_CCtx* zstdContext;
+    std::vector<char> zstdBuffer;
+#endif
+    std::string fileName;
+    std::vector<char> buffer;
+    size_t used;
+    uint64_t bytesWritten; // Uncompressed
+    bool failed;
+
+    // Non-copyable, the writer owns the file handle
+    SvmLightWriter(const SvmLightWriter&);
+    SvmLightWriter& operator=(const SvmLightWriter&);
+
+    static bool endsWith(const std::string& text, const char* suffix) {
+        const size_t length = strlen(suffix);
+        return (text.size() >= length && text.compare(text.size() - length, length, suffix) == 0);
+    }
+
+#ifdef TRAINHOG_USE_ZSTD
+    bool writeZstd(const char* data, size_t length, ZSTD_EndDirective mode) {
+        ZSTD_inBuffer input = {data, length, 0};
+        bool finished = false;
+        while (!finished) {
+            ZSTD_outBuffer output = {&zstdBuffer[0], zstdBuffer.size(), 0};
+            const size_t remaining = ZSTD_compressStream2(zstdContext, &output, &input, mode);
+            if (ZSTD_isError(remaining) || fwrite(&zstdBuffer[0], 1, output.pos, fp) != output.pos) {
+                return false;
+            }
+            finished = (mode == ZSTD_e_end) ? (remaining == 0) : (input.pos == input.size);
+        }
+        return true;
+    }
+#endif
+
+    /**
+     * Writes out the buffered text
+     * @return true on success
+     */
+    bool flushBuffer() {
+        if (used == 0 || failed || !isOpen()) {
+            used = 0;
+            return !failed;
+        }
+#ifdef TRAINHOG_USE_ZLIB
+        if (gzfp != NULL) {
+            failed = (gzwrite(gzfp, &buffer[0], (unsigned) used) != (int) used);
+        } else
+#endif
+#ifdef TRAINHOG_USE_ZSTD
+        if (zstdContext != NULL) {
+            failed = !writeZstd(&buffer[0], used, ZSTD_e_continue);
+        } else
+#endif
+        {
+            failed = (fwrite(&buffer[0], 1, used, fp) != used);
+        }
+        if (failed) {
+            printf("Error writing to file '%s'!\n", fileName.c_str());
+        }
+        bytesWritten += used;
+        used = 0;
+        return !failed;
+    }
+
+    /**
+     * Makes room for the given number of characters in the buffer
+     * @param length
+     * @return pointer to the free buffer space
+     */
+    char* reserve(size_t length) {
+        if (used + length > buffer.size()) {
+            flushBuffer();
+            if (length > buffer.size()) {
+                buffer.resize(length);
+            }
+        }
+        return &buffer[used];
+    }
+
+public:
+
+    SvmLightWriter() : fp(NULL), used(0), bytesWritten(0), failed(false) {
+#ifdef TRAINHOG_USE_ZLIB
+        gzfp = NULL;
+#endif
+#ifdef TRAINHOG_USE_ZSTD
+        zstdContext = NULL;
+#endif
+    }
+
+    virtual ~SvmLightWriter() {
+        close();
+    }
+
+    /**
+     * Opens the file for writing, compressed if the file name ends with .gz or .zst
+     * @param _fileName
+     * @param append true to append to an existing file, compressed files get another gzip member / zstd frame
+     * @return true on success
+     */
+    bool open(const std::string& _fileName, bool append = false) {
+        close();
+        fileName = _fileName;
+        used = 0;
+        bytesWritten = 0;
+        failed = false;
+        buffer.resize(SVMLIGHTWRITER_BUFFER_SIZE);
+        if (endsWith(fileName, ".gz")) {
+#ifdef TRAINHOG_USE_ZLIB
+            gzfp = gzopen(fileName.c_str(), append ? "ab6" : "wb6");
+            if (gzfp == NULL) {
+                printf("Error opening file '%s'!\n", fileName.c_str());
+                return false;
+            }
+            gzbuffer(gzfp, SVMLIGHTWRITER_BUFFER_SIZE);
+            return true;
+#else
+            printf("Error: Writing '%s' requires gzip support, compile with TRAINHOG_USE_ZLIB!\n", fileName.c_str());
+            return false;
+#endif
+        }
+        fp = fopen(fileName.c_str(), append ? "ab" : "wb");
+        if (fp == NULL) {
+            printf("Error opening file '%s'!\n", fileName.c_str());
+            return false;
+        }
+        if (endsWith(fileName, ".zst")) {
+#ifdef TRAINHOG_USE_ZSTD
+            zstdContext = ZSTD_createCCtx();
+            zstdBuffer.resize(ZSTD_CStreamOutSize());
+#else
+            printf("Error: Writing '%s' requires zstd support, compile with TRAINHOG_USE_ZSTD!\n", fileName.c_str());
+            close();
+            return false;
+#endif
+        }
+        return true;
+    }
+
+    /**
+     * Writes a comment line (not supported by libsvm)
+     * @param comment
+     */
+    void writeComment(const std::string& comment) {
+        char* out = reserve(comment.size() + 3);
+        out[0] = '#';
+        out[1] = ' ';
+        memcpy(out + 2, comment.data(), comment.size());
+        out[comment.size() + 2] = '\n';
+        used += comment.size() + 3;
+    }
+
+    /**
+     * Writes a line of space-separated values without indices, e.g. a detecting vector
+     * @param values
+     * @param count number of values
+     */
+    void writeValues(const float* values, size_t count) {
+        for (size_t i = 0; i < count; ++i) {
+            char* out = reserve(32);
+            const int length = formatFloat(values[i], out);
+            out[length] = ' ';
+            used += length + 1;
+        }
+        *reserve(1) = '\n';
+        ++used;
+    }
+
+    /**
+     * Writes a sample, features are numbered from 1 as SVMlight expects
+     * @param label +1 / -1
+     * @param features
+     * @param dimension number of features
+     */
+    void writeSample(float label, const float* features, size_t dimension) {
+        char* out = reserve(2);
+        out[0] = (label > 0) ? '+' : '-';
+        out[1] = '1';
+        used += 2;
+        for (size_t feature = 0; feature < dimension; ++feature) {
+            out = reserve(48);
+            char* begin = out;
+            *out++ = ' ';
+            out += formatUnsigned(feature + 1, out);
+            *out++ = ':';
+            out += formatFloat(features[feature], out);
+            used += out - begin;
+        }
+        *reserve(1) = '\n';
+        ++used;
+    }
+
+    /**
+     * Flushes the buffer and closes the file
+     * @return true if everything was written successfully
+     */
+    bool close() {
+        bool success = !failed;
+#ifdef TRAINHOG_USE_ZLIB
+        if (gzfp != NULL) {
+            success = flushBuffer() && success;
+            success = (gzclose(gzfp) == Z_OK) && success;
+            gzfp = NULL;
+        }
+#endif
+        if (fp != NULL) {
+            success = flushBuffer() && success;
+#ifdef TRAINHOG_USE_ZSTD
+            if (zstdContext != NULL) {
+                success = writeZstd(NULL, 0, ZSTD_e_end) && success;
+                ZSTD_freeCCtx(zstdContext);
+                zstdContext = NULL;
+            }
+#endif
+            success = (fclose(fp) == 0) && success;
+            fp = NULL;
+        }
+        used = 0;
+        return success;
+    }
+
+    bool isOpen() const {
+#ifdef TRAINHOG_USE_ZLIB
+        if (gzfp != NULL) {
+            return true;
+        }
+#endif
+        return (fp != NULL);
+    }
+
+    /**
+     * @return number of (uncompressed) bytes written so far, excluding the buffered ones
+     */
+    uint64_t getBytesWritten() const {
+        return bytesWritten;
+    }
+};
+
+#endif	/* SVMLIGHTWRITER_H */
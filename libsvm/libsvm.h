@@ -5,6 +5,8 @@
  * @brief:  Wrapper interface for libSVM, 
  * @see http://www.csie.ntu.edu.tw/~cjlin/libsvm/ for libSVM details and terms of use
  *
+ * Besides the instance used by main (getInstance), independent instances can be created, each owning its parameters,
+ * problem and model, which can train concurrently (libSVM's solver keeps no global state, except for the print function).
  */
 
 #ifndef LIBSVM_H
@@ -15,8 +17,10 @@
 #include <ctype.h>
 #include <string.h>
 #include <vector>
-#include <locale.h>
+#include <string>
+#include <algorithm>
 #include <stdlib.h>
+#include "../featurestore/featurestore.h"
 
 // Precision to use (float / double)
 typedef float prec;
@@ -34,6 +38,8 @@ private:
     struct svm_problem prob; // set by read_problem
     struct svm_model* model;
     struct svm_node* x_space;
+    std::string fileBackedDirectory; // If set, x_space is placed in a temporary file in this directory
+    FileBackedBuffer fileBackedNodes; // Holds x_space if file-backed memory is used
 
     bool trainingDataStructsUsed;
     bool predictionDataStructsUsed;
@@ -52,6 +58,65 @@ private:
 
     char* readline(FILE *input);
 
+    /**
+     * Allocates the problem structures for the given problem size
+     * @param sampleCount
+     * @param dimension
+     */
+    void allocateProblem(int sampleCount, int dimension) {
+        freeProblem(); // Allows reading in a new problem, e.g. for retraining
+        const size_t elements = (size_t) sampleCount * (dimension + 1);
+        prob.l = sampleCount;
+        prob.y = Malloc(double, prob.l);
+        prob.x = Malloc(struct svm_node *, prob.l);
+        if (!fileBackedDirectory.empty()) {
+            x_space = static_cast<struct svm_node*> (fileBackedNodes.allocate(fileBackedDirectory, elements * sizeof (struct svm_node)));
+            if (x_space == NULL) {
+                exit(EXIT_FAILURE);
+            }
+        } else {
+            x_space = Malloc(struct svm_node, elements);
+        }
+        if (param.gamma == 0 && dimension > 0) {
+            param.gamma = 1.0 / dimension;
+        }
+        this->trainingDataStructsUsed = true;
+    }
+
+    /**
+     * Converts a range of samples into the problem structures, see allocateProblem
+     * @param firstSample index of the first sample to convert
+     * @param sampleCount number of samples to convert
+     * @param labels labels of the samples to convert
+     * @param features row-major features of the samples to convert
+     * @param dimension
+     */
+    void fillProblem(int firstSample, int sampleCount, const float* labels, const float* features, int dimension) {
+        size_t j = (size_t) firstSample * (dimension + 1);
+        for (int sample = 0; sample < sampleCount; ++sample) {
+            const float* sampleFeatures = features + (size_t) sample * dimension;
+            prob.x[firstSample + sample] = &x_space[j];
+            prob.y[firstSample + sample] = labels[sample];
+            for (int feature = 0; feature < dimension; ++feature) {
+                x_space[j].index = feature + 1;
+                x_space[j].value = sampleFeatures[feature];
+                ++j;
+            }
+            x_space[j++].index = -1;
+        }
+        if (fileBackedNodes.isAllocated()) {
+            fileBackedNodes.flush((size_t) firstSample * (dimension + 1) * sizeof (struct svm_node), (size_t) sampleCount * (dimension + 1) * sizeof (struct svm_node));
+        }
+    }
+
+    // Non-copyable, the object owns the problem and the model, @see swap
+    libSVM(const libSVM&);
+    libSVM& operator=(const libSVM&);
+
+public:
+
+    struct svm_parameter param; // set by parse_command_line
+
     libSVM() : trainingDataStructsUsed(false), predictionDataStructsUsed(false) {
         line = NULL;
         max_nr_attr = 64;
@@ -89,11 +154,36 @@ private:
         this->freeMem();
     }
 
-public:
+    static libSVM* getInstance();
 
-    struct svm_parameter param; // set by parse_command_line
+    /**
+     * Exchanges the complete state (parameters, problem, model) with another instance, the C++98 replacement of a move,
+     * e.g. to hand a trained model over to an instance living longer
+     * @param other
+     */
+    void swap(libSVM& other) {
+        std::swap(prob, other.prob);
+        std::swap(model, other.model);
+        std::swap(x_space, other.x_space);
+        fileBackedDirectory.swap(other.fileBackedDirectory);
+        fileBackedNodes.swap(other.fileBackedNodes);
+        std::swap(trainingDataStructsUsed, other.trainingDataStructsUsed);
+        std::swap(predictionDataStructsUsed, other.predictionDataStructsUsed);
+        std::swap(max_nr_attr, other.max_nr_attr);
+        std::swap(predict_probability, other.predict_probability);
+        std::swap(line, other.line);
+        std::swap(max_line_len, other.max_line_len);
+        std::swap(param, other.param);
+    }
 
-    static libSVM* getInstance();
+    /**
+     * Places the problem nodes (x_space) in a temporary file instead of the heap,
+     * so that training sets larger than main memory do not cause swapping. Must be called before read_problem
+     * @param _directory directory for the temporary file including trailing slash, empty to use the heap
+     */
+    void useFileBackedMemory(const std::string& _directory) {
+        fileBackedDirectory = _directory;
+    }
 
     const char* getSVMName() const {
         return "libSVM";
@@ -102,24 +192,77 @@ public:
     void freeMem() {
         // Try to avoid a double-free being thrown because the objects may not be allocated, because the functions that allocate them are not being called
         if (this->trainingDataStructsUsed) {
-            free(prob.y);
-            free(prob.x);
-            free(x_space);
-            free(line);            
+            freeProblem();
+            free(line);
+            line = NULL;
         }
         svm_destroy_param(&this->param);
         svm_free_and_destroy_model(&model); // The model is used in training and prediction specific steps
     }
 
     /**
-     * Reads in a file in svmlight format
+     * Frees the training problem, e.g. before reading in a new one
+     */
+    void freeProblem() {
+        if (this->trainingDataStructsUsed) {
+            free(prob.y);
+            free(prob.x);
+            if (fileBackedNodes.isAllocated()) {
+                fileBackedNodes.release();
+            } else {
+                free(x_space);
+            }
+            prob.y = NULL;
+            prob.x = NULL;
+            prob.l = 0;
+            x_space = NULL;
+        }
+    }
+
+    /**
+     * Builds the training problem directly from memory, from labels and a dense, row-major feature matrix
+     * @param labels sampleCount labels (+1 / -1)
+     * @param features sampleCount x dimension feature values, e.g. the data of a continuous CV_32F cv::Mat
+     * @param sampleCount
+     * @param dimension
+     */
+    void read_problem(const float* labels, const float* features, int sampleCount, int dimension) {
+        allocateProblem(sampleCount, dimension);
+        fillProblem(0, sampleCount, labels, features, dimension);
+    }
+
+    /**
+     * Builds the training problem directly from memory
+     * @param labels one label (+1 / -1) per sample
+     * @param features row-major feature matrix, labels.size() x dimension values
+     */
+    void read_problem(const std::vector<float>& labels, const std::vector<float>& features) {
+        const int sampleCount = labels.size();
+        const int dimension = (sampleCount > 0) ? (features.size() / sampleCount) : 0;
+        read_problem(sampleCount > 0 ? &labels[0] : NULL, sampleCount > 0 ? &features[0] : NULL, sampleCount, dimension);
+    }
+
+    /**
+     * Reads in a binary feature store or a file in svmlight format
      * @param filename
      */
     void read_problem(char *filename) {
-        /// @WARNING: This is really important, ROS seems to set the system locale which takes decimal commata instead of points which causes the file input parsing to fail
-        // Do not use the system locale setlocale(LC_ALL, "C");
-        setlocale(LC_NUMERIC,"C");
-        setlocale(LC_ALL, "POSIX");
+        if (isFeatureStore(filename)) {
+            // Convert the memory-mapped features chunk-wise, dropping the already converted pages of the mapping
+            FeatureStoreMapping mapping;
+            if (!mapping.open(filename)) {
+                exit(EXIT_FAILURE);
+            }
+            const int sampleCount = (int) mapping.getCount();
+            const int dimension = (int) mapping.getDimension();
+            allocateProblem(sampleCount, dimension);
+            for (int firstSample = 0; firstSample < sampleCount; firstSample += FEATURESTORE_CHUNK_SAMPLES) {
+                const int chunkSamples = std::min(FEATURESTORE_CHUNK_SAMPLES, sampleCount - firstSample);
+                fillProblem(firstSample, chunkSamples, mapping.getLabels() + firstSample, mapping.getSample(firstSample), dimension);
+                mapping.releaseSamples(firstSample, chunkSamples);
+            }
+            return;
+        }
 //        cout.getloc().decimal_point ();
         int elements, max_index, inst_max_index, i, j;
         FILE *fp = fopen(filename, "r");
@@ -131,10 +274,12 @@ public:
             exit(1);
         }
 
+        freeProblem(); // Allows reading in a new problem, e.g. for retraining
         prob.l = 0;
         elements = 0;
 
         max_line_len = 1024;
+        free(line);
         line = Malloc(char, max_line_len);
         while (readline(fp) != NULL) {
             char *p = strtok(line, " \t"); // label
@@ -228,22 +373,28 @@ public:
      * @param _modelFileName file name to save the model to
      */
     void saveModelToFile(const std::string _modelFileName) {
-        if (svm_save_model(_modelFileName.c_str(), getInstance()->model)) {
+        if (svm_save_model(_modelFileName.c_str(), model)) {
             fprintf(stderr, "Error: Could not save model to file %s\n", _modelFileName.c_str());
             exit(EXIT_FAILURE);
         }
     }
 
+    /**
+     * libSVM's svm_train() cannot be started from a previous solution, training always starts from scratch
+     * @param _modelFileName unused
+     * @return false
+     */
+    bool setWarmStart(const std::string& _modelFileName) {
+        printf("Warning: libSVM does not support warm starts, training starts from scratch\n");
+        return false;
+    }
+
     /**
      * Function was unit tested, can be assumed libSVM model is correctly loaded from file
      * @param _modelFileName
      */
     void loadModelFromFile(const std::string _modelFileName) {
         this->freeMem();
-        /// @WARNING: This is really important, ROS seems to set the system locale which takes decimal commata instead of points which causes the file input parsing to fail
-        // Do not use the system locale setlocale(LC_ALL, "C");
-        setlocale(LC_NUMERIC,"C");
-        setlocale(LC_ALL, "POSIX");
         /// @TODO Test if this works as intended
         if (this->predictionDataStructsUsed && model != NULL) {
 //            svm_free_and_destroy_model(&model);
@@ -289,6 +440,7 @@ public:
      * After read in the training samples from a file, set parameters for training and call training procedure
      */
     void train() {
+        svm_free_and_destroy_model(&model); // Replace a previously trained model
         model = svm_train(&prob, &param);
         trainingDataStructsUsed = true;
     }
@@ -305,25 +457,52 @@ public:
         singleDetectorVector.clear();
         singleDetectorVectorIndices.clear();
         printf("Total number of support vectors: %d \n", model->l);
-        // Walk over every support vector and build a single vector
-        for (unsigned long ssv = 0; ssv < model->l; ++ssv) { // Walks over available classes (e.g. +1, -1 representing positive and negative training samples)
-            // Retrieve the current support vector from the training set
-            svm_node* singleSupportVector = model->SV[ssv]; // Get next support vector ssv==class, 2nd index is the component of the SV
-            // sv_coef[i] = alpha[i]*sign(label[i]) = alpha[i] * y[i], where i is the training instance, y[i] in [+1,-1]
-            double alpha = model->sv_coef[0][ssv];
-            int singleVectorComponent = 0;
-            while (singleSupportVector[singleVectorComponent].index != -1) { // index=-1 indicates the end of the array
-                if (ssv == 0) { // During first loop run determine the length of the support vectors and adjust the required vector size
-                    singleDetectorVector.push_back(singleSupportVector[singleVectorComponent].value * alpha);
-                    singleDetectorVectorIndices.push_back(singleSupportVector[singleVectorComponent].index); // Holds the indices for the corresponding values in singleDetectorVector, mapping from singleVectorComponent to singleSupportVector[singleVectorComponent].index!
-                } else {
-                    if (singleVectorComponent > singleDetectorVector.size()) { // Catch oversized vectors (maybe from differently sized images?)
-                        printf("Warning: Component %d out of range, should have the same size as other/first vector\n", singleVectorComponent);
-                    } else
-                        singleDetectorVector.at(singleVectorComponent) += (singleSupportVector[singleVectorComponent].value * alpha);
+        // Determine the vector length from the highest feature index of all support vectors
+        int dimension = 0;
+        for (int ssv = 0; ssv < model->l; ++ssv) {
+            for (const svm_node* node = model->SV[ssv]; node->index != -1; ++node) { // index=-1 indicates the end of the array
+                dimension = std::max(dimension, node->index);
+            }
+        }
+        std::vector<double> detectorVector(dimension, 0.0);
+#ifdef _OPENMP
+        #pragma omp parallel
+#endif
+        {
+            // Every thread sums up its share of the support vectors, the partial sums are added up at the end
+            std::vector<double> partialSum(dimension, 0.0);
+#ifdef _OPENMP
+            #pragma omp for schedule(dynamic, 64) nowait
+#endif
+            for (int ssv = 0; ssv < model->l; ++ssv) {
+                // sv_coef[i] = alpha[i]*sign(label[i]) = alpha[i] * y[i], where i is the training instance, y[i] in [+1,-1]
+                const double alpha = model->sv_coef[0][ssv];
+                const svm_node* singleSupportVector = model->SV[ssv];
+                // Dense part: the nodes are stored in index order without gaps, a plain strided loop the compiler can vectorize
+                int component = 0;
+                while (component < dimension && singleSupportVector[component].index == component + 1) {
+                    ++component;
+                }
+                for (int feature = 0; feature < component; ++feature) {
+                    partialSum[feature] += alpha * singleSupportVector[feature].value;
+                }
+                // Sparse remainder, walk up to the terminator
+                for (; singleSupportVector[component].index != -1; ++component) {
+                    partialSum[singleSupportVector[component].index - 1] += alpha * singleSupportVector[component].value;
                 }
-                singleVectorComponent++;
             }
+#ifdef _OPENMP
+            #pragma omp critical
+#endif
+            for (int feature = 0; feature < dimension; ++feature) {
+                detectorVector[feature] += partialSum[feature];
+            }
+        }
+        singleDetectorVector.assign(detectorVector.begin(), detectorVector.end());
+        // Holds the indices for the corresponding values in singleDetectorVector
+        singleDetectorVectorIndices.resize(dimension);
+        for (int feature = 0; feature < dimension; ++feature) {
+            singleDetectorVectorIndices[feature] = feature + 1;
         }
 
         // This is a threshold value which is also recorded in the lear code in lib/windetect.cpp at line 1297 as linearbias and in the original paper as constant epsilon, but no comment on how it is generated
@@ -332,6 +511,14 @@ public:
 //        singleDetectorVectorIndices->push_back(UINT_MAX); // Add maximum unsigned int as index indicating the end of the vector
     }
 
+    /**
+     * Sets the cost of constraint violation, e.g. as selected by cross-validation, must be called before train
+     * @param _C
+     */
+    void setC(double _C) {
+        param.C = _C;
+    }
+
     /**
      * Return model detection threshold / bias
      * @return detection threshold / bias
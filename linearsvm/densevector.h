@@ -0,0 +1,147 @@
+/**
+ * @file:   densevector.h
+ * @brief:  SIMD (SSE) kernels for dense float vectors as used by the dense linear SVM solver and for scoring stored features,
+ * with a plain loop fallback for other platforms
+ */
+
+#ifndef DENSEVECTOR_H
+#define	DENSEVECTOR_H
+
+#ifdef __SSE__
+#include <xmmintrin.h>
+#endif
+
+/**
+ * Dot product of two dense float vectors
+ * @param a
+ * @param b
+ * @param n number of components
+ * @return sum_i a[i]*b[i], partial sums are accumulated in four (SSE) lanes and added in double precision
+ */
+inline double denseDot(const float* a, const float* b, long n) {
+    long i = 0;
+    double result = 0.0;
+#ifdef __SSE__
+    __m128 sum0 = _mm_setzero_ps();
+    __m128 sum1 = _mm_setzero_ps();
+    for (; i + 8 <= n; i += 8) {
+        sum0 = _mm_add_ps(sum0, _mm_mul_ps(_mm_loadu_ps(a + i), _mm_loadu_ps(b + i)));
+        sum1 = _mm_add_ps(sum1, _mm_mul_ps(_mm_loadu_ps(a + i + 4), _mm_loadu_ps(b + i + 4)));
+    }
+    float lanes[4];
+    _mm_storeu_ps(lanes, _mm_add_ps(sum0, sum1));
+    result = (double) lanes[0] + lanes[1] + lanes[2] + lanes[3];
+#endif
+    for (; i < n; ++i) {
+        result += a[i] * b[i];
+    }
+    return result;
+}
+
+/**
+ * y += alpha * x for dense float vectors
+ * @param alpha
+ * @param x
+ * @param y
+ * @param n number of components
+ */
+inline void denseAxpy(float alpha, const float* x, float* y, long n) {
+    long i = 0;
+#ifdef __SSE__
+    const __m128 factor = _mm_set1_ps(alpha);
+    for (; i + 4 <= n; i += 4) {
+        _mm_storeu_ps(y + i, _mm_add_ps(_mm_loadu_ps(y + i), _mm_mul_ps(factor, _mm_loadu_ps(x + i))));
+    }
+#endif
+    for (; i < n; ++i) {
+        y[i] += alpha * x[i];
+    }
+}
+
+/**
+ * y = A*x + offset for a dense row-major float matrix (GEMV), rows are processed in parallel if OpenMP is enabled
+ * @param A matrix of rows x cols values
+ * @param rows
+ * @param cols
+ * @param x vector of cols values
+ * @param offset added to every result component
+ * @param y resulting vector of rows values
+ */
+inline void denseGemv(const float* A, long rows, long cols, const float* x, double offset, double* y) {
+#ifdef _OPENMP
+#pragma omp parallel for schedule(static)
+#endif
+    for (long row = 0; row < rows; ++row) {
+        y[row] = denseDot(A + row * cols, x, cols) + offset;
+    }
+}
+
+/**
+ * C = A*B^T + offsets for dense row-major float matrices (GEMM), e.g. scores of many feature vectors (rows of A) against several models (rows of B).
+ * Two rows of A are multiplied with two rows of B at once, so every loaded value is used twice and the rows of B
+ * are streamed once per pair of rows of A instead of once per row. Not parallelized, callers run it per thread.
+ * @param A matrix of rows x cols values
+ * @param rows
+ * @param B matrix of models x cols values
+ * @param models
+ * @param cols
+ * @param offsets added per model (column of C)
+ * @param C resulting row-major matrix of rows x models values
+ */
+inline void denseGemmTransposed(const float* A, long rows, const float* B, long models, long cols, const double* offsets, double* C) {
+    long row = 0;
+    for (; row + 2 <= rows; row += 2) {
+        const float* a0 = A + row * cols;
+        const float* a1 = a0 + cols;
+        long model = 0;
+        for (; model + 2 <= models; model += 2) {
+            const float* b0 = B + model * cols;
+            const float* b1 = b0 + cols;
+            long i = 0;
+            double c00 = 0.0, c01 = 0.0, c10 = 0.0, c11 = 0.0;
+#ifdef __SSE__
+            __m128 s00 = _mm_setzero_ps(), s01 = _mm_setzero_ps(), s10 = _mm_setzero_ps(), s11 = _mm_setzero_ps();
+            for (; i + 4 <= cols; i += 4) {
+                const __m128 x0 = _mm_loadu_ps(a0 + i);
+                const __m128 x1 = _mm_loadu_ps(a1 + i);
+                const __m128 w0 = _mm_loadu_ps(b0 + i);
+                const __m128 w1 = _mm_loadu_ps(b1 + i);
+                s00 = _mm_add_ps(s00, _mm_mul_ps(x0, w0));
+                s01 = _mm_add_ps(s01, _mm_mul_ps(x0, w1));
+                s10 = _mm_add_ps(s10, _mm_mul_ps(x1, w0));
+                s11 = _mm_add_ps(s11, _mm_mul_ps(x1, w1));
+            }
+            float lanes[4];
+            _mm_storeu_ps(lanes, s00);
+            c00 = (double) lanes[0] + lanes[1] + lanes[2] + lanes[3];
+            _mm_storeu_ps(lanes, s01);
+            c01 = (double) lanes[0] + lanes[1] + lanes[2] + lanes[3];
+            _mm_storeu_ps(lanes, s10);
+            c10 = (double) lanes[0] + lanes[1] + lanes[2] + lanes[3];
+            _mm_storeu_ps(lanes, s11);
+            c11 = (double) lanes[0] + lanes[1] + lanes[2] + lanes[3];
+#endif
+            for (; i < cols; ++i) {
+                c00 += a0[i] * b0[i];
+                c01 += a0[i] * b1[i];
+                c10 += a1[i] * b0[i];
+                c11 += a1[i] * b1[i];
+            }
+            C[row * models + model] = c00 + offsets[model];
+            C[row * models + model + 1] = c01 + offsets[model + 1];
+            C[(row + 1) * models + model] = c10 + offsets[model];
+            C[(row + 1) * models + model + 1] = c11 + offsets[model + 1];
+        }
+        for (; model < models; ++model) {
+            C[row * models + model] = denseDot(a0, B + model * cols, cols) + offsets[model];
+            C[(row + 1) * models + model] = denseDot(a1, B + model * cols, cols) + offsets[model];
+        }
+    }
+    for (; row < rows; ++row) {
+        for (long model = 0; model < models; ++model) {
+            C[row * models + model] = denseDot(A + row * cols, B + model * cols, cols) + offsets[model];
+        }
+    }
+}
+
+#endif	/* DENSEVECTOR_H */
@@ -0,0 +1,396 @@
+/**
+ * @file:   linearsvm.h
+ * @brief:  Dense linear SVM solver for HOG feature vectors, using dual coordinate descent
+ * @see C.-J. Hsieh, K.-W. Chang, C.-J. Lin, S. S. Keerthi, S. Sundararajan: A Dual Coordinate Descent Method for Large-scale Linear SVM (ICML 2008),
+ * as implemented in LIBLINEAR, @see http://www.csie.ntu.edu.tw/~cjlin/liblinear/
+ *
+ * HOG feature vectors are completely dense, so instead of sparse index/value lists the samples are kept as contiguous float matrix
+ * and the solver works directly on the weight vector w, which is the resulting single detecting vector.
+ * The bias is learned as weight of an additional constant feature, decision function is f(x) = w*x + b.
+ * Besides the instance used by main (getInstance), independent instances can be created, e.g. one per cross-validation job,
+ * training concurrently on subsets of one shared read-only feature matrix.
+ */
+
+#ifndef LINEARSVM_H
+#define	LINEARSVM_H
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <math.h>
+#include <stdint.h>
+#include <string>
+#include <vector>
+#include <algorithm>
+#include "densevector.h"
+#include "../featurestore/featurestore.h"
+
+struct LinearSVMParameter {
+    // Loss function, L1 is the standard hinge loss (as SVMlight and libSVM), L2 the squared hinge loss
+    enum LossType { L1LOSS = 1, L2LOSS = 2 };
+    double C; // Cost of constraint violation
+    double eps; // Stopping criterion on the projected gradient
+    int maxIterations; // Maximum number of outer iterations (passes over the active samples)
+    LossType lossType;
+    double biasFeature; // Value of the constant feature used to learn the bias, <= 0 to train without bias
+    bool verbose; // Print the training progress
+};
+
+class LinearSVM {
+private:
+    // Training data, either owned by this object or pointing into the memory-mapped feature store
+    std::vector<float> ownedLabels;
+    std::vector<float> ownedFeatures;
+    FeatureStoreMapping mapping;
+    const float* labels;
+    const float* features;
+    long sampleCount;
+    long dimension;
+    std::vector<long> subset; // Rows of the training data to train on, empty for all
+
+    // Model
+    std::vector<float> weights; // w
+    double bias; // b
+    std::vector<double> alpha; // Dual variables of the last training
+    std::vector<double> warmStartAlphas; // alpha_i*y_i per training example to start the next training from, empty for a cold start
+
+    /**
+     * Deterministic pseudo random number generator (xorshift) for the sample order, so that training is reproducible
+     */
+    static uint32_t nextRandom(uint32_t& state) {
+        state ^= state << 13;
+        state ^= state >> 17;
+        state ^= state << 5;
+        return state;
+    }
+
+    /**
+     * @param i index of a training example
+     * @return its feature vector
+     */
+    const float* sample(long i) const {
+        return features + (subset.empty() ? i : subset[i]) * dimension;
+    }
+
+    double label(long i) const {
+        return (labels[subset.empty() ? i : subset[i]] > 0) ? 1.0 : -1.0;
+    }
+
+public:
+    LinearSVMParameter param;
+
+    LinearSVM() {
+        // The HOG paper uses a soft classifier (C = 0.01)
+        param.C = 0.01;
+        param.eps = 0.1;
+        param.maxIterations = 1000;
+        param.lossType = LinearSVMParameter::L1LOSS;
+        param.biasFeature = 1.0;
+        param.verbose = true;
+        labels = NULL;
+        features = NULL;
+        sampleCount = 0;
+        dimension = 0;
+        bias = 0.0;
+    }
+
+    virtual ~LinearSVM() {
+    }
+
+    static LinearSVM* getInstance();
+
+    const char* getSVMName() const {
+        return "LinearSVM";
+    }
+
+    /**
+     * Sets the training data directly from memory, the data is copied
+     * @param _labels one label (+1 / -1) per sample
+     * @param _features row-major feature matrix, _labels.size() x dimension values
+     */
+    void read_problem(const std::vector<float>& _labels, const std::vector<float>& _features) {
+        mapping.close();
+        subset.clear();
+        ownedLabels = _labels;
+        ownedFeatures = _features;
+        sampleCount = ownedLabels.size();
+        dimension = (sampleCount > 0) ? (ownedFeatures.size() / sampleCount) : 0;
+        labels = (sampleCount > 0) ? &ownedLabels[0] : NULL;
+        features = (sampleCount > 0) ? &ownedFeatures[0] : NULL;
+    }
+
+    /**
+     * Maps a binary feature store as training data
+     * @param filename
+     */
+    void read_problem(char* filename) {
+        std::vector<float>().swap(ownedLabels);
+        std::vector<float>().swap(ownedFeatures);
+        subset.clear();
+        if (!mapping.open(filename)) {
+            fprintf(stderr, "%s only supports binary feature stores as input file\n", getSVMName());
+            exit(EXIT_FAILURE);
+        }
+        sampleCount = mapping.getCount();
+        dimension = mapping.getDimension();
+        labels = mapping.getLabels();
+        features = mapping.getSample(0);
+    }
+
+    /**
+     * Uses training data owned by the caller, which is not copied and has to stay valid until the training is done.
+     * Several instances may share the same data, it is only read
+     * @param _labels one label (+1 / -1) per sample
+     * @param _features row-major feature matrix, _sampleCount x _dimension values
+     * @param _sampleCount
+     * @param _dimension
+     */
+    void setSharedProblem(const float* _labels, const float* _features, long _sampleCount, long _dimension) {
+        mapping.close();
+        std::vector<float>().swap(ownedLabels);
+        std::vector<float>().swap(ownedFeatures);
+        subset.clear();
+        labels = _labels;
+        features = _features;
+        sampleCount = _sampleCount;
+        dimension = _dimension;
+    }
+
+    /**
+     * Restricts the training to some rows of the training data, e.g. the training folds of a cross-validation
+     * @param _rows row indices, empty to train on all samples
+     */
+    void setSampleSubset(const std::vector<long>& _rows) {
+        subset = _rows;
+    }
+
+    /**
+     * Solves the dual problem min_a 0.5*a^T*Q*a - e^T*a, 0 <= a_i <= U by coordinate descent with shrinking,
+     * updating w = sum_i a_i*y_i*x_i alongside
+     */
+    void train() {
+        const double B = std::max(param.biasFeature, 0.0);
+        // L1 loss: upper bound C, L2 loss: unbounded with diagonal term 1/(2C)
+        const double upperBound = (param.lossType == LinearSVMParameter::L1LOSS) ? param.C : HUGE_VAL;
+        const double diagonal = (param.lossType == LinearSVMParameter::L1LOSS) ? 0.0 : 0.5 / param.C;
+
+        const long n = subset.empty() ? sampleCount : (long) subset.size(); // Number of training examples
+        weights.assign(dimension, 0.0f);
+        double biasWeight = 0.0;
+        alpha.assign(n, 0.0);
+        if (!warmStartAlphas.empty()) {
+            // Start from the previous solution, w = sum_i a_i*y_i*x_i has to match the start values
+            const long previous = std::min((long) warmStartAlphas.size(), n);
+            for (long i = 0; i < previous; ++i) {
+                const double y = label(i);
+                alpha[i] = std::min(std::max(warmStartAlphas[i] * y, 0.0), upperBound);
+                if (alpha[i] != 0.0) {
+                    denseAxpy((float) (alpha[i] * y), sample(i), &weights[0], dimension);
+                    biasWeight += alpha[i] * y * B;
+                }
+            }
+            if (param.verbose) {
+                printf("Warm start from %ld previous alphas\n", previous);
+            }
+            warmStartAlphas.clear();
+        }
+        std::vector<double> QD(n);
+        std::vector<long> index(n);
+        for (long i = 0; i < n; ++i) {
+            const float* x = sample(i);
+            QD[i] = diagonal + denseDot(x, x, dimension) + B * B;
+            index[i] = i;
+        }
+
+        if (param.verbose) {
+            printf("Training dense linear SVM on %ld samples of dimension %ld\n", n, dimension);
+        }
+        uint32_t randomState = 2463534242u;
+        long activeSize = n;
+        double PGmaxOld = HUGE_VAL;
+        double PGminOld = -HUGE_VAL;
+        int iteration = 0;
+        while (iteration < param.maxIterations) {
+            double PGmaxNew = -HUGE_VAL;
+            double PGminNew = HUGE_VAL;
+            // Random permutation of the active samples
+            for (long s = 0; s < activeSize; ++s) {
+                std::swap(index[s], index[s + nextRandom(randomState) % (activeSize - s)]);
+            }
+            for (long s = 0; s < activeSize; ++s) {
+                const long i = index[s];
+                const float* x = sample(i);
+                const double y = label(i);
+                const double G = y * (denseDot(&weights[0], x, dimension) + biasWeight * B) - 1.0 + diagonal * alpha[i];
+                double PG = 0.0;
+                if (alpha[i] == 0.0) {
+                    if (G > PGmaxOld) { // Shrink: variable is likely to stay at the lower bound
+                        --activeSize;
+                        std::swap(index[s], index[activeSize]);
+                        --s;
+                        continue;
+                    } else if (G < 0.0) {
+                        PG = G;
+                    }
+                } else if (alpha[i] == upperBound) {
+                    if (G < PGminOld) { // Shrink: variable is likely to stay at the upper bound
+                        --activeSize;
+                        std::swap(index[s], index[activeSize]);
+                        --s;
+                        continue;
+                    } else if (G > 0.0) {
+                        PG = G;
+                    }
+                } else {
+                    PG = G;
+                }
+                PGmaxNew = std::max(PGmaxNew, PG);
+                PGminNew = std::min(PGminNew, PG);
+                if (fabs(PG) > 1.0e-12) {
+                    const double alphaOld = alpha[i];
+                    alpha[i] = std::min(std::max(alpha[i] - G / QD[i], 0.0), upperBound);
+                    const double delta = (alpha[i] - alphaOld) * y;
+                    denseAxpy((float) delta, x, &weights[0], dimension);
+                    biasWeight += delta * B;
+                }
+            }
+            ++iteration;
+            if (param.verbose && iteration % 100 == 0) {
+                printf("Iteration %d: %ld active samples, projected gradient range %3.5f\n", iteration, activeSize, PGmaxNew - PGminNew);
+            }
+            if (PGmaxNew - PGminNew <= param.eps) {
+                if (activeSize == n) {
+                    break;
+                }
+                // Check convergence on all samples once more before stopping
+                activeSize = n;
+                PGmaxOld = HUGE_VAL;
+                PGminOld = -HUGE_VAL;
+                continue;
+            }
+            PGmaxOld = (PGmaxNew <= 0.0) ? HUGE_VAL : PGmaxNew;
+            PGminOld = (PGminNew >= 0.0) ? -HUGE_VAL : PGminNew;
+        }
+        if (param.verbose && iteration >= param.maxIterations) {
+            printf("Warning: Reached maximum number of iterations (%d)\n", param.maxIterations);
+        }
+        bias = biasWeight * B;
+
+        long supportVectors = 0;
+        for (long i = 0; i < n; ++i) {
+            if (alpha[i] > 0.0) {
+                ++supportVectors;
+            }
+        }
+        if (param.verbose) {
+            printf("Optimization finished after %d iterations, %ld support vectors, bias b %3.5f\n", iteration, supportVectors, bias);
+        }
+    }
+
+    /**
+     * Saves w and b as text file, first line holds dimension and bias, second line the weights.
+     * If the model was trained in this run, alpha_i*y_i of every training example is saved to <_modelFileName>.alphas for setWarmStart
+     * @param _modelFileName file name to save the model to
+     */
+    void saveModelToFile(const std::string _modelFileName) {
+        FILE* fp = fopen(_modelFileName.c_str(), "w");
+        if (fp == NULL) {
+            fprintf(stderr, "Error: Could not save model to file %s\n", _modelFileName.c_str());
+            exit(EXIT_FAILURE);
+        }
+        fprintf(fp, "%s %ld %.9g\n", getSVMName(), (long) weights.size(), bias);
+        for (size_t feature = 0; feature < weights.size(); ++feature) {
+            fprintf(fp, "%.9g ", weights[feature]);
+        }
+        fprintf(fp, "\n");
+        fclose(fp);
+
+        if (alpha.empty()) {
+            return;
+        }
+        const std::string alphasFileName = _modelFileName + ".alphas";
+        fp = fopen(alphasFileName.c_str(), "w");
+        if (fp == NULL) {
+            printf("Warning: Could not save alphas to file '%s'\n", alphasFileName.c_str());
+            return;
+        }
+        for (long i = 0; i < (long) alpha.size(); ++i) {
+            fprintf(fp, "%.18g\n", label(i) * alpha[i]);
+        }
+        fclose(fp);
+    }
+
+    /**
+     * Starts the next training from the solution saved with the given model (<_modelFileName>.alphas) instead of from scratch,
+     * e.g. when retraining after adding hard negatives. Training examples are matched by their order,
+     * examples appended since have no previous solution and start at 0
+     * @param _modelFileName model file previously saved with saveModelToFile
+     * @return true if the previous solution could be read
+     */
+    bool setWarmStart(const std::string& _modelFileName) {
+        const std::string alphasFileName = _modelFileName + ".alphas";
+        warmStartAlphas.clear();
+        FILE* fp = fopen(alphasFileName.c_str(), "r");
+        if (fp == NULL) {
+            printf("Warning: No previous solution '%s' found, training starts from scratch\n", alphasFileName.c_str());
+            return false;
+        }
+        double value;
+        while (fscanf(fp, "%lf", &value) == 1) {
+            warmStartAlphas.push_back(value);
+        }
+        fclose(fp);
+        return true;
+    }
+
+    void loadModelFromFile(const std::string _modelFileName) {
+        FILE* fp = fopen(_modelFileName.c_str(), "r");
+        char name[64];
+        long modelDimension = 0;
+        if (fp == NULL || fscanf(fp, "%63s %ld %lf", name, &modelDimension, &bias) != 3 || modelDimension < 0) {
+            fprintf(stderr, "Error: Could not load model from file %s\n", _modelFileName.c_str());
+            exit(EXIT_FAILURE);
+        }
+        weights.resize(modelDimension);
+        for (long feature = 0; feature < modelDimension; ++feature) {
+            if (fscanf(fp, "%f", &weights[feature]) != 1) {
+                fprintf(stderr, "Error: Model file %s is truncated\n", _modelFileName.c_str());
+                exit(EXIT_FAILURE);
+            }
+        }
+        fclose(fp);
+    }
+
+    /**
+     * Returns the trained weight vector w, which already is the single detecting vector
+     * @param singleDetectorVector resulting single detector vector for use in openCV HOG
+     * @param singleDetectorVectorIndices dummy vector for this implementation
+     */
+    void getSingleDetectingVector(std::vector<float>& singleDetectorVector, std::vector<unsigned int>& singleDetectorVectorIndices) {
+        singleDetectorVector = weights;
+    }
+
+    /**
+     * Sets the cost of constraint violation, e.g. as selected by cross-validation, must be called before train
+     * @param _C
+     */
+    void setC(double _C) {
+        param.C = _C;
+    }
+
+    /**
+     * Return model detection threshold, openCV HOG detects if w*x >= threshold, which is w*x + b >= 0
+     * @return detection threshold -b
+     */
+    double getThreshold() const {
+        return -bias;
+    }
+
+};
+
+/// Singleton
+LinearSVM* LinearSVM::getInstance() {
+    static LinearSVM theInstance;
+    return &theInstance;
+}
+
+#endif	/* LINEARSVM_H */
@@ -22,25 +22,27 @@
  *  
  * For the paper regarding Histograms of Oriented Gradients (HOG), @see http://lear.inrialpes.fr/pubs/2005/DT05/
  * You can populate the positive samples dir with files from the INRIA person detection dataset, @see http://pascal.inrialpes.fr/data/human/
- * This program uses SVMlight as machine learning algorithm (@see http://svmlight.joachims.org/), but is not restricted to it
+ * This program uses SVMlight as machine learning algorithm (@see http://svmlight.joachims.org/), but is not restricted to it,
+ * libSVM, a dense linear SVM solver (linearsvm/linearsvm.h) and a streaming SGD solver for training sets larger than main memory (sgdsvm/sgdsvm.h)
+ * can be selected via TRAINHOG_USEDSVM
  * Tested in Ubuntu Linux 64bit 12.04 "Precise Pangolin" with openCV 2.3.1, SVMlight 6.02, g++ 4.6.3
  * and standard HOG settings, training images of size 64x128px.
  * 
  * What this program basically does:
  * 1. Read positive and negative training sample image files from specified directories
- * 2. Calculate their HOG features and keep track of their classes (pos, neg)
- * 3. Save the feature map (vector of vectors/matrix) to file system
+ * 2. Calculate their HOG features (or take them from the feature cache, @see featurestore/featurecache.h) and keep track of their classes (pos, neg)
+ * 3. Save the feature map (vector of vectors/matrix) to file system (binary feature store, @see featurestore/featurestore.h)
  * 4. Read in and pass the features and their classes to a machine learning algorithm, e.g. SVMlight
  * 5. Train the machine learning algorithm using the specified parameters
  * 6. Use the calculated support vectors and SVM model to calculate a single detecting descriptor vector
  * 7. Dry-run the newly trained custom HOG descriptor against training set and against camera images, if available
  * 
  * Build by issuing:
- * g++ `pkg-config --cflags opencv` -c -g -MMD -MP -MF main.o.d -o main.o main.cpp
+ * g++ `pkg-config --cflags opencv` -fopenmp -c -g -MMD -MP -MF main.o.d -o main.o main.cpp
  * gcc -c -g `pkg-config --cflags opencv` -MMD -MP -MF svmlight/svm_learn.o.d -o svmlight/svm_learn.o svmlight/svm_learn.c
  * gcc -c -g `pkg-config --cflags opencv` -MMD -MP -MF svmlight/svm_hideo.o.d -o svmlight/svm_hideo.o svmlight/svm_hideo.c
  * gcc -c -g `pkg-config --cflags opencv` -MMD -MP -MF svmlight/svm_common.o.d -o svmlight/svm_common.o svmlight/svm_common.c
- * g++ `pkg-config --cflags opencv` -o trainhog main.o svmlight/svm_learn.o svmlight/svm_hideo.o svmlight/svm_common.o `pkg-config --libs opencv`
+ * g++ `pkg-config --cflags opencv` -o trainhog main.o svmlight/svm_learn.o svmlight/svm_hideo.o svmlight/svm_common.o `pkg-config --libs opencv` -fopenmp
  * 
  * Warning:
  * Be aware that the program may consume a considerable amount of main memory, hard disk memory and time, dependent on the amount of training samples.
@@ -56,22 +58,41 @@
 /* Parameter and macro definitions */
 
 #include <stdio.h>
+#include <locale.h>
 #include <dirent.h>
-#ifdef __MINGW32__
 #include <sys/stat.h>
-#endif
-#include <ios>
-#include <fstream>
 #include <stdexcept>
+#include <set>
+#include <numeric>
+#include <map>
+#include <pthread.h>
 #include <opencv2/opencv.hpp>
 #include <opencv2/highgui/highgui.hpp>
 #include <opencv2/ml/ml.hpp>
+#include "featurestore/featurestore.h"
+#include "featurestore/featurecache.h"
+#include "featurestore/svmlightwriter.h"
+#include "pipeline/boundedqueue.h"
+#include "dataset/filelist.h"
+#include "linearsvm/densevector.h"
+#include "linearsvm/linearsvm.h" // Solver of the cross-validation, with the objective of the configured LinearSVM or SgdSVM backend
+#include "evaluation/evaluation.h"
+#include "detection/nms.h"
+#include "detection/detectionengine.h"
+#include "detection/quantizeddetector.h"
+#include "augmentation/windowbatch.h"
+#include "acceleration/openclhog.h"
+#include "metrics/runmetrics.h"
 
 #define SVMLIGHT 1
 #define LIBSVM 2
+#define LINEARSVM 3
+#define SGDSVM 4
 
 //#define TRAINHOG_USEDSVM SVMLIGHT
+#ifndef TRAINHOG_USEDSVM
 #define TRAINHOG_USEDSVM SVMLIGHT
+#endif
 
 #if TRAINHOG_USEDSVM == SVMLIGHT
     #include "svmlight/svmlight.h"
@@ -79,341 +100,2515 @@
 #elif TRAINHOG_USEDSVM == LIBSVM
     #include "libsvm/libsvm.h"
     #define TRAINHOG_SVM_TO_TRAIN libSVM
+#elif TRAINHOG_USEDSVM == LINEARSVM
+    #define TRAINHOG_SVM_TO_TRAIN LinearSVM
+#elif TRAINHOG_USEDSVM == SGDSVM
+    #include "sgdsvm/sgdsvm.h"
+    #define TRAINHOG_SVM_TO_TRAIN SgdSVM
 #endif
 
 using namespace std;
 using namespace cv;
 
 
-// Directory containing positive sample images
-static string posSamplesDir = "pos/";
-// Directory containing negative sample images
-static string negSamplesDir = "neg/";
-// Set the file to write the features to
-static string featuresFile = "genfiles/features.dat";
-// Set the file to write the SVM model to
-static string svmModelFile = "genfiles/svmlightmodel.dat";
-// Set the file to write the resulting detecting descriptor vector to
-static string descriptorVectorFile = "genfiles/descriptorvector.dat";
-// Set the file to write the resulting opencv hog classifier as YAML file
-static string cvHOGFile = "genfiles/cvHOGClassifier.yaml";
+// Directory containing positive sample images
+static string posSamplesDir = "pos/";
+// Directory containing negative sample images
+static string negSamplesDir = "neg/";
+// Also collect the sample images in all subdirectories, e.g. of datasets sharded into subdirectories
+static bool recursiveDirectoryScan = false;
+// Number of threads listing subdirectories in parallel during a recursive scan, 0 uses all available cores
+static int directoryScanThreads = 0;
+// Print every found and skipped file during directory scans, otherwise only a summary per directory
+static bool verboseDirectoryScan = false;
+// Manifest listing the training samples as "<path> <label>" lines (@see dataset/filelist.h) instead of scanning posSamplesDir and negSamplesDir, empty to scan
+static string trainingManifestFile = "";
+// Set the file to write the features to (binary feature store)
+static string featuresFile = "genfiles/features.dat";
+// Keep the calculated features in memory and pass them directly to the machine learning algorithm instead of reading back the features file
+static bool trainFromMemory = true;
+// Save the features file even when training from memory, e.g. as cache for later runs
+static bool cacheFeaturesToFile = true;
+/* Place the SVM training structures in a temporary file in this directory instead of the heap (empty to disable),
+ * together with trainFromMemory = false this allows training sets larger than main memory,
+ * LinearSVM and SgdSVM always read the memory-mapped features file in place and ignore this setting
+ */
+static string fileBackedTrainingDir = "";
+// Additionally export the features in SVMlight text format, e.g. for use with the external svm_learn
+static bool exportTextFeatures = false;
+// Set the file to export the features in SVMlight text format to, compressed if ending with .gz (TRAINHOG_USE_ZLIB) or .zst (TRAINHOG_USE_ZSTD)
+static string featuresTextFile = "genfiles/features.txt";
+// Set the file to write the SVM model to
+static string svmModelFile = "genfiles/svmlightmodel.dat";
+// Set the file to write the resulting detecting descriptor vector to
+static string descriptorVectorFile = "genfiles/descriptorvector.dat";
+// Set the file to write the resulting opencv hog classifier as YAML file
+static string cvHOGFile = "genfiles/cvHOGClassifier.yaml";
+
+// HOG parameters for training that for some reason are not included in the HOG class
+static const Size trainingPadding = Size(0, 0);
+static const Size winStride = Size(8, 8);
+
+// Number of hard negative mining rounds (scan, add false positives, retrain) after the initial training, 0 disables mining
+static int hardNegativeMiningRounds = 0;
+// Directory containing full-size negative images (without any persons), scanned for false positives during hard negative mining
+static string fullNegativeImagesDir = "negfull/";
+// Maximum number of hard negatives taken per image and round (highest scoring windows first), 0 for no limit
+static unsigned int maxHardNegativesPerImage = 10;
+/* Start each hard negative mining retraining from the previous solution (saved next to the model file) instead of from scratch.
+ * Only LinearSVM and SgdSVM support warm starts: libSVM has none and SVMlight only for classification, not for the regression it trains
+ */
+static bool warmStartRetraining = (TRAINHOG_USEDSVM == LINEARSVM || TRAINHOG_USEDSVM == SGDSVM);
+
+/* Number of folds of a cross-validated grid search of the SVM cost parameter C before the training, the best C is used for training.
+ * The features are loaded once and shared by all models, the models of all folds and costs are trained in parallel
+ * with the objective and parameters of the configured backend, 0 to train with the default C.
+ * Only supported with the LinearSVM and SgdSVM backends, with SVMlight / libSVM the configured C is kept
+ */
+static int gridSearchFolds = 0;
+// Candidate values of C in ascending order, on equal validation errors the smaller C is preferred
+static const double gridSearchCosts[] = {0.0001, 0.001, 0.01, 0.1, 1.0};
+// Seed of the assignment of the samples to the folds
+static const uint64_t gridSearchSeed = 0x5eed;
+
+/* Concurrently trains one additional detector per value of C in detectorVariantCosts with the SVM backend in use, on the same training set
+ * (before hard negative mining), e.g. to compare soft and hard detectors side by side. Every detector is an independent SVM instance reading
+ * the loaded features, which are shared. Model and descriptor vector are saved like the ones of the main detector, with the suffix _c<C>
+ * before the file extension (e.g. genfiles/descriptorvector_c0.1.dat). SVMlight instances are safe to run concurrently, but train one after another
+ */
+static bool trainDetectorVariants = false;
+static const double detectorVariantCosts[] = {0.001, 0.1};
+
+/* Number of negative windows sampled from each full-size negative image in fullNegativeImagesDir as additional training negatives,
+ * each image is decoded once and all its windows are calculated from one gradient calculation per pyramid level, 0 disables the sampling
+ */
+static unsigned int negativeWindowsPerImage = 0;
+// Take the negative windows from a regular grid (negativeWindowStride) of every pyramid level instead of randomly, evenly thinned out to negativeWindowsPerImage
+static bool denseNegativeWindows = false;
+static const Size negativeWindowStride = Size(32, 64);
+// Scale factor between the pyramid levels the negative windows are sampled from
+static const double negativeWindowScaleStep = 1.2;
+// Seed of the random negative windows, combined with the image index so that the windows do not depend on the thread scheduling
+static const uint64_t negativeWindowSeed = 0x5eed;
+
+// Additionally train with the horizontally mirrored positive samples
+static bool mirrorPositiveSamples = false;
+// Number of randomly shifted copies of every positive sample (and of its mirrored version), 0 disables the shifted copies
+static unsigned int shiftedPositiveCopies = 0;
+// Maximum shift of the copies in pixels in each direction, windows extending beyond the image are padded
+static const int maxPositiveShift = 4;
+// Seed of the random shifts, combined with the sample index
+static const uint64_t positiveShiftSeed = 0x5eed;
+
+// Directory of the persistent per-sample feature cache, features are only calculated for new or changed images, empty disables the cache
+static string featureCacheDir = "genfiles/featurecache/";
+// Identify cached samples by a hash of the file content instead of by path, modification time and size (slower, but survives renaming and copying)
+static bool featureCacheContentHash = false;
+
+// Score all samples of the features file with the trained detector (w*x + b) and write a score histogram and the ROC curve over all thresholds
+static bool evaluateStoredFeatures = true;
+static string scoreHistogramFile = "genfiles/scorehistogram.csv";
+static string rocCurveFile = "genfiles/roc.csv";
+static const int scoreHistogramBins = 50;
+
+// Additionally export the detector quantized for embedded inference: 16 (float16) or 8 (int8 with one scale per HOG block), 0 disables the export
+static int quantizedDetectorBits = 0;
+static string quantizedDetectorFile = "genfiles/descriptorvector.qdet";
+
+// Sweep the detection threshold on a validation set and write the DET curve (miss rate vs. false positives per image)
+static bool thresholdSweep = false;
+// Validation images, each showing one person (e.g. padded crops), and full-size validation images without any persons
+static string validationPosDir = "validation/pos/";
+static string validationNegDir = "validation/neg/";
+static string detCurveFile = "genfiles/det.csv";
+// Lowest window score relative to the detector threshold that is collected for the sweep
+static const double sweepMinScore = -1.0;
+
+// Detection windows overlapping a higher scoring detection by more than this (intersection over union) are suppressed
+static const double nmsOverlapThreshold = 0.5;
+// Accelerate the non-maximum suppression with a spatial grid, pays off for many detections per image
+static bool nmsSpatialGrid = true;
+
+// Number of threads detecting on camera frames in parallel, 0 uses all available cores
+static int liveDetectionThreads = 0;
+// Maximum number of captured frames waiting for detection, older frames are dropped when detection falls behind
+static const unsigned long liveFrameQueueSize = 2;
+
+// Write timing and counters of all stages of the training run (and the peak memory usage) as JSON report, empty disables the report
+static string metricsFile = "genfiles/metrics.json";
+
+// Output of the batch detection mode (--detect), one JSON object per image or video frame
+static string batchDetectionsFile = "genfiles/detections.jsonl";
+
+// Number of worker threads used for feature extraction, 0 uses all available cores
+static int extractionThreads = 0;
+// Number of threads reading the sample image files ahead of the feature calculation, more threads hide more latency of network file systems
+static int prefetchThreads = 2;
+// Maximum number of samples in the feature extraction pipeline (read, decoded or calculated, but not yet written), bounds the memory used
+static const unsigned long extractionPipelineDepth = 256;
+// Number of full-size negative images scanned in parallel before their hard negatives are written to the features file in order
+static const unsigned long extractionBatchSize = 1024;
+
+/* Calculate the HOG features with the OpenCL kernels of openCV (OpenCV 3.0 or newer, or OpenCV 2.4.8 or newer with the ocl module, and an OpenCL device, see acceleration/openclhog.h)
+ * for the window-sized training samples, the training set test and the live and batch detection (--detect --opencl), selected at runtime.
+ * The results are compared with the CPU path on a test image first, the CPU path is used if they differ by more than openCLTolerance
+ */
+static bool useOpenCL = false;
+static const double openCLTolerance = 1e-3;
+// Maximum number of window-sized samples uploaded and calculated together
+static const unsigned long openCLBatchSize = 64;
+// </editor-fold>
+
+// <editor-fold defaultstate="collapsed" desc="Helper functions">
+/* Helper functions */
+
+static string toLowerCase(const string& in) {
+    string t(in); // Converted in place, a single allocation
+    for (string::iterator i = t.begin(); i != t.end(); ++i) {
+        *i = tolower(*i);
+    }
+    return t;
+}
+
+/**
+ * @return number of feature vectors calculated per positive sample (the sample itself and its augmented variants)
+ */
+static unsigned int getPositiveVariantCount() {
+    return (1 + shiftedPositiveCopies) * (mirrorPositiveSamples ? 2 : 1);
+}
+
+/**
+ * Augmented variants of a positive sample: the centered window, its shifted copies and the mirrored versions of both
+ * @param sampleIndex seeds the random shifts, so that the variants do not depend on the thread scheduling
+ * @param variants resulting variants, the unchanged sample first
+ */
+static void getPositiveVariants(unsigned long sampleIndex, vector<WindowVariant>& variants) {
+    variants.clear();
+    RNG rng(positiveShiftSeed + sampleIndex);
+    for (unsigned int copy = 0; copy <= shiftedPositiveCopies; ++copy) {
+        const Point shift = (copy == 0) ? Point(0, 0) : Point(rng.uniform(-maxPositiveShift, maxPositiveShift + 1), rng.uniform(-maxPositiveShift, maxPositiveShift + 1));
+        variants.push_back(WindowVariant(shift, false));
+        if (mirrorPositiveSamples) {
+            variants.push_back(WindowVariant(shift, true));
+        }
+    }
+}
+
+static void storeCursor(void) {
+    printf("\033[s");
+}
+
+static void resetCursor(void) {
+    printf("\033[u");
+}
+
+/**
+ * Saves the given descriptor vector to a file
+ * @param descriptorVector the descriptor vector to save
+ * @param _vectorIndices contains indices for the corresponding vector values (e.g. descriptorVector(0)=3.5f may have index 1)
+ * @param fileName
+ * @TODO Use _vectorIndices to write correct indices
+ */
+static void saveDescriptorVectorToFile(vector<float>& descriptorVector, vector<unsigned int>& _vectorIndices, string fileName) {
+    printf("Saving %lu descriptor vector features to file '%s'\n", (unsigned long) descriptorVector.size(), fileName.c_str());
+    SvmLightWriter writer;
+    if (writer.open(fileName)) {
+        writer.writeValues(&descriptorVector[0], descriptorVector.size());
+        writer.close();
+    }
+}
+
+/**
+ * Collects the HOG parameters to store alongside the calculated features
+ * @param hog HOGDescriptor containing the HOG settings used for feature calculation
+ * @return HOG parameters in feature store format
+ */
+static FeatureStoreHogParams getFeatureStoreHogParams(const HOGDescriptor& hog) {
+    FeatureStoreHogParams hogParams;
+    memset(&hogParams, 0, sizeof (hogParams));
+    hogParams.winWidth = hog.winSize.width;
+    hogParams.winHeight = hog.winSize.height;
+    hogParams.blockWidth = hog.blockSize.width;
+    hogParams.blockHeight = hog.blockSize.height;
+    hogParams.blockStrideWidth = hog.blockStride.width;
+    hogParams.blockStrideHeight = hog.blockStride.height;
+    hogParams.cellWidth = hog.cellSize.width;
+    hogParams.cellHeight = hog.cellSize.height;
+    hogParams.nbins = hog.nbins;
+    hogParams.derivAperture = hog.derivAperture;
+    hogParams.histogramNormType = hog.histogramNormType;
+    hogParams.gammaCorrection = hog.gammaCorrection;
+    hogParams.nlevels = hog.nlevels;
+    hogParams.winSigma = hog.winSigma;
+    hogParams.L2HysThreshold = hog.L2HysThreshold;
+    return hogParams;
+}
+
+/**
+ * For unixoid systems only: Lists all files in a given directory (and its subdirectories if recursiveDirectoryScan is set)
+ * and returns a sorted vector of path+name in string format
+ * @param dirName
+ * @param fileNames found file names in specified directory are appended (vector<string> or FileNameList)
+ * @param validExtensions containing the valid file extensions for collection in lower case
+ */
+template <typename FileList>
+static void getFilesInDirectory(const string& dirName, FileList& fileNames, const vector<string>& validExtensions) {
+    printf("Opening directory %s\n", dirName.c_str());
+    DirectoryScanner scanner(validExtensions, recursiveDirectoryScan, directoryScanThreads, verboseDirectoryScan);
+    if (scanner.scan(dirName, fileNames)) {
+        printf("Found %lu matching files in %lu directories, skipped %lu files of other types\n", (unsigned long) scanner.getFileCount(),
+                scanner.getDirectoryCount(), scanner.getSkippedCount());
+    }
+}
+
+/**
+ * Reads a complete file into memory with a single read of its size, a reused buffer is only reallocated for a file larger than all previous ones
+ * @param fileName
+ * @param content resulting file content, empty on error
+ * @return true on success
+ */
+static bool readFileContent(const char* fileName, vector<uchar>& content) {
+    content.clear();
+    FILE* fp = fopen(fileName, "rb");
+    if (fp == NULL) {
+        printf("Error opening file '%s'!\n", fileName);
+        return false;
+    }
+    struct stat fileStatus;
+    if (fstat(fileno(fp), &fileStatus) == 0 && fileStatus.st_size > 0) {
+        content.resize((size_t) fileStatus.st_size);
+        content.resize(fread(&content[0], 1, content.size(), fp));
+    }
+    // Remainder of files without known size (e.g. pipes) or growing meanwhile
+    uchar buffer[4096];
+    size_t length;
+    while ((length = fread(buffer, 1, sizeof (buffer), fp)) > 0) {
+        content.insert(content.end(), buffer, buffer + length);
+    }
+    const bool success = (ferror(fp) == 0);
+    fclose(fp);
+    if (!success) {
+        printf("Error reading file '%s'!\n", fileName);
+        content.clear();
+    }
+    return success;
+}
+
+/**
+ * Enables the OpenCL backend if it is available and its results match the ones of the CPU path within openCLTolerance,
+ * messages go to stderr as batch detection may write its results to stdout
+ * @param hog HOGDescriptor containing the HOG settings
+ * @return true if the OpenCL backend is in use
+ */
+static bool initializeOpenCL(const HOGDescriptor& hog) {
+    if (!OpenCLHog::enable(true)) {
+        return false;
+    }
+    const double difference = OpenCLHog::verify(hog, Size(8, 8)); // Padding of the detection
+    if (difference > openCLTolerance) {
+        fprintf(stderr, "Error: OpenCL HOG differs from the CPU path by %g (tolerance %g), using the CPU!\n", difference, openCLTolerance);
+        OpenCLHog::enable(false);
+        return false;
+    }
+    fprintf(stderr, "Calculating HOG on OpenCL device '%s', maximum difference to the CPU path %g\n", OpenCLHog::getDeviceName().c_str(), difference);
+    return true;
+}
+
+/**
+ * This is the actual calculation from the (input) image data to the HOG descriptor/feature vector using the hog.compute() function
+ * @param imageFilename file path of the image file, used for messages
+ * @param imageFileContent encoded image file as read from disk (@see readFileContent)
+ * @param descriptorVector the returned calculated feature vector<float> , 
+ *      I can't comprehend why openCV implementation returns std::vector<float> instead of cv::MatExpr_<float> (e.g. Mat<float>)
+ * @param hog HOGDescriptor containin HOG settings
+ * @param decodeSeconds time spent decoding the image is added
+ * @param computeSeconds time spent calculating the features is added
+ * @param extractor batched window extractor, used if variants are given
+ * @param variants window variants (e.g. augmentation) calculated from the decoded image as row-major feature matrix, empty for only the image itself
+ * @param accelerator OpenCL backend, queues the image, the feature vector is only set by accelerator->flush(), NULL to calculate it right away
+ */
+static void calculateFeaturesFromInput(const char* imageFilename, const vector<uchar>& imageFileContent, vector<float>& featureVector, HOGDescriptor& hog,
+        double& decodeSeconds, double& computeSeconds, WindowBatchExtractor* extractor = NULL, const vector<WindowVariant>& variants = vector<WindowVariant>(),
+        OpenCLHog* accelerator = NULL) {
+    if (imageFileContent.empty()) {
+        featureVector.clear();
+        return;
+    }
+    /** for imread/imdecode flags from openCV documentation, 
+     * @see http://docs.opencv.org/modules/highgui/doc/reading_and_writing_images_and_video.html?highlight=imread#Mat imread(const string& filename, int flags)
+     * @note If you get a compile-time error complaining about following line (esp. imdecode),
+     * you either do not have a current openCV version (>2.0) 
+     * or the linking order is incorrect, try g++ -o openCVHogTrainer main.cpp `pkg-config --cflags --libs opencv`
+     */
+    const double decodeStart = RunMetrics::now();
+    Mat imageData = imdecode(imageFileContent, IMREAD_GRAYSCALE);
+    decodeSeconds += RunMetrics::now() - decodeStart;
+    if (imageData.empty()) {
+        featureVector.clear();
+        printf("Error: HOG image '%s' is empty, features calculation skipped!\n", imageFilename);
+        return;
+    }
+    if (extractor != NULL && !variants.empty()) {
+        // All variants from the once decoded image, the image may be larger than the window (e.g. padded crops)
+        if (imageData.cols < hog.winSize.width || imageData.rows < hog.winSize.height) {
+            featureVector.clear();
+            printf("Error: Image '%s' dimensions (%u x %u) are smaller than the HOG window size (%u x %u)!\n", imageFilename, imageData.cols, imageData.rows, hog.winSize.width, hog.winSize.height);
+            return;
+        }
+        const double computeStart = RunMetrics::now();
+        featureVector.clear();
+        extractor->computeVariants(imageData, variants, featureVector);
+        computeSeconds += RunMetrics::now() - computeStart;
+        return;
+    }
+    // Check for mismatching dimensions
+    if (imageData.cols != hog.winSize.width || imageData.rows != hog.winSize.height) {
+        featureVector.clear();
+        printf("Error: Image '%s' dimensions (%u x %u) do not match HOG window size (%u x %u)!\n", imageFilename, imageData.cols, imageData.rows, hog.winSize.width, hog.winSize.height);
+        return;
+    }
+    vector<Point> locations;
+    const double computeStart = RunMetrics::now();
+    if (accelerator != NULL) {
+        accelerator->enqueue(imageData, featureVector); // Window-sized without padding, as calculated by the OpenCL kernels
+    } else {
+        hog.compute(imageData, featureVector, winStride, trainingPadding, locations);
+    }
+    computeSeconds += RunMetrics::now() - computeStart;
+    imageData.release(); // Release the image again after features are extracted
+}
+
+/**
+ * A sample on its way through the feature extraction pipeline, the items are allocated once and reused for all samples,
+ * their buffers keep their capacity so that the steady state does not allocate memory per sample
+ */
+struct FeatureExtractionItem {
+    unsigned long sampleIndex; // Overall sample index, positive samples are enumerated first
+    uint64_t cacheKey; // Feature cache key, 0 if the sample is not cached
+    bool cacheHit; // Feature vector was read from the feature cache
+    vector<uchar> fileContent; // Encoded image file, cleared after decoding
+    vector<float> featureVector; // Calculated feature vector (one row per variant of augmented positive samples), empty if the calculation failed
+    const float* features; // Feature rows of the sample, either in featureVector or already in the training feature matrix
+    unsigned long rowCount; // Number of feature rows, 0 if the calculation failed
+    uint64_t fileBytes; // Size of the image file read
+    double readSeconds, decodeSeconds, computeSeconds; // Time spent in the pipeline stages, for the run metrics
+};
+
+/**
+ * State shared by the stages of the feature extraction pipeline:
+ * 1. prefetch threads read the image files (or take the samples from the feature cache),
+ * 2. compute threads decode the images and calculate their feature vectors, each one with its own copy of the HOGDescriptor,
+ *    and copy them into the rows of the training feature matrix reserved for the sample (if training from memory),
+ * 3. the writer (main thread) brings the samples back into their original order and writes them.
+ * A prefetch thread takes a free item to start a new sample, the writer returns the item after writing it.
+ * This bounds the number of samples in flight, which always are the samples directly following the last written one.
+ */
+struct FeatureExtractionPipeline {
+    /**
+     * @param _positiveFileNames positive sample files, enumerated first
+     * @param _negativeFileNames negative sample files, enumerated after the positive ones
+     * @param _hog HOGDescriptor containing the HOG settings
+     * @param _featureCache cache to look up the samples in, NULL to calculate all samples
+     * @param _depth maximum number of samples in flight
+     * @param _computeThreads number of compute threads
+     * @param _trainingRows training feature matrix with getPositiveVariantCount() rows per positive and one row per negative sample, NULL to leave the features in the items
+     */
+    FeatureExtractionPipeline(const FileNameList& _positiveFileNames, const FileNameList& _negativeFileNames, const HOGDescriptor& _hog, const FeatureCache* _featureCache, unsigned long _depth,
+            int _computeThreads, float* _trainingRows)
+        : positiveFileNames(_positiveFileNames), negativeFileNames(_negativeFileNames), hog(_hog), featureCache(_featureCache), trainingRows(_trainingRows),
+        featureDimension(_hog.getDescriptorSize()), items(_depth), freeItems(_depth), decodeQueue(2 * _computeThreads), resultQueue(_depth), nextSample(0) {
+        pthread_mutex_init(&mutex, NULL);
+        for (unsigned long item = 0; item < _depth; ++item) {
+            freeItems.push(&items[item]);
+        }
+    }
+
+    ~FeatureExtractionPipeline() {
+        pthread_mutex_destroy(&mutex);
+    }
+
+    unsigned long getSampleCount() const {
+        return positiveFileNames.size() + negativeFileNames.size();
+    }
+
+    const char* getFileName(unsigned long sampleIndex) const {
+        return (sampleIndex < positiveFileNames.size() ? positiveFileNames.at(sampleIndex) : negativeFileNames.at(sampleIndex - positiveFileNames.size()));
+    }
+
+    /**
+     * @param sampleIndex
+     * @return number of feature rows of a sample
+     */
+    unsigned long getRowCount(unsigned long sampleIndex) const {
+        return (sampleIndex < positiveFileNames.size()) ? getPositiveVariantCount() : 1;
+    }
+
+    /**
+     * @param sampleIndex
+     * @return first row of the sample in the training feature matrix, NULL if not training from memory
+     */
+    float* getTrainingRows(unsigned long sampleIndex) const {
+        if (trainingRows == NULL) {
+            return NULL;
+        }
+        const unsigned long positives = positiveFileNames.size();
+        const unsigned long row = (sampleIndex < positives) ? sampleIndex * getPositiveVariantCount() : positives * getPositiveVariantCount() + (sampleIndex - positives);
+        return trainingRows + row * featureDimension;
+    }
+
+    /**
+     * Stops all stages, threads blocked in one of the queues return
+     */
+    void close() {
+        freeItems.close();
+        decodeQueue.close();
+        resultQueue.close();
+    }
+
+    const FileNameList& positiveFileNames;
+    const FileNameList& negativeFileNames;
+    const HOGDescriptor& hog;
+    const FeatureCache* featureCache;
+    float* trainingRows;
+    const unsigned long featureDimension;
+    vector<FeatureExtractionItem> items; // All items, owned by the pipeline
+    BoundedQueue<FeatureExtractionItem*> freeItems; // writer -> prefetch
+    BoundedQueue<FeatureExtractionItem*> decodeQueue; // prefetch -> compute
+    BoundedQueue<FeatureExtractionItem*> resultQueue; // compute -> writer
+    pthread_mutex_t mutex; // Guards nextSample
+    unsigned long nextSample; // Next sample to be started by a prefetch thread
+};
+
+/**
+ * Prefetch stage: reads the image files in sample order, samples found in the feature cache are passed on without reading the image
+ * @param _pipeline FeatureExtractionPipeline
+ * @return NULL
+ */
+static void* featureExtractionPrefetchStage(void* _pipeline) {
+    FeatureExtractionPipeline* pipeline = static_cast<FeatureExtractionPipeline*> (_pipeline);
+    FeatureExtractionItem* item;
+    while (pipeline->freeItems.pop(item)) {
+        pthread_mutex_lock(&pipeline->mutex);
+        const unsigned long sampleIndex = pipeline->nextSample;
+        if (sampleIndex < pipeline->getSampleCount()) {
+            ++pipeline->nextSample;
+        }
+        pthread_mutex_unlock(&pipeline->mutex);
+        if (sampleIndex >= pipeline->getSampleCount()) {
+            break;
+        }
+        const char* imageFileName = pipeline->getFileName(sampleIndex);
+        item->sampleIndex = sampleIndex;
+        item->cacheKey = 0;
+        item->cacheHit = false;
+        item->fileContent.clear();
+        item->featureVector.clear();
+        item->features = NULL;
+        item->rowCount = 0;
+        item->fileBytes = 0;
+        item->decodeSeconds = 0.0;
+        item->computeSeconds = 0.0;
+        const double readStart = RunMetrics::now();
+        // The cache holds a single feature vector per sample, augmented positive samples are always calculated
+        const FeatureCache* featureCache = (pipeline->getRowCount(sampleIndex) > 1) ? NULL : pipeline->featureCache;
+        if (featureCache != NULL && !featureCacheContentHash) {
+            item->cacheKey = FeatureCache::sampleKey(imageFileName, false);
+            item->cacheHit = featureCache->lookup(item->cacheKey, item->featureVector);
+        }
+        if (!item->cacheHit && readFileContent(imageFileName, item->fileContent) && featureCache != NULL && featureCacheContentHash) {
+            item->cacheKey = FeatureCache::contentKey(&item->fileContent[0], item->fileContent.size());
+            item->cacheHit = featureCache->lookup(item->cacheKey, item->featureVector);
+        }
+        item->fileBytes = item->fileContent.size();
+        item->readSeconds = RunMetrics::now() - readStart;
+        if (item->cacheHit) {
+            item->fileContent.clear();
+        }
+        if (!pipeline->decodeQueue.push(item)) {
+            break;
+        }
+    }
+    return NULL;
+}
+
+/**
+ * Compute stage: decodes the prefetched image files, calculates their feature vectors and copies them into the training feature matrix.
+ * With the OpenCL backend the samples already waiting are taken up together and their window-sized images are calculated as one batch
+ * @param _pipeline FeatureExtractionPipeline
+ * @return NULL
+ */
+static void* featureExtractionComputeStage(void* _pipeline) {
+    FeatureExtractionPipeline* pipeline = static_cast<FeatureExtractionPipeline*> (_pipeline);
+    HOGDescriptor threadHog(pipeline->hog); // One descriptor per worker
+    WindowBatchExtractor extractor(threadHog, Size(maxPositiveShift, maxPositiveShift));
+    OpenCLHog accelerator(threadHog, openCLBatchSize);
+    OpenCLHog* batchAccelerator = OpenCLHog::isEnabled() ? &accelerator : NULL;
+    vector<WindowVariant> variants;
+    vector<FeatureExtractionItem*> batch;
+    FeatureExtractionItem* item;
+    bool running = true;
+    while (running && pipeline->decodeQueue.pop(item)) {
+        batch.assign(1, item);
+        // Never waits for further samples while holding some, the items in flight are limited
+        while (batchAccelerator != NULL && batch.size() < openCLBatchSize && pipeline->decodeQueue.tryPop(item)) {
+            batch.push_back(item);
+        }
+        for (size_t sample = 0; sample < batch.size(); ++sample) {
+            item = batch[sample];
+            if (!item->cacheHit) {
+                if (pipeline->getRowCount(item->sampleIndex) > 1) {
+                    getPositiveVariants(item->sampleIndex, variants);
+                } else {
+                    variants.clear();
+                }
+                calculateFeaturesFromInput(pipeline->getFileName(item->sampleIndex), item->fileContent, item->featureVector, threadHog, item->decodeSeconds, item->computeSeconds,
+                        &extractor, variants, batchAccelerator);
+                item->fileContent.clear();
+            }
+        }
+        if (batchAccelerator != NULL) {
+            const double flushStart = RunMetrics::now();
+            batchAccelerator->flush();
+            const double flushSeconds = (RunMetrics::now() - flushStart) / batch.size();
+            for (size_t sample = 0; sample < batch.size(); ++sample) {
+                batch[sample]->computeSeconds += flushSeconds;
+            }
+        }
+        for (size_t sample = 0; running && sample < batch.size(); ++sample) {
+            item = batch[sample];
+            const unsigned long expectedRows = pipeline->getRowCount(item->sampleIndex);
+            vector<float>& featureVector = item->featureVector;
+            if (featureVector.size() == expectedRows * pipeline->featureDimension) {
+                item->rowCount = expectedRows;
+                item->features = &featureVector[0];
+                float* trainingRows = pipeline->getTrainingRows(item->sampleIndex);
+                if (trainingRows != NULL) {
+                    copy(featureVector.begin(), featureVector.end(), trainingRows);
+                    item->features = trainingRows;
+                }
+            }
+            running = pipeline->resultQueue.push(item);
+        }
+    }
+    return NULL;
+}
+
+/**
+ * A window collected as hard negative, identified by its source image and location, used to avoid adding the same window twice
+ */
+struct HardNegativeWindow {
+    unsigned long imageIndex;
+    Rect window;
+
+    HardNegativeWindow(unsigned long _imageIndex, const Rect& _window) : imageIndex(_imageIndex), window(_window) {
+    }
+
+    bool operator<(const HardNegativeWindow& other) const {
+        if (imageIndex != other.imageIndex) return imageIndex < other.imageIndex;
+        if (window.x != other.window.x) return window.x < other.window.x;
+        if (window.y != other.window.y) return window.y < other.window.y;
+        if (window.width != other.window.width) return window.width < other.window.width;
+        return window.height < other.window.height;
+    }
+};
+
+/**
+ * Orders detection indices by descending detection weight
+ */
+struct DescendingWeightOrder {
+    const vector<double>& weights;
+
+    DescendingWeightOrder(const vector<double>& _weights) : weights(_weights) {
+    }
+
+    bool operator()(size_t a, size_t b) const {
+        return weights[a] > weights[b];
+    }
+};
+
+/**
+ * Parallel loop body scanning full-size negative images with the current detector,
+ * every detection is a false positive whose window features are calculated as hard negative
+ */
+class HardNegativeMiningBody : public ParallelLoopBody {
+public:
+    /**
+     * @param _imageFileNames full-size negative images
+     * @param _firstImage index of the image the range starts at
+     * @param _hog HOGDescriptor with the current detector set, copied per stripe
+     * @param _hitThreshold detection threshold of the current detector
+     * @param _windows resulting false positive windows per image of the range
+     * @param _features resulting row-major features of the false positive windows per image of the range
+     */
+    HardNegativeMiningBody(const vector<string>& _imageFileNames, unsigned long _firstImage, const HOGDescriptor& _hog, double _hitThreshold, vector< vector<HardNegativeWindow> >& _windows, vector< vector<float> >& _features)
+        : imageFileNames(_imageFileNames), firstImage(_firstImage), hog(_hog), hitThreshold(_hitThreshold), windows(_windows), features(_features) {
+    }
+
+    void operator()(const Range& range) const {
+        HOGDescriptor threadHog(hog); // One descriptor per worker
+        vector<Rect> found;
+        vector<double> foundWeights;
+        vector<size_t> order;
+        vector<float> featureVector;
+        Mat window;
+        for (int batchIndex = range.start; batchIndex < range.end; ++batchIndex) {
+            const unsigned long imageIndex = firstImage + batchIndex;
+            const Mat imageData = imread(imageFileNames.at(imageIndex), IMREAD_GRAYSCALE);
+            if (imageData.empty()) {
+                printf("Error: Image '%s' is empty, skipped for hard negative mining!\n", imageFileNames.at(imageIndex).c_str());
+                continue;
+            }
+            // Raw, ungrouped detections (final threshold 0), every window scoring above the threshold is a false positive
+            threadHog.detectMultiScale(imageData, found, foundWeights, hitThreshold, winStride, trainingPadding, 1.05, 0.0);
+            order.resize(found.size());
+            for (size_t i = 0; i < order.size(); ++i) {
+                order[i] = i;
+            }
+            sort(order.begin(), order.end(), DescendingWeightOrder(foundWeights));
+            if (maxHardNegativesPerImage > 0 && order.size() > maxHardNegativesPerImage) {
+                order.resize(maxHardNegativesPerImage);
+            }
+            for (size_t i = 0; i < order.size(); ++i) {
+                const Rect detection = found[order[i]] & Rect(0, 0, imageData.cols, imageData.rows);
+                if (detection.area() == 0) {
+                    continue;
+                }
+                resize(imageData(detection), window, threadHog.winSize);
+                threadHog.compute(window, featureVector, winStride, trainingPadding);
+                windows.at(batchIndex).push_back(HardNegativeWindow(imageIndex, detection));
+                features.at(batchIndex).insert(features.at(batchIndex).end(), featureVector.begin(), featureVector.end());
+            }
+        }
+    }
+
+private:
+    const vector<string>& imageFileNames;
+    const unsigned long firstImage;
+    const HOGDescriptor& hog;
+    const double hitThreshold;
+    vector< vector<HardNegativeWindow> >& windows;
+    vector< vector<float> >& features;
+};
+
+/**
+ * Scans full-size negative images with the current detector (in parallel) and appends false positive windows
+ * not collected before as hard negatives to the training data, the already stored samples are kept as they are
+ * @param hog HOGDescriptor with the current detector set
+ * @param hitThreshold detection threshold of the current detector
+ * @param fullNegativeImages full-size negative images to scan
+ * @param minedWindows windows collected in previous rounds, extended by the new ones
+ * @param trainingLabels labels for training from memory, NULL if not training from memory
+ * @param trainingFeatures features for training from memory, NULL if not training from memory
+ * @param textWriter SVMlight text export opened for appending, NULL if not exported
+ * @return number of hard negatives added
+ */
+static unsigned long mineHardNegatives(const HOGDescriptor& hog, const double hitThreshold, const vector<string>& fullNegativeImages, set<HardNegativeWindow>& minedWindows,
+        vector<float>* trainingLabels, vector<float>* trainingFeatures, SvmLightWriter* textWriter) {
+    const unsigned long featureDimension = hog.getDescriptorSize();
+    unsigned long addedSamples = 0;
+    for (unsigned long batchStart = 0; batchStart < fullNegativeImages.size(); batchStart += extractionBatchSize) {
+        const unsigned long batchImages = min(extractionBatchSize, fullNegativeImages.size() - batchStart);
+        vector< vector<HardNegativeWindow> > windows(batchImages);
+        vector< vector<float> > features(batchImages);
+        parallel_for_(Range(0, (int) batchImages), HardNegativeMiningBody(fullNegativeImages, batchStart, hog, hitThreshold, windows, features));
+        unsigned long candidates = 0;
+        for (unsigned long batchIndex = 0; batchIndex < batchImages; ++batchIndex) {
+            candidates += windows.at(batchIndex).size();
+        }
+        if (candidates == 0) {
+            continue;
+        }
+        // Append in image order, so that the result does not depend on the thread scheduling
+        FeatureStoreWriter featureStore;
+        if (!featureStore.openForAppend(featuresFile, candidates)) {
+            return addedSamples;
+        }
+        if (featureStore.getDimension() != featureDimension) {
+            printf("Error: Features file '%s' has dimension %lu, the detector %lu!\n", featuresFile.c_str(), (unsigned long) featureStore.getDimension(), featureDimension);
+            return addedSamples;
+        }
+        for (unsigned long batchIndex = 0; batchIndex < batchImages; ++batchIndex) {
+            for (size_t window = 0; window < windows.at(batchIndex).size(); ++window) {
+                if (minedWindows.insert(windows.at(batchIndex).at(window)).second) {
+                    const float* sample = &features.at(batchIndex).at(window * featureDimension);
+                    if (!featureStore.addSample(-1.0f, sample)) {
+                        return addedSamples;
+                    }
+                    if (textWriter != NULL) {
+                        textWriter->writeSample(-1.0f, sample, featureDimension);
+                    }
+                    if (trainingLabels != NULL && trainingFeatures != NULL) {
+                        trainingLabels->push_back(-1.0f);
+                        trainingFeatures->insert(trainingFeatures->end(), sample, sample + featureDimension);
+                    }
+                    ++addedSamples;
+                }
+            }
+        }
+        if (!featureStore.close()) {
+            return addedSamples;
+        }
+        printf("%5lu of %lu images scanned, %lu hard negatives added\n", batchStart + batchImages, (unsigned long) fullNegativeImages.size(), addedSamples);
+    }
+    return addedSamples;
+}
+
+/**
+ * Samples negative windows from a full-size negative image across an image pyramid and calculates their features,
+ * with one hog.compute call (one gradient calculation) per pyramid level for all windows of the level
+ * @param imageData full-size grayscale image without any persons
+ * @param imageIndex index of the image, seeds the random window positions
+ * @param hog HOGDescriptor containing the HOG settings
+ * @param features resulting row-major features of the sampled windows
+ */
+static void sampleNegativeWindows(const Mat& imageData, unsigned long imageIndex, const HOGDescriptor& hog, vector<float>& features) {
+    const Size& winSize = hog.winSize;
+    // Pyramid levels still containing a window, and the number of window positions up to each level
+    vector<Size> levelSizes;
+    vector<double> positionSums;
+    double positions = 0.0;
+    for (double scale = 1.0; ; scale *= negativeWindowScaleStep) {
+        const Size levelSize(cvRound(imageData.cols / scale), cvRound(imageData.rows / scale));
+        if (levelSize.width < winSize.width || levelSize.height < winSize.height) {
+            break;
+        }
+        levelSizes.push_back(levelSize);
+        if (denseNegativeWindows) {
+            positions += (double) ((levelSize.width - winSize.width) / negativeWindowStride.width + 1) * ((levelSize.height - winSize.height) / negativeWindowStride.height + 1);
+        } else {
+            positions += (double) (levelSize.width - winSize.width + 1) * (levelSize.height - winSize.height + 1);
+        }
+        positionSums.push_back(positions);
+        if (negativeWindowScaleStep <= 1.0) {
+            break;
+        }
+    }
+    vector< vector<Point> > locations(levelSizes.size());
+    if (denseNegativeWindows) {
+        // Every grid window, or evenly spaced grid windows if there are more than negativeWindowsPerImage
+        const double step = max(positions / negativeWindowsPerImage, 1.0);
+        double nextWindow = 0.0;
+        long window = 0;
+        unsigned int sampledWindows = 0;
+        for (size_t level = 0; level < levelSizes.size(); ++level) {
+            for (int y = 0; y + winSize.height <= levelSizes[level].height; y += negativeWindowStride.height) {
+                for (int x = 0; x + winSize.width <= levelSizes[level].width; x += negativeWindowStride.width, ++window) {
+                    if (window >= (long) nextWindow && sampledWindows < negativeWindowsPerImage) {
+                        locations[level].push_back(Point(x, y));
+                        nextWindow += step;
+                        ++sampledWindows;
+                    }
+                }
+            }
+        }
+    } else if (positions > 0.0) {
+        // Uniformly distributed over all window positions of all levels
+        RNG rng(negativeWindowSeed + imageIndex);
+        for (unsigned int window = 0; window < negativeWindowsPerImage; ++window) {
+            const double position = rng.uniform(0.0, positions);
+            const size_t level = min((size_t) (upper_bound(positionSums.begin(), positionSums.end(), position) - positionSums.begin()), levelSizes.size() - 1);
+            locations[level].push_back(Point(rng.uniform(0, levelSizes[level].width - winSize.width + 1), rng.uniform(0, levelSizes[level].height - winSize.height + 1)));
+        }
+    }
+    const size_t featureDimension = hog.getDescriptorSize();
+    vector<float> levelFeatures;
+    Mat levelImage;
+    for (size_t level = 0; level < levelSizes.size(); ++level) {
+        if (locations[level].empty()) {
+            continue;
+        }
+        if (level == 0) {
+            levelImage = imageData;
+        } else {
+            resize(imageData, levelImage, levelSizes[level], 0, 0, INTER_LINEAR);
+        }
+        hog.compute(levelImage, levelFeatures, winStride, trainingPadding, locations[level]);
+        if (levelFeatures.size() == locations[level].size() * featureDimension) {
+            features.insert(features.end(), levelFeatures.begin(), levelFeatures.end());
+        }
+    }
+}
+
+/**
+ * Parallel loop body decoding full-size negative images (once each) and calculating the features of the windows sampled from them
+ */
+class NegativeWindowSamplingBody : public ParallelLoopBody {
+public:
+    /**
+     * @param _imageFileNames full-size negative images
+     * @param _firstImage index of the image the range starts at
+     * @param _hog HOGDescriptor containing the HOG settings, copied per stripe
+     * @param _features resulting row-major features of the sampled windows per image of the range
+     */
+    NegativeWindowSamplingBody(const vector<string>& _imageFileNames, unsigned long _firstImage, const HOGDescriptor& _hog, vector< vector<float> >& _features)
+        : imageFileNames(_imageFileNames), firstImage(_firstImage), hog(_hog), features(_features) {
+    }
+
+    void operator()(const Range& range) const {
+        HOGDescriptor threadHog(hog); // One descriptor per worker
+        for (int batchIndex = range.start; batchIndex < range.end; ++batchIndex) {
+            const unsigned long imageIndex = firstImage + batchIndex;
+            const Mat imageData = imread(imageFileNames.at(imageIndex), IMREAD_GRAYSCALE);
+            if (imageData.empty()) {
+                printf("Error: Image '%s' is empty, no negative windows sampled!\n", imageFileNames.at(imageIndex).c_str());
+                continue;
+            }
+            sampleNegativeWindows(imageData, imageIndex, threadHog, features.at(batchIndex));
+        }
+    }
+
+private:
+    const vector<string>& imageFileNames;
+    const unsigned long firstImage;
+    const HOGDescriptor& hog;
+    vector< vector<float> >& features;
+};
+
+/**
+ * Samples negative windows from full-size negative images (in parallel) and adds them as negative samples, in image order
+ * @param hog HOGDescriptor containing the HOG settings
+ * @param fullNegativeImages full-size negative images to sample from
+ * @param featureStore written features file, NULL if not written
+ * @param trainingLabels labels for training from memory, NULL if not training from memory
+ * @param trainingFeatures features for training from memory, NULL if not training from memory
+ * @param textWriter SVMlight text export, NULL if not exported
+ * @param addedSamples number of added negative windows
+ * @return false if writing the samples failed
+ */
+static bool addSampledNegativeWindows(const HOGDescriptor& hog, const vector<string>& fullNegativeImages, FeatureStoreWriter* featureStore,
+        vector<float>* trainingLabels, vector<float>* trainingFeatures, SvmLightWriter* textWriter, unsigned long& addedSamples) {
+    const unsigned long featureDimension = hog.getDescriptorSize();
+    addedSamples = 0;
+    for (unsigned long batchStart = 0; batchStart < fullNegativeImages.size(); batchStart += extractionBatchSize) {
+        const unsigned long batchImages = min(extractionBatchSize, fullNegativeImages.size() - batchStart);
+        vector< vector<float> > features(batchImages);
+        parallel_for_(Range(0, (int) batchImages), NegativeWindowSamplingBody(fullNegativeImages, batchStart, hog, features));
+        for (unsigned long batchIndex = 0; batchIndex < batchImages; ++batchIndex) {
+            const vector<float>& imageFeatures = features.at(batchIndex);
+            const unsigned long windows = imageFeatures.size() / featureDimension;
+            for (unsigned long window = 0; window < windows; ++window) {
+                if (featureStore != NULL && !featureStore->addSample(-1.0f, &imageFeatures[window * featureDimension])) {
+                    return false;
+                }
+                if (textWriter != NULL) {
+                    textWriter->writeSample(-1.0f, &imageFeatures[window * featureDimension], featureDimension);
+                }
+            }
+            if (trainingLabels != NULL && trainingFeatures != NULL) {
+                trainingLabels->insert(trainingLabels->end(), windows, -1.0f);
+                trainingFeatures->insert(trainingFeatures->end(), imageFeatures.begin(), imageFeatures.end());
+            }
+            addedSamples += windows;
+        }
+        printf("%5lu of %lu full-size negative images sampled, %lu negative windows added\n", batchStart + batchImages, (unsigned long) fullNegativeImages.size(), addedSamples);
+    }
+    return true;
+}
+
+/**
+ * Shows the detections in the image
+ * @param found vector containing valid detection rectangles
+ * @param imageData the image in which the detections are drawn
+ */
+static void showDetections(const vector<Point>& found, Mat& imageData) {
+    size_t i, j;
+    for (i = 0; i < found.size(); ++i) {
+        Point r = found[i];
+        // Rect_(_Tp _x, _Tp _y, _Tp _width, _Tp _height);
+        rectangle(imageData, Rect(r.x-16, r.y-32, 32, 64), Scalar(64, 255, 64), 3);
+    }
+}
+
+/**
+ * Shows the detections in the image
+ * @param found vector containing valid detection rectangles
+ * @param imageData the image in which the detections are drawn
+ */
+static void showDetections(const vector<Rect>& found, Mat& imageData) {
+    for (size_t i = 0; i < found.size(); ++i) {
+        const Rect& r = found[i];
+        rectangle(imageData, r.tl(), r.br(), Scalar(64, 255, 64), 3);
+    }
+}
+
+/**
+ * Reduces raw (ungrouped) detection windows by greedy non-maximum suppression (@see detection/nms.h)
+ * @param windows raw detection windows
+ * @param windowWeights score per raw detection window
+ * @param found the kept windows are appended, by descending score
+ * @param foundWeights the scores of the kept windows are appended
+ */
+static void appendSuppressedDetections(const vector<Rect>& windows, const vector<double>& windowWeights, vector<Rect>& found, vector<double>& foundWeights) {
+    vector<size_t> keep;
+    nonMaximumSuppression(windows, windowWeights, nmsOverlapThreshold, keep, nmsSpatialGrid);
+    for (size_t i = 0; i < keep.size(); ++i) {
+        found.push_back(windows[keep[i]]);
+        foundWeights.push_back(windowWeights[keep[i]]);
+    }
+}
+
+/**
+ * Multi-scale detection with scores: the raw (ungrouped) detection windows of detectMultiScale
+ * are reduced by greedy non-maximum suppression (@see detection/nms.h)
+ * @param hog HOGDescriptor with the detector set
+ * @param hitThreshold threshold value for detection
+ * @param imageData
+ * @param found resulting detection windows, by descending score
+ * @param foundWeights resulting score per detection window
+ */
+static void detectWithScores(const HOGDescriptor& hog, const double hitThreshold, const Mat& imageData, vector<Rect>& found, vector<double>& foundWeights) {
+    vector<Rect> windows;
+    vector<double> windowWeights;
+    hog.detectMultiScale(imageData, windows, windowWeights, hitThreshold, Size(8, 8), Size(8, 8), 1.05, 0.0);
+    found.clear();
+    foundWeights.clear();
+    appendSuppressedDetections(windows, windowWeights, found, foundWeights);
+}
+
+/**
+ * Results of testing the detector against a set of sample images
+ */
+struct DetectionTestReport {
+
+    DetectionTestReport() : truePositives(0), trueNegatives(0), falsePositives(0), falseNegatives(0), images(0), cachedImages(0), imageSeconds(0.0) {
+    }
+
+    void add(const DetectionTestReport& other) {
+        truePositives += other.truePositives;
+        trueNegatives += other.trueNegatives;
+        falsePositives += other.falsePositives;
+        falseNegatives += other.falseNegatives;
+        images += other.images;
+        cachedImages += other.cachedImages;
+        imageSeconds += other.imageSeconds;
+    }
+
+    /**
+     * Counts the result of one tested image
+     * @param positiveSample
+     * @param detections number of detections on the image
+     * @param seconds processing time of the image
+     */
+    void addResult(bool positiveSample, size_t detections, double seconds) {
+        imageSeconds += seconds;
+        ++images;
+        if (positiveSample) {
+            if (detections > 0) {
+                ++truePositives;
+            } else {
+                ++falseNegatives;
+            }
+        } else {
+            if (detections > 0) {
+                falsePositives += detections;
+            } else {
+                ++trueNegatives;
+            }
+        }
+    }
+
+    unsigned long truePositives;
+    unsigned long trueNegatives;
+    unsigned long falsePositives;
+    unsigned long falseNegatives;
+    unsigned long images; // Number of tested images
+    unsigned long cachedImages; // Number of images scored from their cached descriptor instead of being decoded and detected again
+    double imageSeconds; // Processing time summed over all images
+};
+
+/**
+ * Parallel loop body testing the detector on sample images, every stripe counts on its own and merges its counts at the end.
+ * Training samples have the size of the detection window, so if their descriptor is found in the feature cache,
+ * w*x + rho is exactly what hog.detect() would calculate for the image and the image needs not be decoded again.
+ * With the OpenCL backend, the descriptors of the window-sized images are calculated in batches and scored the same way.
+ */
+class DetectionTestBody : public ParallelLoopBody {
+public:
+    /**
+     * @param _positiveFileNames positive sample files, enumerated first
+     * @param _negativeFileNames negative sample files, enumerated after the positive ones
+     * @param _hog HOGDescriptor with the detector set, copied per stripe
+     * @param _hitThreshold threshold value for detection
+     * @param _featureCache cache containing the sample descriptors, NULL to detect on all images
+     * @param _report report to merge the counts into
+     * @param _reportMutex guards _report
+     */
+    DetectionTestBody(const FileNameList& _positiveFileNames, const FileNameList& _negativeFileNames, const HOGDescriptor& _hog, const double _hitThreshold,
+            const FeatureCache* _featureCache, DetectionTestReport& _report, pthread_mutex_t& _reportMutex)
+        : positiveFileNames(_positiveFileNames), negativeFileNames(_negativeFileNames), hog(_hog), hitThreshold(_hitThreshold),
+        featureCache(_featureCache), report(_report), reportMutex(_reportMutex) {
+    }
+
+    void operator()(const Range& range) const {
+        HOGDescriptor threadHog(hog); // One descriptor per worker
+        const size_t descriptorSize = threadHog.getDescriptorSize();
+        const double rho = (threadHog.svmDetector.size() > descriptorSize) ? threadHog.svmDetector[descriptorSize] : 0.0;
+        DetectionTestReport stripeReport;
+        vector<Point> foundDetection;
+        vector<float> featureVector;
+        OpenCLHog accelerator(threadHog, openCLBatchSize);
+        const bool accelerated = OpenCLHog::isEnabled();
+        vector< vector<float> > batchDescriptors(accelerated ? openCLBatchSize : 0);
+        vector<char> batchPositive; // Per queued image: positive sample
+        double batchSeconds = 0.0;
+        for (int sampleIndex = range.start; sampleIndex < range.end; ++sampleIndex) {
+            const bool positiveSample = ((size_t) sampleIndex < positiveFileNames.size());
+            const char* imageFileName = (positiveSample ? positiveFileNames.at(sampleIndex) : negativeFileNames.at(sampleIndex - positiveFileNames.size()));
+            const int64 startTicks = getTickCount();
+            size_t detections;
+            if (featureCache != NULL && featureCache->lookup(FeatureCache::sampleKey(imageFileName, featureCacheContentHash), featureVector) && featureVector.size() == descriptorSize) {
+                const double score = inner_product(featureVector.begin(), featureVector.end(), threadHog.svmDetector.begin(), rho);
+                detections = (score >= hitThreshold) ? 1 : 0;
+                ++stripeReport.cachedImages;
+            } else {
+                const Mat imageData = imread(imageFileName, IMREAD_GRAYSCALE);
+                if (imageData.empty()) {
+                    printf("Error: Image '%s' is empty, skipped for testing!\n", imageFileName);
+                    continue;
+                }
+                if (accelerated && imageData.size() == threadHog.winSize) {
+                    accelerator.enqueue(imageData, batchDescriptors[batchPositive.size()]);
+                    batchPositive.push_back(positiveSample);
+                    batchSeconds += (getTickCount() - startTicks) / getTickFrequency();
+                    if (batchPositive.size() == batchDescriptors.size()) {
+                        scoreBatch(accelerator, batchDescriptors, batchPositive, batchSeconds, rho, threadHog.svmDetector, stripeReport);
+                    }
+                    continue;
+                }
+                threadHog.detect(imageData, foundDetection, hitThreshold, winStride, trainingPadding);
+                detections = foundDetection.size();
+            }
+            stripeReport.addResult(positiveSample, detections, (getTickCount() - startTicks) / getTickFrequency());
+        }
+        scoreBatch(accelerator, batchDescriptors, batchPositive, batchSeconds, rho, threadHog.svmDetector, stripeReport);
+        pthread_mutex_lock(&reportMutex);
+        report.add(stripeReport);
+        pthread_mutex_unlock(&reportMutex);
+    }
+
+private:
+
+    /**
+     * Calculates the descriptors of the queued images and scores them as w*x + rho, the queue is emptied
+     * @param accelerator OpenCL backend the images are queued in
+     * @param descriptors descriptor per queued image, set by the OpenCL backend
+     * @param positive per queued image: positive sample
+     * @param seconds processing time of the queued images, the calculation time is added and the sum counted to the images
+     * @param rho
+     * @param detector
+     * @param report
+     */
+    void scoreBatch(OpenCLHog& accelerator, vector< vector<float> >& descriptors, vector<char>& positive, double& seconds, double rho, const vector<float>& detector,
+            DetectionTestReport& report) const {
+        if (positive.empty()) {
+            return;
+        }
+        const int64 startTicks = getTickCount();
+        accelerator.flush();
+        seconds += (getTickCount() - startTicks) / getTickFrequency();
+        for (size_t image = 0; image < positive.size(); ++image) {
+            const vector<float>& descriptor = descriptors[image];
+            if (descriptor.size() != accelerator.getDescriptorSize() || detector.size() < descriptor.size()) {
+                continue; // Calculation failed, reported by flush
+            }
+            const size_t detections = (inner_product(descriptor.begin(), descriptor.end(), detector.begin(), rho) >= hitThreshold) ? 1 : 0;
+            report.addResult(positive[image] != 0, detections, seconds / positive.size());
+        }
+        positive.clear();
+        seconds = 0.0;
+    }
+
+    const FileNameList& positiveFileNames;
+    const FileNameList& negativeFileNames;
+    const HOGDescriptor& hog;
+    const double hitThreshold;
+    const FeatureCache* featureCache;
+    DetectionTestReport& report;
+    pthread_mutex_t& reportMutex;
+};
+
+/**
+ * Test the trained detector against the same training set to get an approximate idea of the detector.
+ * Warning: This does not allow any statement about detection quality, as the detector might be overfitting.
+ * Detector quality must be determined using an independent test set.
+ * @param hog
+ * @param hitThreshold threshold value for detection
+ * @param posFileNames
+ * @param negFileNames
+ * @param featureCache cache containing the descriptors calculated during feature extraction, NULL to detect on all images
+ */
+static void detectTrainingSetTest(const HOGDescriptor& hog, const double hitThreshold, const FileNameList& posFileNames, const FileNameList& negFileNames, const FeatureCache* featureCache) {
+    DetectionTestReport report;
+    pthread_mutex_t reportMutex;
+    pthread_mutex_init(&reportMutex, NULL);
+    const int64 startTicks = getTickCount();
+    parallel_for_(Range(0, (int) (posFileNames.size() + negFileNames.size())), DetectionTestBody(posFileNames, negFileNames, hog, hitThreshold, featureCache, report, reportMutex));
+    const double seconds = (getTickCount() - startTicks) / getTickFrequency();
+    pthread_mutex_destroy(&reportMutex);
+
+    const unsigned long detected = report.truePositives + report.falsePositives;
+    const unsigned long positives = report.truePositives + report.falseNegatives;
+    printf("Results (%lu images, %lu of them scored from cached descriptors):\n", report.images, report.cachedImages);
+    printf("\tTrue Positives: %lu\n\tTrue Negatives: %lu\n\tFalse Positives: %lu\n\tFalse Negatives: %lu\n", report.truePositives, report.trueNegatives, report.falsePositives, report.falseNegatives);
+    printf("\tPrecision: %.4f\n\tRecall: %.4f\n", (detected > 0) ? (double) report.truePositives / detected : 0.0, (positives > 0) ? (double) report.truePositives / positives : 0.0);
+    if (report.images > 0) {
+        printf("\tTime per image: %.3f ms (%.3f ms wall clock using %d threads)\n", 1000.0 * report.imageSeconds / report.images, 1000.0 * seconds / report.images, getNumThreads());
+    }
+}
+
+/**
+ * Scores all samples of the features file with the detector as batched matrix-vector product (w*x + b, detections score >= 0),
+ * which for training samples of the window size is what hog.detect() calculates, without decoding the images again.
+ * Writes a histogram of the scores and the ROC curve over all thresholds, calculated in one pass over the sorted scores.
+ * @param descriptorVector single detecting vector w (optionally followed by rho, as used by openCV)
+ * @param hitThreshold detection threshold of the detector
+ */
+static void scoreStoredFeatures(const vector<float>& descriptorVector, const double hitThreshold) {
+    FeatureStoreMapping mapping;
+    if (!mapping.open(featuresFile.c_str())) {
+        printf("Skipping evaluation of stored features\n");
+        return;
+    }
+    const uint64_t sampleCount = mapping.getCount();
+    const uint64_t featureDimension = mapping.getDimension();
+    if (descriptorVector.size() < featureDimension || sampleCount == 0) {
+        printf("Error: Features file '%s' (%lu samples of dimension %lu) does not match the detector dimension %lu!\n", featuresFile.c_str(),
+                (unsigned long) sampleCount, (unsigned long) featureDimension, (unsigned long) descriptorVector.size());
+        return;
+    }
+    const double rho = (descriptorVector.size() > featureDimension) ? descriptorVector[featureDimension] : 0.0;
+    const int64 startTicks = getTickCount();
+    vector<double> scores(sampleCount);
+    for (uint64_t firstSample = 0; firstSample < sampleCount; firstSample += FEATURESTORE_CHUNK_SAMPLES) {
+        const uint64_t chunkSamples = min((uint64_t) FEATURESTORE_CHUNK_SAMPLES, sampleCount - firstSample);
+        denseGemv(mapping.getSample(firstSample), (long) chunkSamples, (long) featureDimension, &descriptorVector[0], rho - hitThreshold, &scores[firstSample]);
+        mapping.releaseSamples(firstSample, chunkSamples);
+    }
+    const double seconds = (getTickCount() - startTicks) / getTickFrequency();
+    vector<char> positive(sampleCount);
+    unsigned long positives = 0;
+    for (uint64_t sample = 0; sample < sampleCount; ++sample) {
+        positive[sample] = (mapping.getLabels()[sample] > 0);
+        positives += positive[sample];
+    }
+    const unsigned long negatives = sampleCount - positives;
+    vector<RocPoint> curve;
+    computeRocCurve(scores, positive, curve);
+    // Operating point of the detector threshold (score 0)
+    RocPoint detectorPoint;
+    detectorPoint.threshold = 0.0;
+    detectorPoint.truePositives = 0;
+    detectorPoint.falsePositives = 0;
+    for (size_t point = 0; point < curve.size() && curve[point].threshold >= 0.0; ++point) {
+        detectorPoint = curve[point];
+    }
+    printf("Scored %lu stored samples in %.3f s, ROC area under curve %.4f\n", (unsigned long) sampleCount, seconds, rocAreaUnderCurve(curve, positives, negatives));
+    printf("\tAt the detector threshold: True Positives: %lu, False Negatives: %lu, False Positives: %lu, True Negatives: %lu\n",
+            detectorPoint.truePositives, positives - detectorPoint.truePositives, detectorPoint.falsePositives, negatives - detectorPoint.falsePositives);
+    if (writeScoreHistogram(scoreHistogramFile, scores, positive, scoreHistogramBins) && writeRocCurve(rocCurveFile, curve, positives, negatives)) {
+        printf("Score histogram saved to '%s', ROC curve saved to '%s'\n", scoreHistogramFile.c_str(), rocCurveFile.c_str());
+    }
+}
+
+/**
+ * Parallel loop body training the linear SVMs of the grid search, one job per (fold, cost) pair,
+ * every job has its own solver instance reading the shared training data
+ */
+class GridSearchTrainingBody : public ParallelLoopBody {
+public:
+    /**
+     * @param _labels one label (+1 / -1) per sample
+     * @param _features row-major feature matrix, _sampleCount x _dimension values
+     * @param _sampleCount
+     * @param _dimension
+     * @param _trainingRows rows of the training folds per fold
+     * @param _costs candidate values of C
+     * @param _parameter solver parameters, C is replaced by the candidate values
+     * @param _weights resulting weights, one row per job (fold * costs + cost)
+     * @param _biases resulting bias per job
+     */
+    GridSearchTrainingBody(const float* _labels, const float* _features, long _sampleCount, long _dimension, const vector< vector<long> >& _trainingRows,
+            const vector<double>& _costs, const LinearSVMParameter& _parameter, vector<float>& _weights, vector<double>& _biases)
+        : labels(_labels), features(_features), sampleCount(_sampleCount), dimension(_dimension), trainingRows(_trainingRows), costs(_costs), parameter(_parameter), weights(_weights), biases(_biases) {
+    }
+
+    void operator()(const Range& range) const {
+        vector<float> modelWeights;
+        vector<unsigned int> modelIndices;
+        for (int job = range.start; job < range.end; ++job) {
+            LinearSVM svm;
+            svm.param = parameter;
+            svm.param.verbose = false;
+            svm.setC(costs[job % costs.size()]);
+            svm.setSharedProblem(labels, features, sampleCount, dimension);
+            svm.setSampleSubset(trainingRows[job / costs.size()]);
+            svm.train();
+            svm.getSingleDetectingVector(modelWeights, modelIndices);
+            copy(modelWeights.begin(), modelWeights.end(), weights.begin() + job * dimension);
+            biases[job] = -svm.getThreshold();
+        }
+    }
+
+private:
+    const float* labels;
+    const float* features;
+    const long sampleCount;
+    const long dimension;
+    const vector< vector<long> >& trainingRows;
+    const vector<double>& costs;
+    const LinearSVMParameter parameter;
+    vector<float>& weights;
+    vector<double>& biases;
+};
+
+/**
+ * Parallel loop body scoring the validation samples of every fold with the models of all costs trained on the other folds,
+ * as batched matrix product of chunks of validation samples and the model weights
+ */
+class GridSearchScoringBody : public ParallelLoopBody {
+public:
+    /**
+     * @param _features row-major feature matrix
+     * @param _dimension
+     * @param _validationRows rows of the validation fold per fold
+     * @param _costs number of costs (models per fold)
+     * @param _weights model weights, one row per job (fold * costs + cost)
+     * @param _biases model bias per job
+     * @param _scores resulting score w*x + b per cost and sample
+     */
+    GridSearchScoringBody(const float* _features, long _dimension, const vector< vector<long> >& _validationRows, long _costs,
+            const vector<float>& _weights, const vector<double>& _biases, vector< vector<double> >& _scores)
+        : features(_features), dimension(_dimension), validationRows(_validationRows), costs(_costs), weights(_weights), biases(_biases), scores(_scores) {
+    }
+
+    void operator()(const Range& range) const {
+        const long chunkSize = 256;
+        vector<float> chunk(chunkSize * dimension);
+        vector<double> chunkScores(chunkSize * costs);
+        for (int fold = range.start; fold < range.end; ++fold) {
+            const vector<long>& rows = validationRows[fold];
+            for (size_t first = 0; first < rows.size(); first += chunkSize) {
+                const long chunkRows = min((long) (rows.size() - first), chunkSize);
+                for (long row = 0; row < chunkRows; ++row) {
+                    copy(features + rows[first + row] * dimension, features + (rows[first + row] + 1) * dimension, chunk.begin() + row * dimension);
+                }
+                denseGemmTransposed(&chunk[0], chunkRows, &weights[fold * costs * dimension], costs, dimension, &biases[fold * costs], &chunkScores[0]);
+                for (long row = 0; row < chunkRows; ++row) {
+                    for (long cost = 0; cost < costs; ++cost) {
+                        scores[cost][rows[first + row]] = chunkScores[row * costs + cost];
+                    }
+                }
+            }
+        }
+    }
+
+private:
+    const float* features;
+    const long dimension;
+    const vector< vector<long> >& validationRows;
+    const long costs;
+    const vector<float>& weights;
+    const vector<double>& biases;
+    vector< vector<double> >& scores;
+};
+
+/**
+ * Selects the SVM cost parameter C by k-fold cross-validation (gridSearchFolds) over gridSearchCosts, the folds are stratified by label.
+ * The cost with the fewest validation errors (score w*x + b >= 0 counts as positive) is selected, the ROC area under curve is reported alongside
+ * @param labels one label (+1 / -1) per sample
+ * @param features row-major feature matrix, sampleCount x dimension values
+ * @param sampleCount
+ * @param dimension
+ * @param bestCost resulting best value of C
+ * @return false if the backend is not supported or there are not enough samples of both classes for the folds
+ */
+static bool gridSearchCost(const float* labels, const float* features, long sampleCount, long dimension, double& bestCost) {
+    // The folds are trained with the objective of the configured backend, SgdSVM minimizes the one of the L1-loss LinearSVM
+    LinearSVMParameter parameter = LinearSVM().param;
+#if TRAINHOG_USEDSVM == LINEARSVM
+    parameter = TRAINHOG_SVM_TO_TRAIN::getInstance()->param;
+#elif TRAINHOG_USEDSVM == SGDSVM
+    parameter.lossType = LinearSVMParameter::L1LOSS;
+    parameter.biasFeature = TRAINHOG_SVM_TO_TRAIN::getInstance()->param.biasFeature;
+#else
+    printf("Warning: The grid search of C only supports LinearSVM and SgdSVM, %s is trained with its configured C\n", TRAINHOG_SVM_TO_TRAIN::getInstance()->getSVMName());
+    return false;
+#endif
+    const vector<double> costs(gridSearchCosts, gridSearchCosts + sizeof (gridSearchCosts) / sizeof (gridSearchCosts[0]));
+    const int folds = gridSearchFolds;
+    vector<long> classRows[2]; // Negative and positive rows
+    vector<char> positive(sampleCount);
+    for (long row = 0; row < sampleCount; ++row) {
+        positive[row] = (labels[row] > 0);
+        classRows[positive[row] ? 1 : 0].push_back(row);
+    }
+    if ((long) classRows[0].size() < folds || (long) classRows[1].size() < folds) {
+        printf("Error: Not enough positive (%lu) and negative (%lu) samples for %d-fold cross-validation, grid search skipped!\n",
+                (unsigned long) classRows[1].size(), (unsigned long) classRows[0].size(), folds);
+        return false;
+    }
+    // Stratified folds: every class is shuffled and dealt round-robin to the folds
+    vector<int> sampleFold(sampleCount);
+    RNG rng(gridSearchSeed);
+    for (int label = 0; label < 2; ++label) {
+        vector<long>& rows = classRows[label];
+        for (size_t i = rows.size() - 1; i > 0; --i) {
+            swap(rows[i], rows[rng.uniform(0, (int) i + 1)]);
+        }
+        for (size_t i = 0; i < rows.size(); ++i) {
+            sampleFold[rows[i]] = i % folds;
+        }
+    }
+    vector< vector<long> > trainingRows(folds), validationRows(folds);
+    for (long row = 0; row < sampleCount; ++row) {
+        for (int fold = 0; fold < folds; ++fold) {
+            (fold == sampleFold[row] ? validationRows : trainingRows)[fold].push_back(row);
+        }
+    }
+
+    printf("Grid search of C: training %d folds x %lu costs on %ld samples\n", folds, (unsigned long) costs.size(), sampleCount);
+    const long jobs = folds * (long) costs.size();
+    vector<float> weights(jobs * dimension);
+    vector<double> biases(jobs);
+    parallel_for_(Range(0, (int) jobs), GridSearchTrainingBody(labels, features, sampleCount, dimension, trainingRows, costs, parameter, weights, biases));
+    vector< vector<double> > scores(costs.size(), vector<double>(sampleCount));
+    parallel_for_(Range(0, folds), GridSearchScoringBody(features, dimension, validationRows, (long) costs.size(), weights, biases, scores));
+
+    const unsigned long positives = classRows[1].size();
+    const unsigned long negatives = classRows[0].size();
+    unsigned long bestErrors = 0;
+    for (size_t cost = 0; cost < costs.size(); ++cost) {
+        unsigned long falseNegatives = 0, falsePositives = 0;
+        for (long row = 0; row < sampleCount; ++row) {
+            if ((scores[cost][row] >= 0.0) != (positive[row] != 0)) {
+                ++(positive[row] ? falseNegatives : falsePositives);
+            }
+        }
+        vector<RocPoint> curve;
+        computeRocCurve(scores[cost], positive, curve);
+        printf("\tC %g: validation error %.4f%% (%lu false negatives, %lu false positives), ROC area under curve %.4f\n", costs[cost],
+                100.0 * (falseNegatives + falsePositives) / sampleCount, falseNegatives, falsePositives, rocAreaUnderCurve(curve, positives, negatives));
+        if (cost == 0 || falseNegatives + falsePositives < bestErrors) {
+            bestErrors = falseNegatives + falsePositives;
+            bestCost = costs[cost];
+        }
+    }
+    printf("Selected C %g\n", bestCost);
+    return true;
+}
+
+/**
+ * @param fileName
+ * @param cost
+ * @return fileName with the suffix _c<cost> inserted before the file extension
+ */
+static string getVariantFileName(const string& fileName, double cost) {
+    char suffix[32];
+    snprintf(suffix, sizeof (suffix), "_c%g", cost);
+    const size_t separator = fileName.find_last_of('/');
+    const size_t dot = fileName.find_last_of('.');
+    if (dot == string::npos || (separator != string::npos && dot < separator)) {
+        return fileName + suffix;
+    }
+    return fileName.substr(0, dot) + suffix + fileName.substr(dot);
+}
+
+/**
+ * Parallel loop body training one detector per cost, each with its own SVM instance.
+ * LinearSVM and SgdSVM share the training features in memory, the other backends build their own copy of the problem
+ */
+class DetectorVariantTrainingBody : public ParallelLoopBody {
+public:
+    /**
+     * @param _labels training labels in memory, NULL to read the training set from featuresFile
+     * @param _features row-major training features in memory, shared read-only by all instances
+     * @param _costs value of C per detector
+     * @param _thresholds resulting detection threshold per detector
+     */
+    DetectorVariantTrainingBody(const vector<float>* _labels, const vector<float>* _features, const vector<double>& _costs, vector<double>& _thresholds)
+        : labels(_labels), features(_features), costs(_costs), thresholds(_thresholds) {
+    }
+
+    void operator()(const Range& range) const {
+        vector<float> descriptorVector;
+        vector<unsigned int> descriptorVectorIndices;
+        for (int detector = range.start; detector < range.end; ++detector) {
+            TRAINHOG_SVM_TO_TRAIN svm;
+            svm.setC(costs[detector]);
+#if TRAINHOG_USEDSVM == SVMLIGHT || TRAINHOG_USEDSVM == LIBSVM
+            svm.useFileBackedMemory(fileBackedTrainingDir);
+#endif
+            if (labels != NULL) {
+#if TRAINHOG_USEDSVM == LINEARSVM || TRAINHOG_USEDSVM == SGDSVM
+                const long sampleCount = labels->size();
+                svm.setSharedProblem(sampleCount > 0 ? &(*labels)[0] : NULL, sampleCount > 0 ? &(*features)[0] : NULL, sampleCount, sampleCount > 0 ? (long) (features->size() / sampleCount) : 0);
+#else
+                svm.read_problem(*labels, *features);
+#endif
+            } else {
+                svm.read_problem(const_cast<char*> (featuresFile.c_str()));
+            }
+            svm.train();
+            svm.saveModelToFile(getVariantFileName(svmModelFile, costs[detector]));
+            svm.getSingleDetectingVector(descriptorVector, descriptorVectorIndices);
+            saveDescriptorVectorToFile(descriptorVector, descriptorVectorIndices, getVariantFileName(descriptorVectorFile, costs[detector]));
+            thresholds[detector] = svm.getThreshold();
+        }
+    }
+
+private:
+    const vector<float>* labels;
+    const vector<float>* features;
+    const vector<double>& costs;
+    vector<double>& thresholds;
+};
+
+/**
+ * Parallel loop body scoring a chunk of stored samples with the quantized detector
+ */
+class QuantizedScoringBody : public ParallelLoopBody {
+public:
+    /**
+     * @param _detector quantized detector
+     * @param _samples row-major feature matrix of the chunk
+     * @param _dimension number of features per sample
+     * @param _scores resulting score per sample of the chunk
+     */
+    QuantizedScoringBody(const QuantizedDetector& _detector, const float* _samples, uint64_t _dimension, double* _scores)
+        : detector(_detector), samples(_samples), dimension(_dimension), scores(_scores) {
+    }
+
+    void operator()(const Range& range) const {
+        for (int sample = range.start; sample < range.end; ++sample) {
+            scores[sample] = detector.score(samples + sample * dimension);
+        }
+    }
+
+private:
+    const QuantizedDetector& detector;
+    const float* samples;
+    const uint64_t dimension;
+    double* scores;
+};
+
+/**
+ * Exports the detector quantized (@see quantizedDetectorBits) and reports the accuracy delta of the reloaded quantized detector
+ * against the float32 detector on the samples of the features file
+ * @param descriptorVector detecting vector followed by the bias rho
+ * @param hitThreshold threshold value for detection
+ * @param hog HOGDescriptor the detector was trained with
+ */
+static void exportQuantizedDetector(const vector<float>& descriptorVector, const double hitThreshold, const HOGDescriptor& hog) {
+    const uint32_t blockHistogramSize = (hog.blockSize.width / hog.cellSize.width) * (hog.blockSize.height / hog.cellSize.height) * hog.nbins;
+    QuantizedDetector quantized;
+    if (!quantized.quantize(descriptorVector, hog.getDescriptorSize(), (QuantizedDetectorFormat) quantizedDetectorBits, blockHistogramSize, hitThreshold, getFeatureStoreHogParams(hog))
+            || !quantized.save(quantizedDetectorFile) || !quantized.load(quantizedDetectorFile)) {
+        return;
+    }
+    printf("Saved %s quantized detector to '%s' (%lu bytes of weights instead of %lu)\n", (quantizedDetectorBits == QUANTIZED_INT8) ? "int8" : "float16",
+            quantizedDetectorFile.c_str(), (unsigned long) quantized.getWeightBytes(), (unsigned long) (hog.getDescriptorSize() * sizeof (float)));
+
+    FeatureStoreMapping mapping;
+    if (!mapping.open(featuresFile.c_str())) {
+        printf("Skipping accuracy check of the quantized detector\n");
+        return;
+    }
+    const uint64_t sampleCount = mapping.getCount();
+    const uint64_t featureDimension = mapping.getDimension();
+    if (featureDimension != quantized.getDimension() || sampleCount == 0) {
+        printf("Error: Features file '%s' does not match the quantized detector dimension %lu!\n", featuresFile.c_str(), (unsigned long) quantized.getDimension());
+        return;
+    }
+    const double rho = (descriptorVector.size() > featureDimension) ? descriptorVector[featureDimension] : 0.0;
+    vector<double> floatScores(sampleCount);
+    vector<double> quantizedScores(sampleCount);
+    for (uint64_t firstSample = 0; firstSample < sampleCount; firstSample += FEATURESTORE_CHUNK_SAMPLES) {
+        const uint64_t chunkSamples = min((uint64_t) FEATURESTORE_CHUNK_SAMPLES, sampleCount - firstSample);
+        const float* samples = mapping.getSample(firstSample);
+        denseGemv(samples, (long) chunkSamples, (long) featureDimension, &descriptorVector[0], rho, &floatScores[firstSample]);
+        parallel_for_(Range(0, (int) chunkSamples), QuantizedScoringBody(quantized, samples, featureDimension, &quantizedScores[firstSample]));
+        mapping.releaseSamples(firstSample, chunkSamples);
+    }
+    double maxDelta = 0.0;
+    double sumDelta = 0.0;
+    unsigned long flipped = 0;
+    unsigned long floatErrors = 0;
+    unsigned long quantizedErrors = 0;
+    for (uint64_t sample = 0; sample < sampleCount; ++sample) {
+        const bool positive = (mapping.getLabels()[sample] > 0);
+        const bool floatDetection = (floatScores[sample] >= hitThreshold);
+        const bool quantizedDetection = (quantizedScores[sample] >= hitThreshold);
+        const double delta = fabs(quantizedScores[sample] - floatScores[sample]);
+        maxDelta = max(maxDelta, delta);
+        sumDelta += delta;
+        flipped += (floatDetection != quantizedDetection);
+        floatErrors += (floatDetection != positive);
+        quantizedErrors += (quantizedDetection != positive);
+    }
+    printf("Quantized vs. float32 detector on %lu stored samples: score delta max %.6f, mean %.6f, %lu decisions changed\n",
+            (unsigned long) sampleCount, maxDelta, sumDelta / sampleCount, flipped);
+    printf("\tError rate float32 %.4f%%, quantized %.4f%% (delta %+.4f%%)\n", 100.0 * floatErrors / sampleCount, 100.0 * quantizedErrors / sampleCount,
+            100.0 * ((double) quantizedErrors - (double) floatErrors) / sampleCount);
+}
+
+/**
+ * Parallel loop body collecting the raw (ungrouped) window scores of the detector on validation images:
+ * the highest window score of every positive image and all window scores of every negative image
+ */
+class ThresholdSweepBody : public ParallelLoopBody {
+public:
+    /**
+     * @param _positiveFileNames positive validation images, enumerated first
+     * @param _negativeFileNames negative validation images, enumerated after the positive ones
+     * @param _hog HOGDescriptor with the detector set, copied per stripe
+     * @param _minScore lowest collected window score (raw score as returned by detectMultiScale)
+     * @param _imageScores resulting collected window scores per image, relative to _hitThreshold
+     * @param _hitThreshold detection threshold of the detector
+     */
+    ThresholdSweepBody(const vector<string>& _positiveFileNames, const vector<string>& _negativeFileNames, const HOGDescriptor& _hog, const double _minScore,
+            vector< vector<double> >& _imageScores, const double _hitThreshold)
+        : positiveFileNames(_positiveFileNames), negativeFileNames(_negativeFileNames), hog(_hog), minScore(_minScore), imageScores(_imageScores), hitThreshold(_hitThreshold) {
+    }
+
+    void operator()(const Range& range) const {
+        HOGDescriptor threadHog(hog); // One descriptor per worker
+        vector<Rect> found;
+        vector<double> foundWeights;
+        for (int imageIndex = range.start; imageIndex < range.end; ++imageIndex) {
+            const bool positiveImage = ((size_t) imageIndex < positiveFileNames.size());
+            const string& imageFileName = (positiveImage ? positiveFileNames.at(imageIndex) : negativeFileNames.at(imageIndex - positiveFileNames.size()));
+            const Mat imageData = imread(imageFileName, IMREAD_GRAYSCALE);
+            if (imageData.empty()) {
+                printf("Error: Image '%s' is empty, skipped for the threshold sweep!\n", imageFileName.c_str());
+                continue;
+            }
+            // Raw, ungrouped detections (final threshold 0)
+            threadHog.detectMultiScale(imageData, found, foundWeights, minScore, winStride, trainingPadding, 1.05, 0.0);
+            vector<double>& scores = imageScores.at(imageIndex);
+            if (positiveImage) {
+                if (!foundWeights.empty()) {
+                    scores.push_back(*max_element(foundWeights.begin(), foundWeights.end()) - hitThreshold);
+                }
+            } else {
+                for (size_t window = 0; window < foundWeights.size(); ++window) {
+                    scores.push_back(foundWeights[window] - hitThreshold);
+                }
+            }
+        }
+    }
+
+private:
+    const vector<string>& positiveFileNames;
+    const vector<string>& negativeFileNames;
+    const HOGDescriptor& hog;
+    const double minScore;
+    vector< vector<double> >& imageScores;
+    const double hitThreshold;
+};
+
+/**
+ * Collects the window scores of the detector on the validation set once and calculates miss rate and false positives per image
+ * for all thresholds from the sorted scores, instead of testing one threshold per run.
+ * A positive image counts as detected at a threshold if any of its windows scores above it,
+ * every window on a negative image scoring above it is a false positive.
+ * @param hog HOGDescriptor with the detector set
+ * @param hitThreshold detection threshold of the detector, scores in the DET curve are relative to it
+ * @param validExtensions
+ */
+static void sweepDetectionThreshold(const HOGDescriptor& hog, const double hitThreshold, const vector<string>& validExtensions) {
+    vector<string> positiveImages;
+    vector<string> negativeImages;
+    getFilesInDirectory(validationPosDir, positiveImages, validExtensions);
+    getFilesInDirectory(validationNegDir, negativeImages, validExtensions);
+    if (positiveImages.empty() || negativeImages.empty()) {
+        printf("Threshold sweep needs positive and negative validation images, skipping it\n");
+        return;
+    }
+    const int64 startTicks = getTickCount();
+    vector< vector<double> > imageScores(positiveImages.size() + negativeImages.size());
+    parallel_for_(Range(0, (int) imageScores.size()), ThresholdSweepBody(positiveImages, negativeImages, hog, hitThreshold + sweepMinScore, imageScores, hitThreshold));
+    vector<double> scores;
+    vector<char> positive;
+    for (size_t imageIndex = 0; imageIndex < imageScores.size(); ++imageIndex) {
+        scores.insert(scores.end(), imageScores[imageIndex].begin(), imageScores[imageIndex].end());
+        positive.resize(scores.size(), (imageIndex < positiveImages.size()));
+    }
+    vector<RocPoint> curve;
+    computeRocCurve(scores, positive, curve);
+    printf("Collected %lu window scores on %lu validation images in %.3f s\n", (unsigned long) scores.size(), (unsigned long) imageScores.size(), (getTickCount() - startTicks) / getTickFrequency());
+    // Operating point of the detector threshold (score 0)
+    RocPoint thresholdPoint;
+    thresholdPoint.threshold = 0.0;
+    thresholdPoint.truePositives = 0;
+    thresholdPoint.falsePositives = 0;
+    for (size_t point = 0; point < curve.size() && curve[point].threshold >= 0.0; ++point) {
+        thresholdPoint = curve[point];
+    }
+    printf("\tAt the detector threshold: miss rate %.4f at %.4f false positives per image\n",
+            1.0 - (double) thresholdPoint.truePositives / positiveImages.size(), (double) thresholdPoint.falsePositives / negativeImages.size());
+    const double fppiTargets[] = {0.01, 0.1, 1.0};
+    for (size_t target = 0; target < sizeof (fppiTargets) / sizeof (fppiTargets[0]); ++target) {
+        const RocPoint point = rocPointAtFalsePositives(curve, fppiTargets[target] * negativeImages.size());
+        printf("\tAt %.2f false positives per image: miss rate %.4f (threshold %+.5f)\n", fppiTargets[target], 1.0 - (double) point.truePositives / positiveImages.size(), point.threshold);
+    }
+    if (writeDetCurve(detCurveFile, curve, positiveImages.size(), negativeImages.size())) {
+        printf("DET curve saved to '%s'\n", detCurveFile.c_str());
+    }
+}
+
+/**
+ * Test detection with custom HOG description vector
+ * @param hog
+ * @param hitThreshold threshold value for detection
+ * @param imageData
+ */
+static void detectTest(const HOGDescriptor& hog, const double hitThreshold, Mat& imageData) {
+    vector<Rect> found;
+    vector<double> foundWeights;
+    detectWithScores(hog, hitThreshold, imageData, found, foundWeights);
+    showDetections(found, imageData);
+}
+
+/**
+ * A camera frame on its way through the live detection pipeline
+ */
+struct LiveFrame {
+    Mat image;
+    int64 captureTicks; // Tick count when the frame was captured, for measuring the latency
+    unsigned long sequenceNumber; // Consecutive number in the order the frames are taken up for detection
+};
+
+/**
+ * State shared by the stages of the live detection pipeline:
+ * 1. the capture thread grabs frames from the camera and drops the oldest waiting frame if detection falls behind,
+ * 2. detection threads convert and detect on the frames in flight, each one with its own copy of the HOGDescriptor,
+ * 3. the display (main thread) shows the frames in capture order with a FPS / latency overlay.
+ */
+struct LiveDetectionPipeline {
+    /**
+     * @param _capture opened camera
+     * @param _hog HOGDescriptor with the detector set
+     * @param _hitThreshold threshold value for detection
+     * @param _detectionThreads number of detection threads
+     */
+    LiveDetectionPipeline(VideoCapture& _capture, const HOGDescriptor& _hog, const double _hitThreshold, int _detectionThreads)
+        : capture(_capture), hog(_hog), hitThreshold(_hitThreshold), frameQueue(liveFrameQueueSize), resultQueue(2 * _detectionThreads),
+        nextSequenceNumber(0), droppedFrames(0) {
+        pthread_mutex_init(&sequenceMutex, NULL);
+        pthread_mutex_init(&statisticsMutex, NULL);
+    }
 
-// HOG parameters for training that for some reason are not included in the HOG class
-static const Size trainingPadding = Size(0, 0);
-static const Size winStride = Size(8, 8);
-// </editor-fold>
+    ~LiveDetectionPipeline() {
+        pthread_mutex_destroy(&statisticsMutex);
+        pthread_mutex_destroy(&sequenceMutex);
+    }
 
-// <editor-fold defaultstate="collapsed" desc="Helper functions">
-/* Helper functions */
+    /**
+     * Stops all stages, threads blocked in one of the queues return
+     */
+    void close() {
+        frameQueue.close();
+        resultQueue.close();
+    }
 
-static string toLowerCase(const string& in) {
-    string t;
-    for (string::const_iterator i = in.begin(); i != in.end(); ++i) {
-        t += tolower(*i);
+    unsigned long getDroppedFrames() {
+        pthread_mutex_lock(&statisticsMutex);
+        const unsigned long frames = droppedFrames;
+        pthread_mutex_unlock(&statisticsMutex);
+        return frames;
     }
-    return t;
-}
 
-static void storeCursor(void) {
-    printf("\033[s");
-}
+    VideoCapture& capture;
+    const HOGDescriptor& hog;
+    const double hitThreshold;
+    BoundedQueue<LiveFrame*> frameQueue; // capture -> detection
+    BoundedQueue<LiveFrame*> resultQueue; // detection -> display
+    pthread_mutex_t sequenceMutex; // Guards nextSequenceNumber, which is assigned together with taking a frame from frameQueue
+    unsigned long nextSequenceNumber;
+    pthread_mutex_t statisticsMutex; // Guards droppedFrames
+    unsigned long droppedFrames;
+};
 
-static void resetCursor(void) {
-    printf("\033[u");
+/**
+ * Capture stage: grabs camera frames as fast as the camera delivers them
+ * @param _pipeline LiveDetectionPipeline
+ * @return NULL
+ */
+static void* liveCaptureStage(void* _pipeline) {
+    LiveDetectionPipeline* pipeline = static_cast<LiveDetectionPipeline*> (_pipeline);
+    for (;;) {
+        LiveFrame* frame = new LiveFrame;
+        pipeline->capture >> frame->image; // get a new frame from camera
+        frame->captureTicks = getTickCount();
+        if (frame->image.empty()) {
+            printf("Camera delivered no frame, stopping live detection\n");
+            delete frame;
+            pipeline->close();
+            break;
+        }
+        LiveFrame* staleFrame = NULL;
+        bool queued;
+        if (pipeline->frameQueue.pushDroppingOldest(frame, staleFrame, queued)) {
+            delete staleFrame;
+            pthread_mutex_lock(&pipeline->statisticsMutex);
+            ++pipeline->droppedFrames;
+            pthread_mutex_unlock(&pipeline->statisticsMutex);
+        }
+        if (!queued) {
+            delete frame;
+            break;
+        }
+    }
+    return NULL;
 }
 
 /**
- * Saves the given descriptor vector to a file
- * @param descriptorVector the descriptor vector to save
- * @param _vectorIndices contains indices for the corresponding vector values (e.g. descriptorVector(0)=3.5f may have index 1)
- * @param fileName
- * @TODO Use _vectorIndices to write correct indices
+ * Detection stage: detects on the captured frames and draws the detections into them.
+ * With the OpenCL backend the block histograms are calculated on the device (@see detection/detectionengine.h),
+ * with the window stride, padding and scale of detectWithScores
+ * @param _pipeline LiveDetectionPipeline
+ * @return NULL
  */
-static void saveDescriptorVectorToFile(vector<float>& descriptorVector, vector<unsigned int>& _vectorIndices, string fileName) {
-    printf("Saving descriptor vector to file '%s'\n", fileName.c_str());
-    string separator = " "; // Use blank as default separator between single features
-    fstream File;
-    float percent;
-    File.open(fileName.c_str(), ios::out);
-    if (File.good() && File.is_open()) {
-        printf("Saving %lu descriptor vector features:\t", descriptorVector.size());
-        storeCursor();
-        for (int feature = 0; feature < descriptorVector.size(); ++feature) {
-            if ((feature % 10 == 0) || (feature == (descriptorVector.size()-1)) ) {
-                percent = ((1 + feature) * 100 / descriptorVector.size());
-                printf("%4u (%3.0f%%)", feature, percent);
-                fflush(stdout);
-                resetCursor();
-            }
-            File << descriptorVector.at(feature) << separator;
+static void* liveDetectionStage(void* _pipeline) {
+    LiveDetectionPipeline* pipeline = static_cast<LiveDetectionPipeline*> (_pipeline);
+    HOGDescriptor threadHog(pipeline->hog); // One descriptor per worker
+    OpenCLHog accelerator(threadHog);
+    DetectionEngine engine(threadHog, pipeline->hitThreshold, Size(8, 8), Size(8, 8), 1.05);
+    engine.setAccelerator(&accelerator);
+    vector< vector<Rect> > windows;
+    vector< vector<double> > windowWeights;
+    vector<Rect> found;
+    vector<double> foundWeights;
+    for (;;) {
+        LiveFrame* frame;
+        pthread_mutex_lock(&pipeline->sequenceMutex);
+        const bool available = pipeline->frameQueue.pop(frame);
+        if (available) {
+            frame->sequenceNumber = pipeline->nextSequenceNumber++;
+        }
+        pthread_mutex_unlock(&pipeline->sequenceMutex);
+        if (!available) {
+            break;
+        }
+        cvtColor(frame->image, frame->image, CV_BGR2GRAY); // Work on grayscale images as trained
+        if (OpenCLHog::isEnabled() && engine.getModelCount() > 0) {
+            engine.setImage(frame->image);
+            engine.detect(windows, windowWeights);
+            found.clear();
+            foundWeights.clear();
+            appendSuppressedDetections(windows[0], windowWeights[0], found, foundWeights);
+            showDetections(found, frame->image);
+        } else {
+            detectTest(threadHog, pipeline->hitThreshold, frame->image);
+        }
+        if (!pipeline->resultQueue.push(frame)) {
+            delete frame;
+            break;
         }
-        printf("\n");
-        File << endl;
-        File.flush();
-        File.close();
     }
+    return NULL;
 }
 
 /**
- * For unixoid systems only: Lists all files in a given directory and returns a vector of path+name in string format
- * @param dirName
- * @param fileNames found file names in specified directory
- * @param validExtensions containing the valid file extensions for collection in lower case
+ * Live detection on camera frames, capture, detection and display run in parallel (@see LiveDetectionPipeline),
+ * so the frame rate is bounded by the slowest stage instead of the sum of all stages. Stops on ESC.
+ * @param hog HOGDescriptor with the detector set
+ * @param hitThreshold threshold value for detection
+ * @param capture opened camera
  */
-static void getFilesInDirectory(const string& dirName, vector<string>& fileNames, const vector<string>& validExtensions) {
-    printf("Opening directory %s\n", dirName.c_str());
-#ifdef __MINGW32__
-	struct stat s;
-#endif
-    struct dirent* ep;
-    size_t extensionLocation;
-    DIR* dp = opendir(dirName.c_str());
-    if (dp != NULL) {
-        while ((ep = readdir(dp))) {
-            // Ignore (sub-)directories like . , .. , .svn, etc.
-#ifdef __MINGW32__	
-			stat(ep->d_name, &s);
-			if (s.st_mode & S_IFDIR) {
-				continue;
-			}
-#else
-            if (ep->d_type & DT_DIR) {
-                continue;
+static void liveDetection(const HOGDescriptor& hog, const double hitThreshold, VideoCapture& capture) {
+    const int detectionThreads = (liveDetectionThreads > 0) ? liveDetectionThreads : getNumThreads();
+    printf("Using %d detection threads, press ESC to stop\n", detectionThreads);
+    LiveDetectionPipeline pipeline(capture, hog, hitThreshold, detectionThreads);
+    vector<pthread_t> pipelineThreads;
+    for (int thread = 0; thread < 1 + detectionThreads; ++thread) {
+        pthread_t threadId;
+        if (pthread_create(&threadId, NULL, (thread == 0) ? liveCaptureStage : liveDetectionStage, &pipeline) != 0) {
+            printf("Error starting live detection thread!\n");
+            pipeline.close();
+            break;
+        }
+        pipelineThreads.push_back(threadId);
+    }
+    // Frames detected ahead of the next one to show
+    map<unsigned long, LiveFrame*> pendingFrames;
+    unsigned long nextFrame = 0;
+    int64 lastDisplayTicks = 0;
+    double framesPerSecond = 0.0;
+    bool running = true;
+    LiveFrame* detectedFrame;
+    while (running && pipeline.resultQueue.pop(detectedFrame)) {
+        pendingFrames[detectedFrame->sequenceNumber] = detectedFrame;
+        map<unsigned long, LiveFrame*>::iterator next;
+        while (running && (next = pendingFrames.find(nextFrame)) != pendingFrames.end()) {
+            LiveFrame* frame = next->second;
+            pendingFrames.erase(next);
+            ++nextFrame;
+            const int64 displayTicks = getTickCount();
+            if (lastDisplayTicks != 0 && displayTicks > lastDisplayTicks) {
+                // Exponentially smoothed frame rate
+                const double currentFramesPerSecond = getTickFrequency() / (displayTicks - lastDisplayTicks);
+                framesPerSecond = (framesPerSecond > 0.0) ? 0.9 * framesPerSecond + 0.1 * currentFramesPerSecond : currentFramesPerSecond;
             }
-#endif
-            extensionLocation = string(ep->d_name).find_last_of("."); // Assume the last point marks beginning of extension like file.ext
-            // Check if extension is matching the wanted ones
-            string tempExt = toLowerCase(string(ep->d_name).substr(extensionLocation + 1));
-            if (find(validExtensions.begin(), validExtensions.end(), tempExt) != validExtensions.end()) {
-                printf("Found matching data file '%s'\n", ep->d_name);
-                fileNames.push_back((string) dirName + ep->d_name);
-            } else {
-                printf("Found file does not match required file type, skipping: '%s'\n", ep->d_name);
+            lastDisplayTicks = displayTicks;
+            char overlay[128];
+            snprintf(overlay, sizeof (overlay), "%.1f FPS, latency %.0f ms, %lu frames dropped", framesPerSecond,
+                    1000.0 * (displayTicks - frame->captureTicks) / getTickFrequency(), pipeline.getDroppedFrames());
+            putText(frame->image, overlay, Point(10, 20), FONT_HERSHEY_SIMPLEX, 0.5, Scalar(255), 1);
+            imshow("HOG custom detection", frame->image);
+            delete frame;
+            if ((waitKey(1) & 255) == 27) {
+                running = false;
             }
         }
-        (void) closedir(dp);
-    } else {
-        printf("Error opening directory '%s'!\n", dirName.c_str());
     }
-    return;
+    pipeline.close();
+    for (size_t thread = 0; thread < pipelineThreads.size(); ++thread) {
+        pthread_join(pipelineThreads.at(thread), NULL);
+    }
+    for (map<unsigned long, LiveFrame*>::iterator frame = pendingFrames.begin(); frame != pendingFrames.end(); ++frame) {
+        delete frame->second;
+    }
+    while (pipeline.frameQueue.pop(detectedFrame) || pipeline.resultQueue.pop(detectedFrame)) {
+        delete detectedFrame;
+    }
+    printf("Live detection stopped after %lu frames, %lu frames dropped\n", nextFrame, pipeline.getDroppedFrames());
 }
 
 /**
- * This is the actual calculation from the (input) image data to the HOG descriptor/feature vector using the hog.compute() function
- * @param imageFilename file path of the image file to read and calculate feature vector from
- * @param descriptorVector the returned calculated feature vector<float> , 
- *      I can't comprehend why openCV implementation returns std::vector<float> instead of cv::MatExpr_<float> (e.g. Mat<float>)
- * @param hog HOGDescriptor containin HOG settings
+ * Escapes a string for use as JSON string value
+ * @param in
+ * @return escaped string without enclosing quotes
  */
-static void calculateFeaturesFromInput(const string& imageFilename, vector<float>& featureVector, HOGDescriptor& hog) {
-    /** for imread flags from openCV documentation, 
-     * @see http://docs.opencv.org/modules/highgui/doc/reading_and_writing_images_and_video.html?highlight=imread#Mat imread(const string& filename, int flags)
-     * @note If you get a compile-time error complaining about following line (esp. imread),
-     * you either do not have a current openCV version (>2.0) 
-     * or the linking order is incorrect, try g++ -o openCVHogTrainer main.cpp `pkg-config --cflags --libs opencv`
+static string jsonEscape(const string& in) {
+    string out;
+    out.reserve(in.size());
+    for (size_t i = 0; i < in.size(); ++i) {
+        const unsigned char c = in[i];
+        if (c == '"' || c == '\\') {
+            out += '\\';
+            out += c;
+        } else if (c < 0x20) {
+            char escaped[8];
+            snprintf(escaped, sizeof (escaped), "\\u%04x", c);
+            out += escaped;
+        } else {
+            out += c;
+        }
+    }
+    return out;
+}
+
+/**
+ * An image or video frame on its way through the batch detection pipeline
+ */
+struct BatchDetectionItem {
+    string source; // Image or video file
+    long frame; // Frame number within the video, -1 for images
+    Mat image; // Decoded video frame, images are read by the detection threads
+    vector<Rect> found;
+    vector<double> foundWeights;
+    vector<size_t> foundModels; // Detecting model per detection window
+};
+
+/**
+ * State shared by the stages of the batch detection pipeline:
+ * 1. the reader thread enumerates the input images and decodes video files frame by frame,
+ * 2. detection threads read the images and detect with all models, each one with its own DetectionEngine,
+ * 3. the writer (main thread) writes the detections as JSON lines as they finish, each line names its source and frame.
+ */
+struct BatchDetectionPipeline {
+    /**
+     * @param _inputFiles image and video files to detect on
+     * @param _models HOGDescriptors with the detectors loaded, all with the same HOG parameters
+     * @param _hitThresholds threshold value for detection per model
+     * @param _regionsOfInterest regions to detect in, empty for the complete images
+     * @param _detectionThreads number of detection threads
      */
-    Mat imageData = imread(imageFilename, IMREAD_GRAYSCALE);
-    if (imageData.empty()) {
-        featureVector.clear();
-        printf("Error: HOG image '%s' is empty, features calculation skipped!\n", imageFilename.c_str());
-        return;
+    BatchDetectionPipeline(const vector<string>& _inputFiles, const vector<HOGDescriptor>& _models, const vector<double>& _hitThresholds, const vector<Rect>& _regionsOfInterest, int _detectionThreads)
+        : inputFiles(_inputFiles), models(_models), hitThresholds(_hitThresholds), regionsOfInterest(_regionsOfInterest), jobQueue(2 * _detectionThreads), resultQueue(2 * _detectionThreads), runningDetectionThreads(_detectionThreads) {
+        pthread_mutex_init(&mutex, NULL);
     }
-    // Check for mismatching dimensions
-    if (imageData.cols != hog.winSize.width || imageData.rows != hog.winSize.height) {
-        featureVector.clear();
-        printf("Error: Image '%s' dimensions (%u x %u) do not match HOG window size (%u x %u)!\n", imageFilename.c_str(), imageData.cols, imageData.rows, hog.winSize.width, hog.winSize.height);
-        return;
+
+    ~BatchDetectionPipeline() {
+        pthread_mutex_destroy(&mutex);
     }
-    vector<Point> locations;
-    hog.compute(imageData, featureVector, winStride, trainingPadding, locations);
-    imageData.release(); // Release the image again after features are extracted
-}
+
+    const vector<string>& inputFiles;
+    const vector<HOGDescriptor>& models;
+    const vector<double>& hitThresholds;
+    const vector<Rect>& regionsOfInterest;
+    BoundedQueue<BatchDetectionItem*> jobQueue; // reader -> detection
+    BoundedQueue<BatchDetectionItem*> resultQueue; // detection -> writer
+    pthread_mutex_t mutex; // Guards runningDetectionThreads
+    int runningDetectionThreads; // The last detection thread to finish closes resultQueue
+};
 
 /**
- * Shows the detections in the image
- * @param found vector containing valid detection rectangles
- * @param imageData the image in which the detections are drawn
+ * Checks by its extension whether a file is a video file (and not an image)
+ * @param fileName
+ * @return
  */
-static void showDetections(const vector<Point>& found, Mat& imageData) {
-    size_t i, j;
-    for (i = 0; i < found.size(); ++i) {
-        Point r = found[i];
-        // Rect_(_Tp _x, _Tp _y, _Tp _width, _Tp _height);
-        rectangle(imageData, Rect(r.x-16, r.y-32, 32, 64), Scalar(64, 255, 64), 3);
+static bool isVideoFile(const string& fileName) {
+    static const char* videoExtensions[] = {"avi", "mp4", "m4v", "mkv", "mov", "mpg", "mpeg", "wmv", "webm"};
+    const size_t extensionLocation = fileName.find_last_of(".");
+    const string extension = (extensionLocation != string::npos) ? toLowerCase(fileName.substr(extensionLocation + 1)) : "";
+    for (size_t i = 0; i < sizeof (videoExtensions) / sizeof (videoExtensions[0]); ++i) {
+        if (extension == videoExtensions[i]) {
+            return true;
+        }
     }
+    return false;
 }
 
 /**
- * Shows the detections in the image
- * @param found vector containing valid detection rectangles
- * @param imageData the image in which the detections are drawn
+ * Reader stage: passes images on by file name, decodes videos frame by frame (video decoding cannot be parallelized)
+ * @param _pipeline BatchDetectionPipeline
+ * @return NULL
  */
-static void showDetections(const vector<Rect>& found, Mat& imageData) {
-    vector<Rect> found_filtered;
-    size_t i, j;
-    for (i = 0; i < found.size(); ++i) {
-        Rect r = found[i];
-        for (j = 0; j < found.size(); ++j)
-            if (j != i && (r & found[j]) == r)
+static void* batchReaderStage(void* _pipeline) {
+    BatchDetectionPipeline* pipeline = static_cast<BatchDetectionPipeline*> (_pipeline);
+    for (size_t file = 0; file < pipeline->inputFiles.size(); ++file) {
+        const string& inputFile = pipeline->inputFiles.at(file);
+        if (!isVideoFile(inputFile)) {
+            BatchDetectionItem* item = new BatchDetectionItem;
+            item->source = inputFile;
+            item->frame = -1;
+            if (!pipeline->jobQueue.push(item)) {
+                delete item;
                 break;
-        if (j == found.size())
-            found_filtered.push_back(r);
-    }
-    for (i = 0; i < found_filtered.size(); i++) {
-        Rect r = found_filtered[i];
-        rectangle(imageData, r.tl(), r.br(), Scalar(64, 255, 64), 3);
+            }
+            continue;
+        }
+        VideoCapture video(inputFile);
+        if (!video.isOpened()) {
+            fprintf(stderr, "Error opening video file '%s'!\n", inputFile.c_str());
+            continue;
+        }
+        Mat frame;
+        for (long frameNumber = 0; video.read(frame); ++frameNumber) {
+            BatchDetectionItem* item = new BatchDetectionItem;
+            item->source = inputFile;
+            item->frame = frameNumber;
+            item->image = frame.clone(); // The capture reuses its frame buffer
+            if (!pipeline->jobQueue.push(item)) {
+                delete item;
+                break;
+            }
+        }
     }
+    pipeline->jobQueue.close();
+    return NULL;
 }
 
 /**
- * Test the trained detector against the same training set to get an approximate idea of the detector.
- * Warning: This does not allow any statement about detection quality, as the detector might be overfitting.
- * Detector quality must be determined using an independent test set.
- * @param hog
+ * Detection stage: reads the images (or takes the decoded video frames) and detects on them,
+ * the image pyramid and block histograms of an image are calculated once and all models score the windows together (@see detection/detectionengine.h)
+ * @param _pipeline BatchDetectionPipeline
+ * @return NULL
  */
-static void detectTrainingSetTest(const HOGDescriptor& hog, const double hitThreshold, const vector<string>& posFileNames, const vector<string>& negFileNames) {
-    unsigned int truePositives = 0;
-    unsigned int trueNegatives = 0;
-    unsigned int falsePositives = 0;
-    unsigned int falseNegatives = 0;
-    vector<Point> foundDetection;
-    // Walk over positive training samples, generate images and detect
-    for (vector<string>::const_iterator posTrainingIterator = posFileNames.begin(); posTrainingIterator != posFileNames.end(); ++posTrainingIterator) {
-        const Mat imageData = imread(*posTrainingIterator, IMREAD_GRAYSCALE);
-        hog.detect(imageData, foundDetection, hitThreshold, winStride, trainingPadding);
-        if (foundDetection.size() > 0) {
-            ++truePositives;
-            falseNegatives += foundDetection.size() - 1;
+static void* batchDetectionStage(void* _pipeline) {
+    BatchDetectionPipeline* pipeline = static_cast<BatchDetectionPipeline*> (_pipeline);
+    DetectionEngine engine(pipeline->models.at(0), pipeline->hitThresholds.at(0), Size(8, 8), Size(8, 8), 1.05); // One engine per worker
+    for (size_t model = 1; model < pipeline->models.size(); ++model) {
+        engine.addModel(pipeline->models.at(model).svmDetector, pipeline->hitThresholds.at(model));
+    }
+    OpenCLHog accelerator(pipeline->models.at(0)); // Used by the engine if the OpenCL backend is enabled
+    engine.setAccelerator(&accelerator);
+    engine.setRegionsOfInterest(pipeline->regionsOfInterest);
+    vector< vector<Rect> > windows;
+    vector< vector<double> > windowWeights;
+    BatchDetectionItem* item;
+    while (pipeline->jobQueue.pop(item)) {
+        if (item->frame < 0) {
+            item->image = imread(item->source, IMREAD_GRAYSCALE);
+        } else if (item->image.channels() == 3) {
+            cvtColor(item->image, item->image, CV_BGR2GRAY); // Work on grayscale images as trained
+        }
+        if (item->image.empty()) {
+            fprintf(stderr, "Error: Image '%s' is empty, skipped for detection!\n", item->source.c_str());
         } else {
-            ++falseNegatives;
+            engine.setImage(item->image);
+            engine.detect(windows, windowWeights); // All models in one sweep
+            for (size_t model = 0; model < windows.size(); ++model) {
+                appendSuppressedDetections(windows[model], windowWeights[model], item->found, item->foundWeights);
+                item->foundModels.resize(item->found.size(), model);
+            }
+        }
+        if (!pipeline->resultQueue.push(item)) {
+            delete item;
         }
     }
-    // Walk over negative training samples, generate images and detect
-    for (vector<string>::const_iterator negTrainingIterator = negFileNames.begin(); negTrainingIterator != negFileNames.end(); ++negTrainingIterator) {
-        const Mat imageData = imread(*negTrainingIterator, IMREAD_GRAYSCALE);
-        hog.detect(imageData, foundDetection, hitThreshold, winStride, trainingPadding);
-        if (foundDetection.size() > 0) {
-            falsePositives += foundDetection.size();
-        } else {
-            ++trueNegatives;
-        }        
+    pthread_mutex_lock(&pipeline->mutex);
+    if (--pipeline->runningDetectionThreads == 0) {
+        pipeline->resultQueue.close();
     }
-    
-    printf("Results:\n\tTrue Positives: %u\n\tTrue Negatives: %u\n\tFalse Positives: %u\n\tFalse Negatives: %u\n", truePositives, trueNegatives, falsePositives, falseNegatives);
+    pthread_mutex_unlock(&pipeline->mutex);
+    return NULL;
 }
 
 /**
- * Test detection with custom HOG description vector
- * @param hog
- * @param hitThreshold threshold value for detection
- * @param imageData
+ * Headless batch detection: loads the saved HOG detector (or several detectors trained with the same HOG parameters)
+ * and detects on image files, video files and directories of them, without training and without opening any window.
+ * Usage: --detect [--model <file>]... [--roi <x>,<y>,<w>,<h>]... [--threshold <value>] [--threads <number>] [--output <file>|-] [--recursive] [--opencl] <image|video|directory>...
+ * @param argc number of arguments following --detect
+ * @param argv arguments following --detect
+ * @return EXIT_SUCCESS (0) or EXIT_FAILURE (1)
  */
-static void detectTest(const HOGDescriptor& hog, const double hitThreshold, Mat& imageData) {
-    vector<Rect> found;
-    Size padding(Size(8, 8));
-    Size winStride(Size(8, 8));
-    hog.detectMultiScale(imageData, found, hitThreshold, winStride, padding);
-    showDetections(found, imageData);
+static int batchDetection(int argc, char** argv) {
+    string outputFile = batchDetectionsFile;
+    int detectionThreads = getNumThreads();
+    bool thresholdGiven = false;
+    double hitThreshold = 0.0;
+    vector<string> modelFiles;
+    vector<Rect> regionsOfInterest;
+    vector<string> inputPaths;
+    for (int arg = 0; arg < argc; ++arg) {
+        const string option = argv[arg];
+        if (option == "--model" && arg + 1 < argc) {
+            modelFiles.push_back(argv[++arg]);
+        } else if (option == "--roi" && arg + 1 < argc) {
+            Rect roi;
+            if (sscanf(argv[++arg], "%d,%d,%d,%d", &roi.x, &roi.y, &roi.width, &roi.height) != 4 || roi.width <= 0 || roi.height <= 0) {
+                fprintf(stderr, "Error: Invalid region of interest '%s'!\n", argv[arg]);
+                return EXIT_FAILURE;
+            }
+            regionsOfInterest.push_back(roi);
+        } else if (option == "--threshold" && arg + 1 < argc) {
+            hitThreshold = atof(argv[++arg]);
+            thresholdGiven = true;
+        } else if (option == "--threads" && arg + 1 < argc) {
+            detectionThreads = max(atoi(argv[++arg]), 1);
+        } else if (option == "--output" && arg + 1 < argc) {
+            outputFile = argv[++arg];
+        } else if (option == "--recursive") {
+            recursiveDirectoryScan = true;
+        } else if (option == "--opencl") {
+            useOpenCL = true;
+        } else {
+            inputPaths.push_back(option);
+        }
+    }
+
+    if (modelFiles.empty()) {
+        modelFiles.push_back(cvHOGFile);
+    }
+    vector<HOGDescriptor> models(modelFiles.size());
+    vector<double> hitThresholds(modelFiles.size(), hitThreshold);
+    for (size_t model = 0; model < modelFiles.size(); ++model) {
+        if (!models.at(model).load(modelFiles.at(model))) {
+            fprintf(stderr, "Error loading HOG detector from '%s'!\n", modelFiles.at(model).c_str());
+            return EXIT_FAILURE;
+        }
+        const FeatureStoreHogParams modelParams = getFeatureStoreHogParams(models.at(model));
+        const FeatureStoreHogParams firstParams = getFeatureStoreHogParams(models.at(0));
+        if (memcmp(&modelParams, &firstParams, sizeof (modelParams)) != 0) {
+            fprintf(stderr, "Error: HOG parameters of '%s' differ from '%s', models cannot share the calculated features!\n", modelFiles.at(model).c_str(), modelFiles.at(0).c_str());
+            return EXIT_FAILURE;
+        }
+        if (!thresholdGiven) {
+            // Saved next to the HOG parameters after training
+            FileStorage hogFile(modelFiles.at(model), FileStorage::READ);
+            const FileNode thresholdNode = hogFile["hitThreshold"];
+            hitThresholds.at(model) = thresholdNode.empty() ? 0.0 : (double) thresholdNode;
+        }
+    }
+
+    if (useOpenCL) {
+        initializeOpenCL(models.at(0));
+    }
+
+    vector<string> validExtensions;
+    validExtensions.push_back("jpg");
+    validExtensions.push_back("png");
+    validExtensions.push_back("ppm");
+    validExtensions.push_back("avi");
+    validExtensions.push_back("mp4");
+    validExtensions.push_back("mkv");
+    validExtensions.push_back("mov");
+    vector<string> inputFiles;
+    for (size_t path = 0; path < inputPaths.size(); ++path) {
+        struct stat pathStatus;
+        if (stat(inputPaths.at(path).c_str(), &pathStatus) == 0 && S_ISDIR(pathStatus.st_mode)) {
+            const string& directory = inputPaths.at(path);
+            getFilesInDirectory(directory + ((directory[directory.size() - 1] != '/') ? "/" : ""), inputFiles, validExtensions);
+        } else {
+            inputFiles.push_back(inputPaths.at(path));
+        }
+    }
+    if (inputFiles.empty()) {
+        fprintf(stderr, "Usage: --detect [--model <file>]... [--roi <x>,<y>,<w>,<h>]... [--threshold <value>] [--threads <number>] [--output <file>|-] [--recursive] [--opencl] <image|video|directory>...\n");
+        return EXIT_FAILURE;
+    }
+
+    FILE* output = (outputFile == "-") ? stdout : fopen(outputFile.c_str(), "w");
+    if (output == NULL) {
+        fprintf(stderr, "Error opening file '%s'!\n", outputFile.c_str());
+        return EXIT_FAILURE;
+    }
+    fprintf(stderr, "Detecting on %lu input files using %d threads and %lu models in %lu regions of interest\n", (unsigned long) inputFiles.size(), detectionThreads,
+            (unsigned long) models.size(), (unsigned long) regionsOfInterest.size());
+    for (size_t model = 0; model < models.size(); ++model) {
+        fprintf(stderr, "Model %lu '%s', hit threshold %.5f\n", (unsigned long) model, modelFiles.at(model).c_str(), hitThresholds.at(model));
+    }
+    const int64 startTicks = getTickCount();
+    BatchDetectionPipeline pipeline(inputFiles, models, hitThresholds, regionsOfInterest, detectionThreads);
+    vector<pthread_t> pipelineThreads;
+    for (int thread = 0; thread < 1 + detectionThreads; ++thread) {
+        pthread_t threadId;
+        if (pthread_create(&threadId, NULL, (thread == 0) ? batchReaderStage : batchDetectionStage, &pipeline) != 0) {
+            fprintf(stderr, "Error starting batch detection thread!\n");
+            // The missing detection threads never finish, close the queues in their place
+            pipeline.jobQueue.close();
+            pipeline.resultQueue.close();
+            break;
+        }
+        pipelineThreads.push_back(threadId);
+    }
+    unsigned long images = 0;
+    unsigned long detections = 0;
+    BatchDetectionItem* item;
+    while (pipeline.resultQueue.pop(item)) {
+        fprintf(output, "{\"source\":\"%s\",\"frame\":%ld,\"width\":%d,\"height\":%d,\"detections\":[", jsonEscape(item->source).c_str(), item->frame, item->image.cols, item->image.rows);
+        for (size_t detection = 0; detection < item->found.size(); ++detection) {
+            const Rect& r = item->found[detection];
+            char score[32]; // Decimal point independent of the locale
+            score[formatFloat((detection < item->foundWeights.size()) ? (float) item->foundWeights[detection] : 0.0f, score)] = '\0';
+            fprintf(output, "%s{\"model\":%lu,\"x\":%d,\"y\":%d,\"w\":%d,\"h\":%d,\"score\":%s}", (detection > 0) ? "," : "", (unsigned long) item->foundModels[detection],
+                    r.x, r.y, r.width, r.height, score);
+        }
+        fprintf(output, "]}\n");
+        ++images;
+        detections += item->found.size();
+        delete item;
+    }
+    for (size_t thread = 0; thread < pipelineThreads.size(); ++thread) {
+        pthread_join(pipelineThreads.at(thread), NULL);
+    }
+    const bool success = (output == stdout) ? (fflush(output) == 0) : (fclose(output) == 0);
+    const double seconds = (getTickCount() - startTicks) / getTickFrequency();
+    fprintf(stderr, "%lu detections on %lu images / frames in %.3f s (%.1f images per second)\n", detections, images, seconds, (seconds > 0.0) ? images / seconds : 0.0);
+    return success ? EXIT_SUCCESS : EXIT_FAILURE;
 }
 // </editor-fold>
 
 /**
  * Main program entry point
- * @param argc unused
- * @param argv unused
+ * @param argc
+ * @param argv no arguments to train and test, --detect ... for headless batch detection with the saved detector (@see batchDetection)
  * @return EXIT_SUCCESS (0) or EXIT_FAILURE (1)
  */
 int main(int argc, char** argv) {
+    /// @WARNING: This is really important, some libraries (e.g. ROS) seems to set the system locale which takes decimal commata instead of points which causes the model file parsing to fail
+    // Set once before any thread is started, as setlocale is not thread-safe
+    setlocale(LC_NUMERIC, "C");
+    if (argc > 1 && string(argv[1]) == "--detect") {
+        return batchDetection(argc - 2, argv + 2);
+    }
 
     // <editor-fold defaultstate="collapsed" desc="Init">
     HOGDescriptor hog; // Use standard parameters here
     hog.winSize = Size(64, 128); // Default training images size as used in paper
     // Get the files to train from somewhere
-    static vector<string> positiveTrainingImages;
-    static vector<string> negativeTrainingImages;
+    static FileNameList positiveTrainingImages;
+    static FileNameList negativeTrainingImages;
     static vector<string> validExtensions;
     validExtensions.push_back("jpg");
     validExtensions.push_back("png");
     validExtensions.push_back("ppm");
+    RunMetrics runMetrics;
+    runMetrics.setValue("svm", string(TRAINHOG_SVM_TO_TRAIN::getInstance()->getSVMName()));
     // </editor-fold>
 
     // <editor-fold defaultstate="collapsed" desc="Read image files">
-    getFilesInDirectory(posSamplesDir, positiveTrainingImages, validExtensions);
-    getFilesInDirectory(negSamplesDir, negativeTrainingImages, validExtensions);
+    double stageStart = RunMetrics::now();
+    if (!trainingManifestFile.empty()) {
+        printf("Reading training samples from manifest '%s'\n", trainingManifestFile.c_str());
+        if (!readManifest(trainingManifestFile, positiveTrainingImages, negativeTrainingImages)) {
+            return EXIT_FAILURE;
+        }
+    } else {
+        getFilesInDirectory(posSamplesDir, positiveTrainingImages, validExtensions);
+        getFilesInDirectory(negSamplesDir, negativeTrainingImages, validExtensions);
+    }
+    // Full-size negative images, negative windows are sampled from
+    static vector<string> negativeWindowImages;
+    if (negativeWindowsPerImage > 0) {
+        getFilesInDirectory(fullNegativeImagesDir, negativeWindowImages, validExtensions);
+    }
     /// Retrieve the descriptor vectors from the samples
     unsigned long overallSamples = positiveTrainingImages.size() + negativeTrainingImages.size();
+    // Upper bound of the number of negative windows
+    const unsigned long maxNegativeWindows = negativeWindowImages.size() * negativeWindowsPerImage;
+    runMetrics.stopStage("directory_scan", stageStart, overallSamples + negativeWindowImages.size());
     // </editor-fold>
     
     // <editor-fold defaultstate="collapsed" desc="Calculate HOG features and save to file">
     // Make sure there are actually samples to train
-    if (overallSamples == 0) {
+    if (overallSamples + maxNegativeWindows == 0) {
         printf("No training sample files found, nothing to do!\n");
         return EXIT_SUCCESS;
     }
 
-    /// @WARNING: This is really important, some libraries (e.g. ROS) seems to set the system locale which takes decimal commata instead of points which causes the file input parsing to fail
-    setlocale(LC_ALL, "C"); // Do not use the system locale
-    setlocale(LC_NUMERIC,"C");
-    setlocale(LC_ALL, "POSIX");
+    if (useOpenCL) {
+        runMetrics.setValue("opencl_device", initializeOpenCL(hog) ? OpenCLHog::getDeviceName() : string());
+    }
 
     printf("Reading files, generating HOG features and save them to file '%s':\n", featuresFile.c_str());
     float percent;
     /**
-     * Save the calculated descriptor vectors to a file in a format that can be used by SVMlight for training
+     * Save the calculated descriptor vectors to a binary feature store that can be read by the SVM wrappers for training
      * @NOTE: If you split these steps into separate steps: 
      * 1. calculating features into memory (e.g. into a cv::Mat or vector< vector<float> >), 
      * 2. saving features to file / directly inject from memory to machine learning algorithm,
      * the program may consume a considerable amount of main memory
      */ 
-    fstream File;
-    File.open(featuresFile.c_str(), ios::out);
-    if (File.good() && File.is_open()) {
-        #if TRAINHOG_USEDSVM == SVMLIGHT
-            // Remove following line for libsvm which does not support comments
-            File << "# Use this file to train, e.g. SVMlight by issuing $ svm_learn -i 1 -a weights.txt " << featuresFile.c_str() << endl;
-        #endif
-        // Iterate over sample images
-        for (unsigned long currentFile = 0; currentFile < overallSamples; ++currentFile) {
+    const unsigned long featureDimension = hog.getDescriptorSize();
+    // Hard negative mining appends to the features file and retrains from it
+    const bool writeFeaturesFile = (cacheFeaturesToFile || !trainFromMemory || hardNegativeMiningRounds > 0);
+    FeatureStoreWriter featureStore;
+    // Upper bound of the number of samples including the augmented positives and the sampled negative windows
+    const unsigned long maxSamples = overallSamples + positiveTrainingImages.size() * (getPositiveVariantCount() - 1) + maxNegativeWindows;
+    if (writeFeaturesFile && !featureStore.open(featuresFile, featureDimension, maxSamples, getFeatureStoreHogParams(hog))) {
+        return EXIT_FAILURE;
+    }
+    // Labels and row-major feature matrix of all valid samples for training from memory
+    vector<float> trainingLabels;
+    vector<float> trainingFeatures;
+    if (trainFromMemory) {
+        // Only the samples of the image files, the sampled negative windows (at most maxNegativeWindows) grow the vectors as they are added
+        const unsigned long pipelineSamples = positiveTrainingImages.size() * getPositiveVariantCount() + negativeTrainingImages.size();
+        trainingLabels.reserve(pipelineSamples);
+        // Rows of all pipeline samples, filled by the compute threads in place and compacted by the writer if samples fail
+        trainingFeatures.resize(pipelineSamples * featureDimension);
+    }
+    // Numbers are formatted independent of the system locale, which some libraries (e.g. ROS) set to decimal commata
+    SvmLightWriter textWriter;
+    if (exportTextFeatures) {
+        if (!textWriter.open(featuresTextFile)) {
+            return EXIT_FAILURE;
+        }
+#if TRAINHOG_USEDSVM == SVMLIGHT
+        // Remove following line for libsvm which does not support comments
+        textWriter.writeComment("Use this file to train, e.g. SVMlight by issuing $ svm_learn -i 1 -a weights.txt " + featuresTextFile);
+#endif
+    }
+    if (extractionThreads > 0) {
+        setNumThreads(extractionThreads);
+    }
+    const int workerThreads = getNumThreads();
+    printf("Using %d prefetch and %d worker threads for feature extraction\n", prefetchThreads, workerThreads);
+    FeatureCache featureCache;
+    if (!featureCacheDir.empty()) {
+        if (featureCache.open(featureCacheDir, featureDimension, getFeatureStoreHogParams(hog))) {
+            printf("Using feature cache '%s' containing %lu samples\n", featureCache.getFileName().c_str(), (unsigned long) featureCache.getCount());
+        } else {
+            printf("Warning: Continuing without feature cache\n");
+        }
+    }
+    unsigned long cachedSamples = 0;
+    unsigned long augmentedSamples = 0; // Feature vectors of augmented variants, in addition to one per sample
+    const double extractionStart = RunMetrics::now();
+    double readSeconds = 0.0, decodeSeconds = 0.0, computeSeconds = 0.0, writeSeconds = 0.0;
+    uint64_t readBytes = 0;
+    unsigned long calculatedSamples = 0;
+    // Read, decode/calculate and write the samples in a pipeline, so that file I/O is hidden behind the feature calculation
+    FeatureExtractionPipeline pipeline(positiveTrainingImages, negativeTrainingImages, hog, featureCache.isOpen() ? &featureCache : NULL, extractionPipelineDepth, workerThreads,
+            (trainFromMemory && !trainingFeatures.empty()) ? &trainingFeatures[0] : NULL);
+    vector<pthread_t> pipelineThreads;
+    for (int thread = 0; thread < max(prefetchThreads, 1) + workerThreads; ++thread) {
+        pthread_t threadId;
+        if (pthread_create(&threadId, NULL, (thread < max(prefetchThreads, 1)) ? featureExtractionPrefetchStage : featureExtractionComputeStage, &pipeline) != 0) {
+            printf("Error starting feature extraction thread!\n");
+            pipeline.close();
+            break;
+        }
+        pipelineThreads.push_back(threadId);
+    }
+    // Samples that have been calculated ahead of the next one to write, at most extractionPipelineDepth samples following it are in flight
+    vector<FeatureExtractionItem*> pendingSamples(extractionPipelineDepth, (FeatureExtractionItem*) NULL);
+    bool extractionFailed = false;
+    unsigned long currentFile = 0;
+    FeatureExtractionItem* calculatedSample;
+    while (!extractionFailed && currentFile < overallSamples && pipeline.resultQueue.pop(calculatedSample)) {
+        pendingSamples[calculatedSample->sampleIndex % extractionPipelineDepth] = calculatedSample;
+        FeatureExtractionItem* sample;
+        while (!extractionFailed && (sample = pendingSamples[currentFile % extractionPipelineDepth]) != NULL) {
+            pendingSamples[currentFile % extractionPipelineDepth] = NULL;
             storeCursor();
-            vector<float> featureVector;
-            // Get positive or negative sample image file path
-            const string currentImageFile = (currentFile < positiveTrainingImages.size() ? positiveTrainingImages.at(currentFile) : negativeTrainingImages.at(currentFile - positiveTrainingImages.size()));
             // Output progress
             if ( (currentFile+1) % 10 == 0 || (currentFile+1) == overallSamples ) {
                 percent = ((currentFile+1) * 100 / overallSamples);
-                printf("%5lu (%3.0f%%):\tFile '%s'", (currentFile+1), percent, currentImageFile.c_str());
+                printf("%5lu (%3.0f%%):\tFile '%s'", (currentFile+1), percent, pipeline.getFileName(currentFile));
                 fflush(stdout);
                 resetCursor();
             }
-            // Calculate feature vector from current image file
-            calculateFeaturesFromInput(currentImageFile, featureVector, hog);
-            if (!featureVector.empty()) {
+            readSeconds += sample->readSeconds;
+            decodeSeconds += sample->decodeSeconds;
+            computeSeconds += sample->computeSeconds;
+            readBytes += sample->fileBytes;
+            calculatedSamples += (sample->cacheHit ? 0 : 1);
+            const double writeStart = RunMetrics::now();
+            // One feature vector per sample, or one per variant of augmented positive samples
+            const unsigned long sampleRows = sample->rowCount;
+            if (sampleRows > 0) {
+                const float* features = sample->features;
+                if (trainFromMemory) {
+                    // Close the gap of failed samples before, the rows are only moved towards rows already written
+                    float* writtenRows = &trainingFeatures[trainingLabels.size() * featureDimension];
+                    if (features != writtenRows) {
+                        memmove(writtenRows, features, sampleRows * featureDimension * sizeof (float));
+                    }
+                    features = writtenRows;
+                }
+                if (sample->cacheHit) {
+                    ++cachedSamples;
+                } else if (featureCache.isOpen() && sample->cacheKey != 0 && sampleRows == 1) {
+                    featureCache.add(sample->cacheKey, features);
+                }
                 /* Put positive or negative sample class to file, 
                  * true=positive, false=negative, 
                  * and convert positive class to +1 and negative class to -1 for SVMlight
                  */
-                File << ((currentFile < positiveTrainingImages.size()) ? "+1" : "-1");
-                // Save feature vector components
-                for (unsigned int feature = 0; feature < featureVector.size(); ++feature) {
-                    File << " " << (feature + 1) << ":" << featureVector.at(feature);
+                const bool positiveSample = (currentFile < positiveTrainingImages.size());
+                for (unsigned long row = 0; row < sampleRows; ++row) {
+                    if (writeFeaturesFile && !featureStore.addSample(positiveSample ? +1.0f : -1.0f, features + row * featureDimension)) {
+                        extractionFailed = true;
+                    }
+                    if (exportTextFeatures) {
+                        textWriter.writeSample(positiveSample ? +1.0f : -1.0f, features + row * featureDimension, featureDimension);
+                    }
                 }
-                File << endl;
+                if (trainFromMemory) {
+                    trainingLabels.insert(trainingLabels.end(), sampleRows, positiveSample ? +1.0f : -1.0f);
+                }
+                augmentedSamples += sampleRows - 1;
             }
+            writeSeconds += RunMetrics::now() - writeStart;
+            pipeline.freeItems.push(sample); // Allow the next sample to enter the pipeline
+            ++currentFile;
         }
-        printf("\n");
-        File.flush();
-        File.close();
-    } else {
-        printf("Error opening file '%s'!\n", featuresFile.c_str());
+    }
+    pipeline.close();
+    for (size_t thread = 0; thread < pipelineThreads.size(); ++thread) {
+        pthread_join(pipelineThreads.at(thread), NULL);
+    }
+    if (extractionFailed || currentFile < overallSamples) {
         return EXIT_FAILURE;
     }
+    printf("\n");
+    if (trainFromMemory) {
+        trainingFeatures.resize(trainingLabels.size() * featureDimension); // Drop the rows of failed samples, keeping the capacity
+    }
+    if (featureCache.isOpen()) {
+        printf("Feature cache: %lu samples read from cache, %lu samples calculated and added\n", cachedSamples, (unsigned long) featureCache.getAddedCount());
+    }
+    if (augmentedSamples > 0) {
+        printf("Added %lu augmented positive samples (%u variants per positive sample)\n", augmentedSamples, getPositiveVariantCount());
+        runMetrics.setValue("augmented_samples", (long) augmentedSamples);
+        overallSamples += augmentedSamples;
+    }
+    if (!negativeWindowImages.empty()) {
+        printf("Sampling %s%u negative windows from each of %lu full-size negative images\n", denseNegativeWindows ? "up to " : "", negativeWindowsPerImage, (unsigned long) negativeWindowImages.size());
+        const double samplingStart = RunMetrics::now();
+        unsigned long negativeWindows = 0;
+        if (!addSampledNegativeWindows(hog, negativeWindowImages, writeFeaturesFile ? &featureStore : NULL, trainFromMemory ? &trainingLabels : NULL, trainFromMemory ? &trainingFeatures : NULL,
+                exportTextFeatures ? &textWriter : NULL, negativeWindows)) {
+            return EXIT_FAILURE;
+        }
+        runMetrics.stopStage("negative_window_sampling", samplingStart, negativeWindows);
+        runMetrics.setValue("sampled_negative_windows", (long) negativeWindows);
+        overallSamples += negativeWindows;
+    }
+    if (!featureStore.close()) {
+        return EXIT_FAILURE;
+    }
+    if (exportTextFeatures && !textWriter.close()) {
+        return EXIT_FAILURE;
+    }
+    runMetrics.addStage("read", readSeconds, overallSamples, readBytes);
+    runMetrics.addStage("decode", decodeSeconds, calculatedSamples);
+    runMetrics.addStage("hog_compute", computeSeconds, calculatedSamples);
+    runMetrics.addStage("feature_write", writeSeconds, overallSamples,
+            (writeFeaturesFile ? featureStore.getCount() * (featureDimension + 1) * sizeof (float) : 0) + textWriter.getBytesWritten());
+    runMetrics.stopStage("feature_extraction", extractionStart, overallSamples);
+    runMetrics.setValue("samples", (long) overallSamples);
+    runMetrics.setValue("cached_samples", (long) cachedSamples);
+    runMetrics.setValue("feature_dimension", (long) featureDimension);
+    runMetrics.setValue("extraction_threads", (long) workerThreads);
+    // </editor-fold>
+
+    // <editor-fold defaultstate="collapsed" desc="Cross-validated grid search of C">
+    if (gridSearchFolds > 1) {
+        stageStart = RunMetrics::now();
+        FeatureStoreMapping gridSearchMapping;
+        const float* labels = NULL;
+        const float* features = NULL;
+        long sampleCount = 0;
+        if (trainFromMemory) {
+            sampleCount = trainingLabels.size();
+            labels = (sampleCount > 0) ? &trainingLabels[0] : NULL;
+            features = (sampleCount > 0) ? &trainingFeatures[0] : NULL;
+        } else if (gridSearchMapping.open(featuresFile.c_str()) && gridSearchMapping.getCount() > 0) {
+            sampleCount = gridSearchMapping.getCount();
+            labels = gridSearchMapping.getLabels();
+            features = gridSearchMapping.getSample(0);
+        }
+        double bestCost;
+        if (labels != NULL && gridSearchCost(labels, features, sampleCount, featureDimension, bestCost)) {
+            TRAINHOG_SVM_TO_TRAIN::getInstance()->setC(bestCost);
+            runMetrics.setValue("grid_search_c", bestCost);
+        }
+        runMetrics.stopStage("grid_search", stageStart, sampleCount);
+    }
+    // </editor-fold>
+
+    // <editor-fold defaultstate="collapsed" desc="Train detector variants concurrently">
+    if (trainDetectorVariants) {
+        stageStart = RunMetrics::now();
+        const vector<double> costs(detectorVariantCosts, detectorVariantCosts + sizeof (detectorVariantCosts) / sizeof (detectorVariantCosts[0]));
+        vector<double> thresholds(costs.size());
+        const DetectorVariantTrainingBody variantTrainingBody(trainFromMemory ? &trainingLabels : NULL, trainFromMemory ? &trainingFeatures : NULL, costs, thresholds);
+#if TRAINHOG_USEDSVM == LINEARSVM || TRAINHOG_USEDSVM == SGDSVM
+        printf("Training %lu detector variants concurrently\n", (unsigned long) costs.size());
+        parallel_for_(Range(0, (int) costs.size()), variantTrainingBody);
+#else
+        // Each instance holds its own copy of the training set (and SVMlight serializes its library calls), so one after the other
+        printf("Training %lu detector variants\n", (unsigned long) costs.size());
+        variantTrainingBody(Range(0, (int) costs.size()));
+#endif
+        for (size_t detector = 0; detector < costs.size(); ++detector) {
+            printf("\tC %g: threshold %3.5f, descriptor vector '%s'\n", costs[detector], thresholds[detector], getVariantFileName(descriptorVectorFile, costs[detector]).c_str());
+        }
+        runMetrics.stopStage("detector_variants", stageStart, overallSamples * costs.size());
+    }
     // </editor-fold>
 
     // <editor-fold defaultstate="collapsed" desc="Pass features to machine learning algorithm">
     /// Read in and train the calculated feature vectors
     printf("Calling %s\n", TRAINHOG_SVM_TO_TRAIN::getInstance()->getSVMName());
-    TRAINHOG_SVM_TO_TRAIN::getInstance()->read_problem(const_cast<char*> (featuresFile.c_str()));
+#if TRAINHOG_USEDSVM == SVMLIGHT || TRAINHOG_USEDSVM == LIBSVM
+    TRAINHOG_SVM_TO_TRAIN::getInstance()->useFileBackedMemory(fileBackedTrainingDir);
+#else
+    if (!fileBackedTrainingDir.empty()) {
+        printf("Note: fileBackedTrainingDir has no effect, %s reads the memory-mapped features file in place\n", TRAINHOG_SVM_TO_TRAIN::getInstance()->getSVMName());
+    }
+#endif
+    stageStart = RunMetrics::now();
+    if (trainFromMemory) {
+        TRAINHOG_SVM_TO_TRAIN::getInstance()->read_problem(trainingLabels, trainingFeatures);
+        // The SVM keeps its own copy of the training data, release ours unless hard negative mining extends it
+        if (hardNegativeMiningRounds <= 0) {
+            vector<float>().swap(trainingLabels);
+            vector<float>().swap(trainingFeatures);
+        }
+    } else {
+        TRAINHOG_SVM_TO_TRAIN::getInstance()->read_problem(const_cast<char*> (featuresFile.c_str()));
+    }
+    runMetrics.stopStage("read_problem", stageStart, overallSamples);
+    stageStart = RunMetrics::now();
     TRAINHOG_SVM_TO_TRAIN::getInstance()->train(); // Call the core libsvm training procedure
+    runMetrics.stopStage("train", stageStart, overallSamples);
     printf("Training done, saving model file!\n");
     TRAINHOG_SVM_TO_TRAIN::getInstance()->saveModelToFile(svmModelFile);
     // </editor-fold>
@@ -423,20 +2618,103 @@ int main(int argc, char** argv) {
     vector<float> descriptorVector;
     vector<unsigned int> descriptorVectorIndices;
     // Generate a single detecting feature vector (v1 | b) from the trained support vectors, for use e.g. with the HOG algorithm
+    stageStart = RunMetrics::now();
     TRAINHOG_SVM_TO_TRAIN::getInstance()->getSingleDetectingVector(descriptorVector, descriptorVectorIndices);
+    runMetrics.stopStage("get_single_detecting_vector", stageStart);
     // And save the precious to file system
     saveDescriptorVectorToFile(descriptorVector, descriptorVectorIndices, descriptorVectorFile);
     // </editor-fold>
 
+    // <editor-fold defaultstate="collapsed" desc="Hard negative mining">
+    if (hardNegativeMiningRounds > 0) {
+        static vector<string> fullNegativeImages;
+        getFilesInDirectory(fullNegativeImagesDir, fullNegativeImages, validExtensions);
+        set<HardNegativeWindow> minedWindows;
+        for (int round = 1; round <= hardNegativeMiningRounds; ++round) {
+            printf("Hard negative mining round %d of %d: scanning %lu images\n", round, hardNegativeMiningRounds, (unsigned long) fullNegativeImages.size());
+            hog.setSVMDetector(descriptorVector);
+            stageStart = RunMetrics::now();
+            // The mined windows are added to the features file, the text export and the training set in memory alike
+            if (exportTextFeatures && !textWriter.open(featuresTextFile, true)) {
+                return EXIT_FAILURE;
+            }
+            const unsigned long minedSamples = mineHardNegatives(hog, TRAINHOG_SVM_TO_TRAIN::getInstance()->getThreshold(), fullNegativeImages, minedWindows,
+                    trainFromMemory ? &trainingLabels : NULL, trainFromMemory ? &trainingFeatures : NULL, exportTextFeatures ? &textWriter : NULL);
+            if (exportTextFeatures && !textWriter.close()) {
+                return EXIT_FAILURE;
+            }
+            runMetrics.stopStage("hard_negative_mining", stageStart, fullNegativeImages.size());
+            if (minedSamples == 0) {
+                printf("No new hard negatives found, stopping hard negative mining\n");
+                break;
+            }
+            // Retrain on the extended training set
+            stageStart = RunMetrics::now();
+            if (trainFromMemory) {
+                TRAINHOG_SVM_TO_TRAIN::getInstance()->read_problem(trainingLabels, trainingFeatures);
+            } else {
+                TRAINHOG_SVM_TO_TRAIN::getInstance()->read_problem(const_cast<char*> (featuresFile.c_str()));
+            }
+            runMetrics.stopStage("read_problem", stageStart);
+            if (warmStartRetraining) {
+                TRAINHOG_SVM_TO_TRAIN::getInstance()->setWarmStart(svmModelFile);
+            }
+            stageStart = RunMetrics::now();
+            TRAINHOG_SVM_TO_TRAIN::getInstance()->train();
+            runMetrics.stopStage("train", stageStart);
+            printf("Retraining done, saving model file!\n");
+            TRAINHOG_SVM_TO_TRAIN::getInstance()->saveModelToFile(svmModelFile);
+            stageStart = RunMetrics::now();
+            TRAINHOG_SVM_TO_TRAIN::getInstance()->getSingleDetectingVector(descriptorVector, descriptorVectorIndices);
+            runMetrics.stopStage("get_single_detecting_vector", stageStart);
+            saveDescriptorVectorToFile(descriptorVector, descriptorVectorIndices, descriptorVectorFile);
+        }
+        vector<float>().swap(trainingLabels);
+        vector<float>().swap(trainingFeatures);
+    }
+    // </editor-fold>
+
     // <editor-fold defaultstate="collapsed" desc="Test detecting vector">
     // Detector detection tolerance threshold
     const double hitThreshold = TRAINHOG_SVM_TO_TRAIN::getInstance()->getThreshold();
     // Set our custom detecting vector
     hog.setSVMDetector(descriptorVector);
     hog.save(cvHOGFile);
+    {
+        // openCV does not save the detection threshold with the HOG parameters, add it for the batch detection mode
+        FileStorage hogFile(cvHOGFile, FileStorage::APPEND);
+        if (hogFile.isOpened()) {
+            hogFile << "hitThreshold" << hitThreshold;
+        }
+    }
 	
+    stageStart = RunMetrics::now();
+    if (evaluateStoredFeatures) {
+        printf("Scoring stored features of '%s' with the trained detector\n", featuresFile.c_str());
+        scoreStoredFeatures(descriptorVector, hitThreshold);
+    }
+
+    if (quantizedDetectorBits != 0) {
+        printf("Exporting quantized detector\n");
+        exportQuantizedDetector(descriptorVector, hitThreshold, hog);
+    }
+
+    if (thresholdSweep) {
+        printf("Sweeping the detection threshold on the validation set\n");
+        sweepDetectionThreshold(hog, hitThreshold, validExtensions);
+    }
+    runMetrics.stopStage("evaluation", stageStart);
+
     printf("Testing training phase using training set as test set (just to check if training is ok - no detection quality conclusion with this!)\n");
-    detectTrainingSetTest(hog, hitThreshold, positiveTrainingImages, negativeTrainingImages);
+    stageStart = RunMetrics::now();
+    detectTrainingSetTest(hog, hitThreshold, positiveTrainingImages, negativeTrainingImages, featureCache.isOpen() ? &featureCache : NULL);
+    runMetrics.stopStage("training_set_test", stageStart, overallSamples);
+
+    // The live detection runs until it is quit, report the run before
+    runMetrics.printSummary();
+    if (!metricsFile.empty() && runMetrics.writeJson(metricsFile)) {
+        printf("Run metrics saved to '%s'\n", metricsFile.c_str());
+    }
 
     printf("Testing custom detection using camera\n");
     VideoCapture cap(-1); // open the default camera
@@ -444,13 +2722,7 @@ int main(int argc, char** argv) {
         printf("Error opening camera!\n");
         return EXIT_FAILURE;
     }
-    Mat testImage;
-    while ((cvWaitKey(10) & 255) != 27) {
-        cap >> testImage; // get a new frame from camera
-        cvtColor(testImage, testImage, CV_BGR2GRAY); // Work on grayscale images as trained
-        detectTest(hog, hitThreshold, testImage);
-        imshow("HOG custom detection", testImage);
-    }
+    liveDetection(hog, hitThreshold, cap);
     // </editor-fold>
 
     return EXIT_SUCCESS;
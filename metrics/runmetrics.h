@@ -0,0 +1,193 @@
+/**
+ * @file:   runmetrics.h
+ * @brief:  Timing and counters of the stages of a training run (directory scan, decoding, HOG calculation, training, ...),
+ * written as machine-readable JSON report, e.g. to track performance regressions across growing datasets.
+ *
+ * Stages are accumulated by name, so repeated stages (e.g. retraining during hard negative mining) add up.
+ * Stages running in pipeline threads report the summed time of all threads, not the wall time.
+ * Not thread-safe, stages are added from the main thread.
+ */
+
+#ifndef RUNMETRICS_H
+#define	RUNMETRICS_H
+
+#include <stdio.h>
+#include <stdint.h>
+#include <time.h>
+#include <sys/time.h>
+#include <sys/resource.h>
+#include <string>
+#include <vector>
+#include <map>
+
+struct StageMetrics {
+    std::string name;
+    double seconds;
+    uint64_t items; // e.g. samples or images processed
+    uint64_t bytes; // e.g. bytes read or written
+    unsigned long calls; // Number of times the stage ran
+};
+
+class RunMetrics {
+private:
+    std::vector<StageMetrics> stages; // In order of first occurrence
+    std::map<std::string, size_t> stageIndices;
+    std::vector< std::pair<std::string, std::string> > values; // Additional run properties, already JSON formatted
+    time_t startTime;
+    double startSeconds;
+
+    static std::string jsonString(const std::string& in) {
+        std::string out = "\"";
+        for (size_t i = 0; i < in.size(); ++i) {
+            const unsigned char c = in[i];
+            if (c == '"' || c == '\\') {
+                out += '\\';
+                out += c;
+            } else if (c < 0x20) {
+                char escaped[8];
+                snprintf(escaped, sizeof (escaped), "\\u%04x", c);
+                out += escaped;
+            } else {
+                out += c;
+            }
+        }
+        return out + "\"";
+    }
+
+    /**
+     * Formats a floating point value for JSON, with a decimal point independent of the locale
+     */
+    static std::string jsonNumber(double value) {
+        char text[64];
+        snprintf(text, sizeof (text), "%.6f", value);
+        for (char* c = text; *c != '\0'; ++c) {
+            if (*c == ',') {
+                *c = '.';
+            }
+        }
+        return text;
+    }
+
+public:
+
+    RunMetrics() : startTime(time(NULL)), startSeconds(now()) {
+    }
+
+    /**
+     * @return monotonic time in seconds
+     */
+    static double now() {
+        struct timespec ts;
+        clock_gettime(CLOCK_MONOTONIC, &ts);
+        return ts.tv_sec + ts.tv_nsec * 1e-9;
+    }
+
+    /**
+     * @return peak resident set size of the process in kilobytes
+     */
+    static long peakResidentKilobytes() {
+        struct rusage usage;
+        if (getrusage(RUSAGE_SELF, &usage) != 0) {
+            return 0;
+        }
+#ifdef __APPLE__
+        return usage.ru_maxrss / 1024; // Bytes on OS X
+#else
+        return usage.ru_maxrss;
+#endif
+    }
+
+    /**
+     * Adds time and counts to a stage
+     * @param name
+     * @param seconds
+     * @param items
+     * @param bytes
+     */
+    void addStage(const std::string& name, double seconds, uint64_t items = 0, uint64_t bytes = 0) {
+        std::map<std::string, size_t>::iterator index = stageIndices.find(name);
+        if (index == stageIndices.end()) {
+            StageMetrics stage;
+            stage.name = name;
+            stage.seconds = 0.0;
+            stage.items = 0;
+            stage.bytes = 0;
+            stage.calls = 0;
+            index = stageIndices.insert(std::make_pair(name, stages.size())).first;
+            stages.push_back(stage);
+        }
+        StageMetrics& stage = stages[index->second];
+        stage.seconds += seconds;
+        stage.items += items;
+        stage.bytes += bytes;
+        ++stage.calls;
+    }
+
+    /**
+     * Adds time to a stage, measured from the given start time
+     * @param name
+     * @param startSeconds as returned by now()
+     * @param items
+     * @param bytes
+     */
+    void stopStage(const std::string& name, double stageStartSeconds, uint64_t items = 0, uint64_t bytes = 0) {
+        addStage(name, now() - stageStartSeconds, items, bytes);
+    }
+
+    void setValue(const std::string& name, const std::string& value) {
+        values.push_back(std::make_pair(name, jsonString(value)));
+    }
+
+    void setValue(const std::string& name, double value) {
+        values.push_back(std::make_pair(name, jsonNumber(value)));
+    }
+
+    void setValue(const std::string& name, long value) {
+        char text[32];
+        snprintf(text, sizeof (text), "%ld", value);
+        values.push_back(std::make_pair(name, std::string(text)));
+    }
+
+    /**
+     * Prints a summary table of the stages
+     */
+    void printSummary() const {
+        printf("%-28s %10s %12s %12s %14s\n", "Stage", "Seconds", "Items", "Items/s", "Bytes");
+        for (size_t i = 0; i < stages.size(); ++i) {
+            const StageMetrics& stage = stages[i];
+            printf("%-28s %10.3f %12lu %12.1f %14lu\n", stage.name.c_str(), stage.seconds, (unsigned long) stage.items,
+                    (stage.seconds > 0.0) ? stage.items / stage.seconds : 0.0, (unsigned long) stage.bytes);
+        }
+        printf("Wall time %.3f s, peak resident memory %ld kB\n", now() - startSeconds, peakResidentKilobytes());
+    }
+
+    /**
+     * Writes the report as JSON file
+     * @param fileName
+     * @return true on success
+     */
+    bool writeJson(const std::string& fileName) const {
+        FILE* fp = fopen(fileName.c_str(), "w");
+        if (fp == NULL) {
+            printf("Error opening file '%s'!\n", fileName.c_str());
+            return false;
+        }
+        char startText[32];
+        strftime(startText, sizeof (startText), "%Y-%m-%dT%H:%M:%SZ", gmtime(&startTime));
+        fprintf(fp, "{\n  \"start\": \"%s\",\n  \"wall_seconds\": %s,\n  \"peak_rss_kb\": %ld,\n", startText, jsonNumber(now() - startSeconds).c_str(), peakResidentKilobytes());
+        for (size_t i = 0; i < values.size(); ++i) {
+            fprintf(fp, "  %s: %s,\n", jsonString(values[i].first).c_str(), values[i].second.c_str());
+        }
+        fprintf(fp, "  \"stages\": [");
+        for (size_t i = 0; i < stages.size(); ++i) {
+            const StageMetrics& stage = stages[i];
+            fprintf(fp, "%s\n    {\"name\": %s, \"seconds\": %s, \"calls\": %lu, \"items\": %lu, \"items_per_second\": %s, \"bytes\": %lu}", (i > 0) ? "," : "",
+                    jsonString(stage.name).c_str(), jsonNumber(stage.seconds).c_str(), stage.calls, (unsigned long) stage.items,
+                    jsonNumber((stage.seconds > 0.0) ? stage.items / stage.seconds : 0.0).c_str(), (unsigned long) stage.bytes);
+        }
+        fprintf(fp, "\n  ]\n}\n");
+        return (fclose(fp) == 0);
+    }
+};
+
+#endif	/* RUNMETRICS_H */
@@ -0,0 +1,169 @@
+#
+# Benchmark configuration, build and run the benchmark suite (benchmark/benchmark.cpp) by issuing:
+# make CONF=Benchmark build
+# make benchmark
+#
+# The benchmark is built once per SVM backend (SVMlight, libSVM, dense linear SVM, SGD), selected by TRAINHOG_USEDSVM.
+# "make benchmark" fails if a result regressed against ${BENCHMARK_BASELINE} by more than ${BENCHMARK_TOLERANCE},
+# "make benchmark-baseline" records the current results as new baseline.
+
+
+# Environment
+MKDIR=mkdir
+CP=cp
+GREP=grep
+NM=nm
+CCADMIN=CCadmin
+RANLIB=ranlib
+CC=gcc
+CCC=g++
+CXX=g++
+FC=gfortran
+AS=as
+
+# Macros
+CND_PLATFORM=GNU-Linux-x86
+CND_DLIB_EXT=so
+CND_CONF=Benchmark
+CND_DISTDIR=dist
+CND_BUILDDIR=build
+
+# Include project Makefile
+include Makefile
+
+# Object Directory
+OBJECTDIR=${CND_BUILDDIR}/${CND_CONF}/${CND_PLATFORM}
+
+# Benchmark binaries
+BENCHMARKDIR=${CND_DISTDIR}/${CND_CONF}/${CND_PLATFORM}
+BENCHMARKS= \
+	${BENCHMARKDIR}/benchmark_svmlight \
+	${BENCHMARKDIR}/benchmark_libsvm \
+	${BENCHMARKDIR}/benchmark_linearsvm \
+	${BENCHMARKDIR}/benchmark_sgdsvm
+
+# Object Files
+SVMLIGHTOBJECTFILES= \
+	${OBJECTDIR}/svmlight/svm_common.o \
+	${OBJECTDIR}/svmlight/svm_hideo.o \
+	${OBJECTDIR}/svmlight/svm_learn.o
+
+LIBSVMOBJECTFILES= \
+	${OBJECTDIR}/libsvm/svm.o
+
+
+# C Compiler Flags
+CFLAGS=
+
+# CC Compiler Flags
+CCFLAGS=-fopenmp
+CXXFLAGS=-fopenmp
+
+# Fortran Compiler Flags
+FFLAGS=
+
+# Assembler Flags
+ASFLAGS=
+
+# Link Libraries and Options
+# All modules of the installed openCV, with OpenCV 2.4 the DetectionEngine needs the ocl module (acceleration/openclhog.h)
+LDLIBSOPTIONS=`pkg-config --libs opencv` -fopenmp
+
+# Benchmark run options
+BENCHMARK_BASELINE=benchmark/baseline.txt
+BENCHMARK_TOLERANCE=0.2
+# The dense backends need about 14.1 GB for the 1000000 samples training size
+BENCHMARK_ARGS=--dataset inria --max-memory-mb 16384
+# The kernel SVM backends are only trained at the smallest size, larger sizes take hours
+BENCHMARK_KERNEL_ARGS=--suite training --training-sizes 10000 --repeat 1
+
+# Build Targets
+.build-conf: ${BUILD_SUBPROJECTS}
+	"${MAKE}"  -f nbproject/Makefile-${CND_CONF}.mk ${BENCHMARKS}
+
+${BENCHMARKDIR}/benchmark_svmlight: ${OBJECTDIR}/benchmark/benchmark_svmlight.o ${SVMLIGHTOBJECTFILES}
+	${MKDIR} -p ${BENCHMARKDIR}
+	${LINK.cc} -o $@ ${OBJECTDIR}/benchmark/benchmark_svmlight.o ${SVMLIGHTOBJECTFILES} ${LDLIBSOPTIONS}
+
+${BENCHMARKDIR}/benchmark_libsvm: ${OBJECTDIR}/benchmark/benchmark_libsvm.o ${LIBSVMOBJECTFILES}
+	${MKDIR} -p ${BENCHMARKDIR}
+	${LINK.cc} -o $@ ${OBJECTDIR}/benchmark/benchmark_libsvm.o ${LIBSVMOBJECTFILES} ${LDLIBSOPTIONS}
+
+${BENCHMARKDIR}/benchmark_linearsvm: ${OBJECTDIR}/benchmark/benchmark_linearsvm.o
+	${MKDIR} -p ${BENCHMARKDIR}
+	${LINK.cc} -o $@ ${OBJECTDIR}/benchmark/benchmark_linearsvm.o ${LDLIBSOPTIONS}
+
+${BENCHMARKDIR}/benchmark_sgdsvm: ${OBJECTDIR}/benchmark/benchmark_sgdsvm.o
+	${MKDIR} -p ${BENCHMARKDIR}
+	${LINK.cc} -o $@ ${OBJECTDIR}/benchmark/benchmark_sgdsvm.o ${LDLIBSOPTIONS}
+
+${OBJECTDIR}/benchmark/benchmark_svmlight.o: benchmark/benchmark.cpp 
+	${MKDIR} -p ${OBJECTDIR}/benchmark
+	${RM} "$@.d"
+	$(COMPILE.cc) -O2 -DTRAINHOG_USEDSVM=1 -I/usr/local/include/opencv2 -MMD -MP -MF "$@.d" -o $@ benchmark/benchmark.cpp
+
+${OBJECTDIR}/benchmark/benchmark_libsvm.o: benchmark/benchmark.cpp 
+	${MKDIR} -p ${OBJECTDIR}/benchmark
+	${RM} "$@.d"
+	$(COMPILE.cc) -O2 -DTRAINHOG_USEDSVM=2 -I/usr/local/include/opencv2 -MMD -MP -MF "$@.d" -o $@ benchmark/benchmark.cpp
+
+${OBJECTDIR}/benchmark/benchmark_linearsvm.o: benchmark/benchmark.cpp 
+	${MKDIR} -p ${OBJECTDIR}/benchmark
+	${RM} "$@.d"
+	$(COMPILE.cc) -O2 -DTRAINHOG_USEDSVM=3 -I/usr/local/include/opencv2 -MMD -MP -MF "$@.d" -o $@ benchmark/benchmark.cpp
+
+${OBJECTDIR}/benchmark/benchmark_sgdsvm.o: benchmark/benchmark.cpp 
+	${MKDIR} -p ${OBJECTDIR}/benchmark
+	${RM} "$@.d"
+	$(COMPILE.cc) -O2 -DTRAINHOG_USEDSVM=4 -I/usr/local/include/opencv2 -MMD -MP -MF "$@.d" -o $@ benchmark/benchmark.cpp
+
+${OBJECTDIR}/libsvm/svm.o: libsvm/svm.cpp 
+	${MKDIR} -p ${OBJECTDIR}/libsvm
+	${RM} "$@.d"
+	$(COMPILE.cc) -O2 -I/usr/local/include/opencv2 -MMD -MP -MF "$@.d" -o ${OBJECTDIR}/libsvm/svm.o libsvm/svm.cpp
+
+${OBJECTDIR}/svmlight/svm_common.o: svmlight/svm_common.c 
+	${MKDIR} -p ${OBJECTDIR}/svmlight
+	${RM} "$@.d"
+	$(COMPILE.c) -O2 -MMD -MP -MF "$@.d" -o ${OBJECTDIR}/svmlight/svm_common.o svmlight/svm_common.c
+
+${OBJECTDIR}/svmlight/svm_hideo.o: svmlight/svm_hideo.c 
+	${MKDIR} -p ${OBJECTDIR}/svmlight
+	${RM} "$@.d"
+	$(COMPILE.c) -O2 -MMD -MP -MF "$@.d" -o ${OBJECTDIR}/svmlight/svm_hideo.o svmlight/svm_hideo.c
+
+${OBJECTDIR}/svmlight/svm_learn.o: svmlight/svm_learn.c 
+	${MKDIR} -p ${OBJECTDIR}/svmlight
+	${RM} "$@.d"
+	$(COMPILE.c) -O2 -MMD -MP -MF "$@.d" -o ${OBJECTDIR}/svmlight/svm_learn.o svmlight/svm_learn.c
+
+# Run Targets, every binary compares its results against the shared baseline and fails on regressions
+.run-benchmark: .build-conf
+	${MKDIR} -p genfiles
+	${BENCHMARKDIR}/benchmark_linearsvm ${BENCHMARK_ARGS} --baseline ${BENCHMARK_BASELINE} --tolerance ${BENCHMARK_TOLERANCE} --output genfiles/benchmark_linearsvm.json
+	${BENCHMARKDIR}/benchmark_sgdsvm ${BENCHMARK_ARGS} --suite training --baseline ${BENCHMARK_BASELINE} --tolerance ${BENCHMARK_TOLERANCE} --output genfiles/benchmark_sgdsvm.json
+	${BENCHMARKDIR}/benchmark_svmlight ${BENCHMARK_ARGS} ${BENCHMARK_KERNEL_ARGS} --baseline ${BENCHMARK_BASELINE} --tolerance ${BENCHMARK_TOLERANCE} --output genfiles/benchmark_svmlight.json
+	${BENCHMARKDIR}/benchmark_libsvm ${BENCHMARK_ARGS} ${BENCHMARK_KERNEL_ARGS} --baseline ${BENCHMARK_BASELINE} --tolerance ${BENCHMARK_TOLERANCE} --output genfiles/benchmark_libsvm.json
+
+.run-benchmark-baseline: .build-conf
+	${MKDIR} -p genfiles
+	${BENCHMARKDIR}/benchmark_linearsvm ${BENCHMARK_ARGS} --baseline ${BENCHMARK_BASELINE} --update-baseline --output genfiles/benchmark_linearsvm.json
+	${BENCHMARKDIR}/benchmark_sgdsvm ${BENCHMARK_ARGS} --suite training --baseline ${BENCHMARK_BASELINE} --update-baseline --output genfiles/benchmark_sgdsvm.json
+	${BENCHMARKDIR}/benchmark_svmlight ${BENCHMARK_ARGS} ${BENCHMARK_KERNEL_ARGS} --baseline ${BENCHMARK_BASELINE} --update-baseline --output genfiles/benchmark_svmlight.json
+	${BENCHMARKDIR}/benchmark_libsvm ${BENCHMARK_ARGS} ${BENCHMARK_KERNEL_ARGS} --baseline ${BENCHMARK_BASELINE} --update-baseline --output genfiles/benchmark_libsvm.json
+
+# Subprojects
+.build-subprojects:
+
+# Clean Targets
+.clean-conf: ${CLEAN_SUBPROJECTS}
+	${RM} -r ${CND_BUILDDIR}/${CND_CONF}
+	${RM} ${BENCHMARKS}
+
+# Subprojects
+.clean-subprojects:
+
+# Enable dependency checking
+.dep.inc: .depcheck-impl
+
+include .dep.inc
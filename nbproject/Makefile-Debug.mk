@@ -46,8 +46,8 @@ OBJECTFILES= \
 CFLAGS=
 
 # CC Compiler Flags
-CCFLAGS=`pkg-config --cflags opencv` 
-CXXFLAGS=`pkg-config --cflags opencv` 
+CCFLAGS=`pkg-config --cflags opencv` -fopenmp
+CXXFLAGS=`pkg-config --cflags opencv` -fopenmp
 
 # Fortran Compiler Flags
 FFLAGS=
@@ -56,7 +56,7 @@ FFLAGS=
 ASFLAGS=
 
 # Link Libraries and Options
-LDLIBSOPTIONS=`pkg-config --libs opencv`  
+LDLIBSOPTIONS=`pkg-config --libs opencv` -fopenmp
 
 # Build Targets
 .build-conf: ${BUILD_SUBPROJECTS}
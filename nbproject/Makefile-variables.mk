@@ -22,6 +22,14 @@ CND_ARTIFACT_PATH_Release=dist/Release/GNU-Linux-x86/trainhogpullrequests
 CND_PACKAGE_DIR_Release=dist/Release/GNU-Linux-x86/package
 CND_PACKAGE_NAME_Release=trainhogpullrequests.tar
 CND_PACKAGE_PATH_Release=dist/Release/GNU-Linux-x86/package/trainhogpullrequests.tar
+# Benchmark configuration
+CND_PLATFORM_Benchmark=GNU-Linux-x86
+CND_ARTIFACT_DIR_Benchmark=dist/Benchmark/GNU-Linux-x86
+CND_ARTIFACT_NAME_Benchmark=benchmark_linearsvm
+CND_ARTIFACT_PATH_Benchmark=dist/Benchmark/GNU-Linux-x86/benchmark_linearsvm
+CND_PACKAGE_DIR_Benchmark=dist/Benchmark/GNU-Linux-x86/package
+CND_PACKAGE_NAME_Benchmark=trainhogpullrequests.tar
+CND_PACKAGE_PATH_Benchmark=dist/Benchmark/GNU-Linux-x86/package/trainhogpullrequests.tar
 #
 # include compiler specific variables
 #
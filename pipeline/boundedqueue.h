@@ -0,0 +1,145 @@
+/**
+ * @file:   boundedqueue.h
+ * @brief:  Blocking FIFO queue with fixed capacity (pthreads) connecting the stages of the feature extraction pipeline.
+ * Producers block while the queue is full, so a fast stage cannot run arbitrarily far ahead and memory usage stays flat.
+ * The items are kept in a ring buffer allocated once, so pushing and popping never allocates memory.
+ */
+
+#ifndef BOUNDEDQUEUE_H
+#define	BOUNDEDQUEUE_H
+
+#include <pthread.h>
+#include <vector>
+
+template <typename T>
+class BoundedQueue {
+private:
+    std::vector<T> items; // Ring buffer of capacity items
+    size_t capacity;
+    size_t head; // Index of the oldest item
+    size_t count; // Number of queued items
+    bool closed;
+    pthread_mutex_t mutex;
+    pthread_cond_t notEmpty;
+    pthread_cond_t notFull;
+
+    // Non-copyable, the queue owns the synchronization primitives
+    BoundedQueue(const BoundedQueue&);
+    BoundedQueue& operator=(const BoundedQueue&);
+
+public:
+
+    /**
+     * @param _capacity maximum number of queued items, at least 1
+     */
+    explicit BoundedQueue(size_t _capacity) : items(_capacity > 0 ? _capacity : 1), capacity(_capacity > 0 ? _capacity : 1), head(0), count(0), closed(false) {
+        pthread_mutex_init(&mutex, NULL);
+        pthread_cond_init(&notEmpty, NULL);
+        pthread_cond_init(&notFull, NULL);
+    }
+
+    virtual ~BoundedQueue() {
+        pthread_cond_destroy(&notFull);
+        pthread_cond_destroy(&notEmpty);
+        pthread_mutex_destroy(&mutex);
+    }
+
+    /**
+     * Appends an item, blocks while the queue is full
+     * @param item
+     * @return false if the queue was closed, the item is not queued then
+     */
+    bool push(const T& item) {
+        pthread_mutex_lock(&mutex);
+        while (count >= capacity && !closed) {
+            pthread_cond_wait(&notFull, &mutex);
+        }
+        const bool queued = !closed;
+        if (queued) {
+            items[(head + count) % capacity] = item;
+            ++count;
+            pthread_cond_signal(&notEmpty);
+        }
+        pthread_mutex_unlock(&mutex);
+        return queued;
+    }
+
+    /**
+     * Appends an item without blocking, if the queue is full its oldest item is removed to make room,
+     * e.g. to drop stale camera frames when the consumers fall behind
+     * @param item
+     * @param dropped the removed oldest item, only valid if true is returned
+     * @param queued set to false if the queue was closed, the item is not queued then
+     * @return true if an item was dropped
+     */
+    bool pushDroppingOldest(const T& item, T& dropped, bool& queued) {
+        pthread_mutex_lock(&mutex);
+        bool droppedItem = false;
+        queued = !closed;
+        if (queued) {
+            if (count >= capacity) {
+                dropped = items[head];
+                head = (head + 1) % capacity;
+                --count;
+                droppedItem = true;
+            }
+            items[(head + count) % capacity] = item;
+            ++count;
+            pthread_cond_signal(&notEmpty);
+        }
+        pthread_mutex_unlock(&mutex);
+        return droppedItem;
+    }
+
+    /**
+     * Removes the oldest item, blocks while the queue is empty
+     * @param item the removed item
+     * @return false if the queue was closed and all items have been removed
+     */
+    bool pop(T& item) {
+        pthread_mutex_lock(&mutex);
+        while (count == 0 && !closed) {
+            pthread_cond_wait(&notEmpty, &mutex);
+        }
+        const bool available = (count > 0);
+        if (available) {
+            item = items[head];
+            head = (head + 1) % capacity;
+            --count;
+            pthread_cond_signal(&notFull);
+        }
+        pthread_mutex_unlock(&mutex);
+        return available;
+    }
+
+    /**
+     * Removes the oldest item without blocking, e.g. to collect the items already waiting into a batch
+     * @param item the removed item
+     * @return false if the queue is empty
+     */
+    bool tryPop(T& item) {
+        pthread_mutex_lock(&mutex);
+        const bool available = (count > 0);
+        if (available) {
+            item = items[head];
+            head = (head + 1) % capacity;
+            --count;
+            pthread_cond_signal(&notFull);
+        }
+        pthread_mutex_unlock(&mutex);
+        return available;
+    }
+
+    /**
+     * Signals that no more items will be pushed, waiting consumers return once the remaining items are removed
+     */
+    void close() {
+        pthread_mutex_lock(&mutex);
+        closed = true;
+        pthread_cond_broadcast(&notEmpty);
+        pthread_cond_broadcast(&notFull);
+        pthread_mutex_unlock(&mutex);
+    }
+};
+
+#endif	/* BOUNDEDQUEUE_H */
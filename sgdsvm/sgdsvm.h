@@ -0,0 +1,540 @@
+/**
+ * @file:   sgdsvm.h
+ * @brief:  Streaming linear SVM solver for HOG feature vectors using averaged minibatch stochastic gradient descent (Pegasos),
+ * for training sets larger than main memory, e.g. after several rounds of hard negative mining
+ * @see S. Shalev-Shwartz, Y. Singer, N. Srebro: Pegasos: Primal Estimated sub-GrAdient SOlver for SVM (ICML 2007)
+ * @see L. Bottou: Stochastic Gradient Descent Tricks (Neural Networks: Tricks of the Trade, 2012)
+ *
+ * Minimizes the same primal objective as the other backends, 0.5*|w|^2 + C*sum_i max(0, 1 - y_i*(w*x_i + b)),
+ * in the equivalent form lambda/2*|w|^2 + 1/n*sum_i max(0, 1 - y_i*(w*x_i + b)) with lambda = 1/(n*C).
+ * The feature store is memory-mapped and processed in blocks of consecutive samples (in shuffled block order, samples shuffled
+ * within the block), the pages of a block are released after it has been processed, so that the resident memory stays
+ * at about one block independent of the number of samples.
+ * Minibatch updates are synchronous: the sub-gradient of a minibatch is calculated by several threads in parts and added up
+ * in thread order before the update, so that training is reproducible for a given number of threads (independent of the scheduling).
+ * The bias is learned as weight of an additional constant feature, decision function is f(x) = w*x + b.
+ * Besides the instance used by main (getInstance), independent instances can be created, each with its own worker threads.
+ */
+
+#ifndef SGDSVM_H
+#define	SGDSVM_H
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <math.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <string>
+#include <vector>
+#include <algorithm>
+#include "../linearsvm/densevector.h"
+#include "../featurestore/featurestore.h"
+
+struct SgdSVMParameter {
+    double C; // Cost of constraint violation, as for the other backends
+    int epochs; // Maximum number of passes over the training data
+    double eps; // Stopping criterion on the relative change of the objective between two epochs
+    long minibatchSize; // Samples per update
+    long blockSize; // Consecutive samples read (and shuffled) together, the resident part of a memory-mapped feature store
+    int threads; // Threads calculating the minibatch sub-gradients, 0 for the number of cores
+    double eta0; // Initial learning rate, <= 0 to estimate it from the feature norms
+    bool averaging; // Return the average of the weights from the second epoch on (averaged SGD), which converges faster than the last iterate
+    double biasFeature; // Value of the constant feature used to learn the bias, <= 0 to train without bias
+};
+
+class SgdSVM {
+private:
+    // Training data, either owned by this object or pointing into the memory-mapped feature store
+    std::vector<float> ownedLabels;
+    std::vector<float> ownedFeatures;
+    FeatureStoreMapping mapping;
+    bool mapped;
+    const float* labels;
+    const float* features;
+    long sampleCount;
+    long dimension;
+
+    // Model
+    std::vector<float> weights; // w
+    double bias; // b
+    std::vector<float> warmStartWeights; // Weights (followed by the bias) to start the next training from, empty for a cold start
+
+    // Minibatch sub-gradient workers, thread 0 is the training thread itself
+    int workerCount;
+    std::vector<pthread_t> workers;
+    pthread_mutex_t workerMutex;
+    pthread_cond_t workReady;
+    pthread_cond_t workDone;
+    unsigned long workGeneration; // Incremented for every minibatch
+    int pendingWorkers;
+    bool stopWorkers;
+    const long* batch; // Sample indices of the current minibatch
+    long batchSize;
+    const float* currentWeights; // w and the bias weight of the current iterate
+    double currentBiasWeight;
+    std::vector< std::vector<float> > gradients; // Per thread: sum of y_i*x_i of the margin violators
+    std::vector<double> biasGradients; // Per thread: sum of y_i*biasFeature of the margin violators
+    std::vector<double> losses; // Per thread: summed hinge loss of the minibatch part
+
+    struct WorkerArgument {
+        SgdSVM* svm;
+        int thread;
+    };
+    std::vector<WorkerArgument> workerArguments;
+
+    // Non-copyable, the object owns the worker threads, which point to it
+    SgdSVM(const SgdSVM&);
+    SgdSVM& operator=(const SgdSVM&);
+
+    /**
+     * Deterministic pseudo random number generator (xorshift) for the sample order, so that training is reproducible
+     */
+    static uint32_t nextRandom(uint32_t& state) {
+        state ^= state << 13;
+        state ^= state >> 17;
+        state ^= state << 5;
+        return state;
+    }
+
+    /**
+     * Calculates the sub-gradient part of one thread: the thread's share of the current minibatch
+     * @param thread
+     */
+    void computeGradientPart(int thread) {
+        const long begin = batchSize * thread / workerCount;
+        const long end = batchSize * (thread + 1) / workerCount;
+        const double B = std::max(param.biasFeature, 0.0);
+        std::vector<float>& gradient = gradients[thread];
+        std::fill(gradient.begin(), gradient.end(), 0.0f);
+        double biasGradient = 0.0;
+        double loss = 0.0;
+        for (long s = begin; s < end; ++s) {
+            const long i = batch[s];
+            const float* x = features + i * dimension;
+            const double y = (labels[i] > 0) ? 1.0 : -1.0;
+            const double margin = y * (denseDot(currentWeights, x, dimension) + currentBiasWeight * B);
+            if (margin < 1.0) {
+                loss += 1.0 - margin;
+                denseAxpy((float) y, x, &gradient[0], dimension);
+                biasGradient += y * B;
+            }
+        }
+        biasGradients[thread] = biasGradient;
+        losses[thread] = loss;
+    }
+
+    void work(int thread) {
+        unsigned long seenGeneration = 0;
+        pthread_mutex_lock(&workerMutex);
+        while (true) {
+            while (workGeneration == seenGeneration && !stopWorkers) {
+                pthread_cond_wait(&workReady, &workerMutex);
+            }
+            if (stopWorkers) {
+                break;
+            }
+            seenGeneration = workGeneration;
+            pthread_mutex_unlock(&workerMutex);
+            computeGradientPart(thread);
+            pthread_mutex_lock(&workerMutex);
+            if (--pendingWorkers == 0) {
+                pthread_cond_signal(&workDone);
+            }
+        }
+        pthread_mutex_unlock(&workerMutex);
+    }
+
+    static void* workerThread(void* _argument) {
+        WorkerArgument* argument = static_cast<WorkerArgument*> (_argument);
+        argument->svm->work(argument->thread);
+        return NULL;
+    }
+
+    void startThreads() {
+        workerCount = (param.threads > 0) ? param.threads : std::max((int) sysconf(_SC_NPROCESSORS_ONLN), 1);
+        workerCount = (int) std::max(std::min((long) workerCount, param.minibatchSize), 1L);
+        gradients.assign(workerCount, std::vector<float>(dimension, 0.0f));
+        biasGradients.assign(workerCount, 0.0);
+        losses.assign(workerCount, 0.0);
+        workerArguments.resize(workerCount);
+        stopWorkers = false;
+        workGeneration = 0;
+        for (int thread = 1; thread < workerCount; ++thread) {
+            workerArguments[thread].svm = this;
+            workerArguments[thread].thread = thread;
+            pthread_t worker;
+            if (pthread_create(&worker, NULL, workerThread, &workerArguments[thread]) != 0) {
+                printf("Warning: Could only start %d sub-gradient threads\n", thread);
+                workerCount = thread;
+                break;
+            }
+            workers.push_back(worker);
+        }
+    }
+
+    void stopThreads() {
+        pthread_mutex_lock(&workerMutex);
+        stopWorkers = true;
+        pthread_cond_broadcast(&workReady);
+        pthread_mutex_unlock(&workerMutex);
+        for (size_t worker = 0; worker < workers.size(); ++worker) {
+            pthread_join(workers[worker], NULL);
+        }
+        workers.clear();
+    }
+
+    /**
+     * Calculates the sub-gradient parts of a minibatch in all threads and waits for them
+     * @param _batch sample indices
+     * @param _batchSize
+     */
+    void computeGradient(const long* _batch, long _batchSize) {
+        pthread_mutex_lock(&workerMutex);
+        batch = _batch;
+        batchSize = _batchSize;
+        pendingWorkers = workerCount - 1;
+        ++workGeneration;
+        pthread_cond_broadcast(&workReady);
+        pthread_mutex_unlock(&workerMutex);
+        computeGradientPart(0);
+        pthread_mutex_lock(&workerMutex);
+        while (pendingWorkers > 0) {
+            pthread_cond_wait(&workDone, &workerMutex);
+        }
+        pthread_mutex_unlock(&workerMutex);
+    }
+
+public:
+    SgdSVMParameter param;
+
+    SgdSVM() {
+        // The HOG paper uses a soft classifier (C = 0.01)
+        param.C = 0.01;
+        param.epochs = 20;
+        param.eps = 0.001;
+        param.minibatchSize = 256;
+        param.blockSize = 16384;
+        param.threads = 0;
+        param.eta0 = 0.0;
+        param.averaging = true;
+        param.biasFeature = 1.0;
+        mapped = false;
+        labels = NULL;
+        features = NULL;
+        sampleCount = 0;
+        dimension = 0;
+        bias = 0.0;
+        workerCount = 1;
+        workGeneration = 0;
+        pendingWorkers = 0;
+        stopWorkers = false;
+        batch = NULL;
+        batchSize = 0;
+        currentWeights = NULL;
+        currentBiasWeight = 0.0;
+        pthread_mutex_init(&workerMutex, NULL);
+        pthread_cond_init(&workReady, NULL);
+        pthread_cond_init(&workDone, NULL);
+    }
+
+    virtual ~SgdSVM() {
+        stopThreads();
+        pthread_cond_destroy(&workDone);
+        pthread_cond_destroy(&workReady);
+        pthread_mutex_destroy(&workerMutex);
+    }
+
+    static SgdSVM* getInstance();
+
+    const char* getSVMName() const {
+        return "SgdSVM";
+    }
+
+    /**
+     * Sets the training data directly from memory, the data is copied
+     * @param _labels one label (+1 / -1) per sample
+     * @param _features row-major feature matrix, _labels.size() x dimension values
+     */
+    void read_problem(const std::vector<float>& _labels, const std::vector<float>& _features) {
+        mapping.close();
+        mapped = false;
+        ownedLabels = _labels;
+        ownedFeatures = _features;
+        sampleCount = ownedLabels.size();
+        dimension = (sampleCount > 0) ? (ownedFeatures.size() / sampleCount) : 0;
+        labels = (sampleCount > 0) ? &ownedLabels[0] : NULL;
+        features = (sampleCount > 0) ? &ownedFeatures[0] : NULL;
+    }
+
+    /**
+     * Uses training data owned by the caller, which is not copied and has to stay valid until the training is done.
+     * Several instances may share the same data, it is only read
+     * @param _labels one label (+1 / -1) per sample
+     * @param _features row-major feature matrix, _sampleCount x _dimension values
+     * @param _sampleCount
+     * @param _dimension
+     */
+    void setSharedProblem(const float* _labels, const float* _features, long _sampleCount, long _dimension) {
+        mapping.close();
+        mapped = false;
+        std::vector<float>().swap(ownedLabels);
+        std::vector<float>().swap(ownedFeatures);
+        labels = _labels;
+        features = _features;
+        sampleCount = _sampleCount;
+        dimension = _dimension;
+    }
+
+    /**
+     * Maps a binary feature store as training data, it is read block by block during training
+     * @param filename
+     */
+    void read_problem(char* filename) {
+        std::vector<float>().swap(ownedLabels);
+        std::vector<float>().swap(ownedFeatures);
+        if (!mapping.open(filename)) {
+            fprintf(stderr, "%s only supports binary feature stores as input file\n", getSVMName());
+            exit(EXIT_FAILURE);
+        }
+        mapped = true;
+        sampleCount = mapping.getCount();
+        dimension = mapping.getDimension();
+        labels = mapping.getLabels();
+        features = mapping.getSample(0);
+    }
+
+    /**
+     * Runs averaged minibatch SGD with the Pegasos step size eta_t = eta0 / (1 + lambda*eta0*t) and projection onto the ball
+     * |w| <= 1/sqrt(lambda) containing the optimum
+     */
+    void train() {
+        const double B = std::max(param.biasFeature, 0.0);
+        const long minibatchSize = std::max(param.minibatchSize, 1L);
+        const long blockSize = std::max(param.blockSize, minibatchSize);
+        weights.assign(dimension, 0.0f);
+        bias = 0.0;
+        if (sampleCount == 0 || dimension == 0) {
+            printf("Warning: No training samples, %s model left empty\n", getSVMName());
+            return;
+        }
+        const double lambda = 1.0 / (sampleCount * param.C);
+        double biasWeight = 0.0;
+        if ((long) warmStartWeights.size() == dimension + 1) {
+            std::copy(warmStartWeights.begin(), warmStartWeights.begin() + dimension, weights.begin());
+            biasWeight = (B > 0.0) ? warmStartWeights[dimension] / B : 0.0;
+            printf("Warm start from the previous weights\n");
+        }
+        warmStartWeights.clear();
+
+        double eta0 = param.eta0;
+        if (eta0 <= 0.0) {
+            // About one unit of margin per violating sample (the inverse mean squared norm of the first block),
+            // larger for larger minibatches whose averaged sub-gradients are less noisy
+            const long estimateSamples = std::min(sampleCount, blockSize);
+            double squaredNorms = 0.0;
+            for (long i = 0; i < estimateSamples; ++i) {
+                const float* x = features + i * dimension;
+                squaredNorms += denseDot(x, x, dimension) + B * B;
+            }
+            eta0 = sqrt((double) minibatchSize) * ((squaredNorms > 0.0) ? estimateSamples / squaredNorms : 1.0);
+        }
+
+        startThreads();
+        printf("Training linear SVM by minibatch SGD on %ld samples of dimension %ld (%ld samples per minibatch, %d threads, eta0 %g)\n",
+                sampleCount, dimension, minibatchSize, workerCount, eta0);
+        std::vector<float> averageWeights(param.averaging ? dimension : 0, 0.0f);
+        double averageBiasWeight = 0.0;
+        unsigned long averagedIterations = 0;
+        std::vector<float> gradient(dimension);
+        const long blockCount = (sampleCount + blockSize - 1) / blockSize;
+        std::vector<long> blockOrder(blockCount);
+        for (long block = 0; block < blockCount; ++block) {
+            blockOrder[block] = block;
+        }
+        std::vector<long> sampleOrder;
+        uint32_t randomState = 2463534242u;
+        unsigned long iteration = 0;
+        double previousObjective = HUGE_VAL;
+        int epoch = 0;
+        while (epoch < param.epochs) {
+            double epochLoss = 0.0;
+            for (long b = 0; b < blockCount; ++b) {
+                std::swap(blockOrder[b], blockOrder[b + nextRandom(randomState) % (blockCount - b)]);
+            }
+            for (long b = 0; b < blockCount; ++b) {
+                const long firstSample = blockOrder[b] * blockSize;
+                const long blockSamples = std::min(blockSize, sampleCount - firstSample);
+                sampleOrder.resize(blockSamples);
+                for (long s = 0; s < blockSamples; ++s) {
+                    sampleOrder[s] = firstSample + s;
+                }
+                for (long s = 0; s < blockSamples; ++s) {
+                    std::swap(sampleOrder[s], sampleOrder[s + nextRandom(randomState) % (blockSamples - s)]);
+                }
+                for (long first = 0; first < blockSamples; first += minibatchSize) {
+                    const long size = std::min(minibatchSize, blockSamples - first);
+                    currentWeights = &weights[0];
+                    currentBiasWeight = biasWeight;
+                    computeGradient(&sampleOrder[first], size);
+                    // Add up the parts in thread order, independent of the scheduling
+                    std::copy(gradients[0].begin(), gradients[0].end(), gradient.begin());
+                    double biasGradient = biasGradients[0];
+                    epochLoss += losses[0];
+                    for (int thread = 1; thread < workerCount; ++thread) {
+                        denseAxpy(1.0f, &gradients[thread][0], &gradient[0], dimension);
+                        biasGradient += biasGradients[thread];
+                        epochLoss += losses[thread];
+                    }
+                    // w = (1 - eta*lambda)*w + eta/|batch|*sum_violators(y_i*x_i)
+                    const double eta = eta0 / (1.0 + lambda * eta0 * iteration);
+                    const double decay = std::max(1.0 - eta * lambda, 0.0);
+                    for (long j = 0; j < dimension; ++j) {
+                        weights[j] = (float) (decay * weights[j]);
+                    }
+                    denseAxpy((float) (eta / size), &gradient[0], &weights[0], dimension);
+                    biasWeight = decay * biasWeight + eta / size * biasGradient;
+                    // Projection onto the ball of radius 1/sqrt(lambda)
+                    const double squaredNorm = denseDot(&weights[0], &weights[0], dimension) + biasWeight * biasWeight;
+                    if (squaredNorm * lambda > 1.0) {
+                        const double scale = 1.0 / sqrt(squaredNorm * lambda);
+                        for (long j = 0; j < dimension; ++j) {
+                            weights[j] = (float) (scale * weights[j]);
+                        }
+                        biasWeight *= scale;
+                    }
+                    ++iteration;
+                    if (param.averaging && epoch > 0) {
+                        ++averagedIterations;
+                        const float rate = 1.0f / averagedIterations;
+                        for (long j = 0; j < dimension; ++j) {
+                            averageWeights[j] += rate * (weights[j] - averageWeights[j]);
+                        }
+                        averageBiasWeight += (biasWeight - averageBiasWeight) / averagedIterations;
+                    }
+                }
+                if (mapped) {
+                    mapping.releaseSamples(firstSample, blockSamples);
+                }
+            }
+            ++epoch;
+            // Objective estimated from the losses seen during the epoch
+            const double objective = 0.5 * lambda * (denseDot(&weights[0], &weights[0], dimension) + biasWeight * biasWeight) + epochLoss / sampleCount;
+            printf("Epoch %d: objective %3.5f\n", epoch, objective);
+            if (epoch > 1 && fabs(previousObjective - objective) <= param.eps * std::max(objective, 1.0e-12)) {
+                break;
+            }
+            previousObjective = objective;
+        }
+        stopThreads();
+        if (averagedIterations > 0) {
+            weights.swap(averageWeights);
+            biasWeight = averageBiasWeight;
+        }
+        bias = biasWeight * B;
+        printf("Optimization finished after %d epochs (%lu minibatch updates), bias b %3.5f\n", epoch, iteration, bias);
+    }
+
+    /**
+     * Saves w and b as text file, first line holds dimension and bias, second line the weights
+     * @param _modelFileName file name to save the model to
+     */
+    void saveModelToFile(const std::string _modelFileName) {
+        FILE* fp = fopen(_modelFileName.c_str(), "w");
+        if (fp == NULL) {
+            fprintf(stderr, "Error: Could not save model to file %s\n", _modelFileName.c_str());
+            exit(EXIT_FAILURE);
+        }
+        fprintf(fp, "%s %ld %.9g\n", getSVMName(), (long) weights.size(), bias);
+        for (size_t feature = 0; feature < weights.size(); ++feature) {
+            fprintf(fp, "%.9g ", weights[feature]);
+        }
+        fprintf(fp, "\n");
+        fclose(fp);
+    }
+
+    /**
+     * Starts the next training from the weights of the given model instead of from scratch,
+     * e.g. when retraining after adding hard negatives
+     * @param _modelFileName model file previously saved with saveModelToFile
+     * @return true if the previous model could be read
+     */
+    bool setWarmStart(const std::string& _modelFileName) {
+        warmStartWeights.clear();
+        FILE* fp = fopen(_modelFileName.c_str(), "r");
+        char name[64];
+        long modelDimension = 0;
+        double modelBias = 0.0;
+        if (fp == NULL || fscanf(fp, "%63s %ld %lf", name, &modelDimension, &modelBias) != 3 || modelDimension < 0) {
+            printf("Warning: No previous model '%s' found, training starts from scratch\n", _modelFileName.c_str());
+            if (fp != NULL) {
+                fclose(fp);
+            }
+            return false;
+        }
+        warmStartWeights.resize(modelDimension + 1);
+        for (long feature = 0; feature < modelDimension; ++feature) {
+            if (fscanf(fp, "%f", &warmStartWeights[feature]) != 1) {
+                printf("Warning: Previous model '%s' is truncated, training starts from scratch\n", _modelFileName.c_str());
+                warmStartWeights.clear();
+                fclose(fp);
+                return false;
+            }
+        }
+        warmStartWeights[modelDimension] = (float) modelBias;
+        fclose(fp);
+        return true;
+    }
+
+    void loadModelFromFile(const std::string _modelFileName) {
+        FILE* fp = fopen(_modelFileName.c_str(), "r");
+        char name[64];
+        long modelDimension = 0;
+        if (fp == NULL || fscanf(fp, "%63s %ld %lf", name, &modelDimension, &bias) != 3 || modelDimension < 0) {
+            fprintf(stderr, "Error: Could not load model from file %s\n", _modelFileName.c_str());
+            exit(EXIT_FAILURE);
+        }
+        weights.resize(modelDimension);
+        for (long feature = 0; feature < modelDimension; ++feature) {
+            if (fscanf(fp, "%f", &weights[feature]) != 1) {
+                fprintf(stderr, "Error: Model file %s is truncated\n", _modelFileName.c_str());
+                exit(EXIT_FAILURE);
+            }
+        }
+        fclose(fp);
+    }
+
+    /**
+     * Returns the trained weight vector w, which already is the single detecting vector
+     * @param singleDetectorVector resulting single detector vector for use in openCV HOG
+     * @param singleDetectorVectorIndices dummy vector for this implementation
+     */
+    void getSingleDetectingVector(std::vector<float>& singleDetectorVector, std::vector<unsigned int>& singleDetectorVectorIndices) {
+        singleDetectorVector = weights;
+    }
+
+    /**
+     * Sets the cost of constraint violation, e.g. as selected by cross-validation, must be called before train
+     * @param _C
+     */
+    void setC(double _C) {
+        param.C = _C;
+    }
+
+    /**
+     * Return model detection threshold, openCV HOG detects if w*x >= threshold, which is w*x + b >= 0
+     * @return detection threshold -b
+     */
+    double getThreshold() const {
+        return -bias;
+    }
+
+};
+
+/// Singleton
+SgdSVM* SgdSVM::getInstance() {
+    static SgdSVM theInstance;
+    return &theInstance;
+}
+
+#endif	/* SGDSVM_H */
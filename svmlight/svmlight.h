@@ -4,7 +4,10 @@
  * @date:   Created on 11. Mai 2011
  * @brief:  Wrapper interface for SVMlight, 
  * @see http://www.cs.cornell.edu/people/tj/svm_light/ for SVMlight details and terms of use
- * 
+ *
+ * Besides the instance used by main (getInstance), independent instances can be created, each owning its parameters,
+ * training examples and model. The SVMlight library itself keeps state in globals (verbosity, the working sets of the QP solver),
+ * so the library calls of all instances are serialized by a process-wide mutex: concurrent instances are safe, but train one after another.
  */
 
 #ifndef SVMLIGHT_H
@@ -12,6 +15,10 @@
 
 #include <stdio.h>
 #include <vector>
+#include <string>
+#include <algorithm>
+#include <pthread.h>
+#include "../featurestore/featurestore.h"
 // svmlight related
 // namespace required for avoiding collisions of declarations (e.g. LINEAR being declared in flann, svmlight and libsvm)
 namespace svmlight {
@@ -31,16 +38,174 @@ private:
     double* alpha_in;
     KERNEL_CACHE* kernel_cache;
     MODEL* model; // SVM model
+    bool modelTrained; // model was filled by training, its support vectors point into docs
+    bool modelLoaded; // model was read from file and owns its support vectors
+    std::vector<double> warmStartAlphas; // alpha_i*y_i per training example to start the next training from, empty for a cold start
+    std::string fileBackedDirectory; // If set, the feature words of the training examples are placed in a temporary file in this directory
+    FileBackedBuffer fileBackedWords; // Holds the feature words of all training examples if file-backed memory is used
+
+    long verbosityLevel; // SVMlight verbosity (-v) of the library calls of this instance
+
+    // Non-copyable, the object owns the training examples and the model, @see swap
+    SVMlight(const SVMlight&);
+    SVMlight& operator=(const SVMlight&);
+
+    /**
+     * Holds the process-wide mutex serializing the calls into the SVMlight library (which is not re-entrant) for its lifetime
+     * and sets the global verbosity to the one of the calling instance
+     */
+    class LibraryLock {
+    private:
+
+        static pthread_mutex_t* getMutex() {
+            static pthread_mutex_t libraryMutex = PTHREAD_MUTEX_INITIALIZER;
+            return &libraryMutex;
+        }
+
+    public:
+
+        LibraryLock(long _verbosity) {
+            pthread_mutex_lock(getMutex());
+            verbosity = _verbosity;
+        }
+
+        ~LibraryLock() {
+            pthread_mutex_unlock(getMutex());
+        }
+    };
+
+    /**
+     * Frees the current model, including its support vectors if it was read from file
+     */
+    void freeModel() {
+        if (modelLoaded) {
+            free_model(model, 1);
+        } else if (modelTrained) {
+            free_model(model, 0);
+        } else {
+            free(model); // Never filled, the members are not initialized
+        }
+        model = NULL;
+        modelTrained = false;
+        modelLoaded = false;
+    }
+
+    /**
+     * Frees the training examples, the feature words only if they are not located in the file-backed buffer
+     */
+    void freeProblem() {
+        for (i = 0; i < totdoc; i++) {
+            if (fileBackedWords.isAllocated()) {
+                free(docs[i]->fvec->userdefined);
+                free(docs[i]->fvec);
+                free(docs[i]);
+            } else {
+                free_example(docs[i], 1);
+            }
+        }
+        free(docs);
+        free(target);
+        fileBackedWords.release();
+        docs = NULL;
+        target = NULL;
+        totdoc = 0;
+    }
+
+    /**
+     * Adds factor * the given support vector to the detector vector sum
+     * @param words support vector components, terminated by feature number 0
+     * @param factor alpha_i*y_i of the support vector
+     * @param sum resulting sum, indexed by feature number - 1
+     */
+    static void addSupportVector(const WORD* words, double factor, std::vector<double>& sum) {
+        const long dimension = sum.size();
+        if (dimension == 0) {
+            return;
+        }
+        long component = 0;
+        // Dense part: the components are stored in feature order without gaps, a plain strided loop the compiler can vectorize
+        while (component < dimension && words[component].wnum == component + 1) {
+            ++component;
+        }
+        double* denseSum = &sum[0];
+        for (long feature = 0; feature < component; ++feature) {
+            denseSum[feature] += factor * words[feature].weight;
+        }
+        // Sparse remainder, walk up to the terminator
+        for (; words[component].wnum != 0; ++component) {
+            if (words[component].wnum <= dimension) {
+                denseSum[words[component].wnum - 1] += factor * words[component].weight;
+            }
+        }
+    }
+
+    /**
+     * Allocates the example structures for the given problem size
+     * @param sampleCount
+     * @param dimension
+     */
+    void allocateProblem(long sampleCount, long dimension) {
+        freeProblem(); // Allows reading in a new problem, e.g. for retraining
+        docs = (DOC **) my_malloc(sizeof (DOC *) * sampleCount);
+        target = (double *) my_malloc(sizeof (double) * sampleCount);
+        if (!fileBackedDirectory.empty() && fileBackedWords.allocate(fileBackedDirectory, sizeof (WORD) * (dimension + 1) * sampleCount) == NULL) {
+            exit(EXIT_FAILURE);
+        }
+        totwords = dimension;
+        totdoc = sampleCount;
+    }
+
+    /**
+     * Converts a range of samples into training examples, see allocateProblem
+     * @param firstSample index of the first sample to convert
+     * @param sampleCount number of samples to convert
+     * @param labels labels of the samples to convert
+     * @param features row-major features of the samples to convert
+     */
+    void fillProblem(long firstSample, long sampleCount, const float* labels, const float* features) {
+        for (long sample = 0; sample < sampleCount; ++sample) {
+            const long docnum = firstSample + sample;
+            const float* sampleFeatures = features + sample * totwords;
+            WORD* words = fileBackedWords.isAllocated()
+                    ? static_cast<WORD*> (fileBackedWords.getData()) + docnum * (totwords + 1)
+                    : (WORD *) my_malloc(sizeof (WORD) * (totwords + 1));
+            for (long feature = 0; feature < totwords; ++feature) {
+                words[feature].wnum = feature + 1; // SVMlight feature numbers start at 1
+                words[feature].weight = sampleFeatures[feature];
+            }
+            words[totwords].wnum = 0; // Terminates the word list
+            // Build the vector in place instead of using create_svector, which would copy the words to the heap
+            SVECTOR* featureVector = (SVECTOR *) my_malloc(sizeof (SVECTOR));
+            featureVector->words = words;
+            featureVector->twonorm_sq = sprod_ss(featureVector, featureVector);
+            featureVector->userdefined = (char *) my_malloc(1);
+            featureVector->userdefined[0] = '\0';
+            featureVector->kernel_id = 0;
+            featureVector->next = NULL;
+            featureVector->factor = 1.0;
+            target[docnum] = labels[sample];
+            docs[docnum] = create_example(docnum, 0, 0, 1.0, featureVector);
+        }
+        if (fileBackedWords.isAllocated()) {
+            fileBackedWords.flush(sizeof (WORD) * (totwords + 1) * firstSample, sizeof (WORD) * (totwords + 1) * sampleCount);
+        }
+    }
+
+public:
+    LEARN_PARM* learn_parm;
+    KERNEL_PARM* kernel_parm;
 
     SVMlight() {
         // Init variables
         alpha_in = NULL;
         kernel_cache = NULL; // Cache not needed with linear kernel
         model = (MODEL *) my_malloc(sizeof (MODEL));
+        modelTrained = false;
+        modelLoaded = false;
         learn_parm = new LEARN_PARM;
         kernel_parm = new KERNEL_PARM;
         // Init parameters
-        verbosity = 1; // Show some messages -v 1
+        verbosityLevel = 1; // Show some messages -v 1
         learn_parm->alphafile[0] = '\0'; // NULL; // Important, otherwise files with strange/invalid names appear in the working directory
         learn_parm->biased_hyperplane = 1;
         learn_parm->sharedslack = 0; // 1
@@ -82,36 +247,191 @@ private:
         if (kernel_cache)
             kernel_cache_cleanup(kernel_cache);
         free(alpha_in);
-        free_model(model, 0);
-        for (i = 0; i < totdoc; i++)
-            free_example(docs[i], 1);
-        free(docs);
-        free(target);
+        freeModel();
+        freeProblem();
+        delete learn_parm;
+        delete kernel_parm;
     }
 
-public:
-    LEARN_PARM* learn_parm;
-    KERNEL_PARM* kernel_parm;
-
     static SVMlight* getInstance();
 
+    /**
+     * Exchanges the complete state (parameters, training examples, model) with another instance, the C++98 replacement of a move,
+     * e.g. to hand a trained model over to an instance living longer
+     * @param other
+     */
+    void swap(SVMlight& other) {
+        std::swap(docs, other.docs);
+        std::swap(totwords, other.totwords);
+        std::swap(totdoc, other.totdoc);
+        std::swap(i, other.i);
+        std::swap(target, other.target);
+        std::swap(alpha_in, other.alpha_in);
+        std::swap(kernel_cache, other.kernel_cache);
+        std::swap(model, other.model);
+        std::swap(modelTrained, other.modelTrained);
+        std::swap(modelLoaded, other.modelLoaded);
+        warmStartAlphas.swap(other.warmStartAlphas);
+        fileBackedDirectory.swap(other.fileBackedDirectory);
+        fileBackedWords.swap(other.fileBackedWords);
+        std::swap(verbosityLevel, other.verbosityLevel);
+        std::swap(learn_parm, other.learn_parm);
+        std::swap(kernel_parm, other.kernel_parm);
+    }
+
+    /**
+     * @param _verbosity SVMlight verbosity level of this instance (-v), 0 for no messages
+     */
+    void setVerbosity(long _verbosity) {
+        verbosityLevel = _verbosity;
+    }
+
+    /**
+     * Places the feature data of the training examples in a temporary file instead of the heap,
+     * so that training sets larger than main memory do not cause swapping. Must be called before read_problem
+     * @param _directory directory for the temporary file including trailing slash, empty to use the heap
+     */
+    void useFileBackedMemory(const std::string& _directory) {
+        fileBackedDirectory = _directory;
+    }
+
+    /**
+     * Saves the model and, if it was trained for classification in this run, alpha_i*y_i of every training example to <_modelFileName>.alphas
+     * (one value per line, as written by svm_learn -a), which is used by setWarmStart
+     * @param _modelFileName
+     */
     inline void saveModelToFile(const std::string _modelFileName) {
-        write_model(const_cast<char*>(_modelFileName.c_str()), model);
+        {
+            LibraryLock lock(verbosityLevel);
+            write_model(const_cast<char*>(_modelFileName.c_str()), model);
+        }
+        if (!modelTrained || learn_parm->type != CLASSIFICATION) {
+            return;
+        }
+        std::vector<double> alphas(totdoc, 0.0);
+        for (long sv = 1; sv < model->sv_num; ++sv) {
+            const long docnum = model->supvec[sv]->docnum;
+            if (docnum >= 0 && docnum < totdoc) {
+                alphas[docnum] += model->alpha[sv];
+            }
+        }
+        const std::string alphasFileName = _modelFileName + ".alphas";
+        FILE* fp = fopen(alphasFileName.c_str(), "w");
+        if (fp == NULL) {
+            printf("Warning: Could not save alphas to file '%s'\n", alphasFileName.c_str());
+            return;
+        }
+        for (long doc = 0; doc < totdoc; ++doc) {
+            fprintf(fp, "%.18g\n", alphas[doc]);
+        }
+        fclose(fp);
+    }
+
+    /**
+     * Starts the next training from the solution saved with the given model (<_modelFileName>.alphas) instead of from scratch,
+     * e.g. when retraining after adding hard negatives. Training examples are matched by their order,
+     * examples appended since have no previous solution and start at 0.
+     * Only svm_learn_classification accepts start values, with any other learning type training starts from scratch.
+     * @param _modelFileName model file previously saved with saveModelToFile
+     * @return true if the previous solution could be read
+     */
+    bool setWarmStart(const std::string& _modelFileName) {
+        warmStartAlphas.clear();
+        if (learn_parm->type != CLASSIFICATION) {
+            printf("Warning: SVMlight only supports warm starts for classification, training starts from scratch\n");
+            return false;
+        }
+        const std::string alphasFileName = _modelFileName + ".alphas";
+        FILE* fp = fopen(alphasFileName.c_str(), "r");
+        if (fp == NULL) {
+            printf("Warning: No previous solution '%s' found, training starts from scratch\n", alphasFileName.c_str());
+            return false;
+        }
+        double alpha;
+        while (fscanf(fp, "%lf", &alpha) == 1) {
+            warmStartAlphas.push_back(alpha);
+        }
+        fclose(fp);
+        printf("Warm start from %lu previous alphas\n", (unsigned long) warmStartAlphas.size());
+        return true;
     }
 
     void loadModelFromFile(const std::string _modelFileName) {
+        freeModel();
+        LibraryLock lock(verbosityLevel);
         this->model = read_model(const_cast<char*>(_modelFileName.c_str()));
+        modelLoaded = true;
     }
 
-    // read in a problem (in svmlight format)
+    /**
+     * Builds the training examples directly from memory, from labels and a dense, row-major feature matrix
+     * @param labels sampleCount labels (+1 / -1)
+     * @param features sampleCount x dimension feature values, e.g. the data of a continuous CV_32F cv::Mat
+     * @param sampleCount
+     * @param dimension
+     */
+    void read_problem(const float* labels, const float* features, long sampleCount, long dimension) {
+        allocateProblem(sampleCount, dimension);
+        fillProblem(0, sampleCount, labels, features);
+    }
+
+    /**
+     * Builds the training examples directly from memory
+     * @param labels one label (+1 / -1) per sample
+     * @param features row-major feature matrix, labels.size() x dimension values
+     */
+    void read_problem(const std::vector<float>& labels, const std::vector<float>& features) {
+        const long sampleCount = labels.size();
+        const long dimension = (sampleCount > 0) ? (features.size() / sampleCount) : 0;
+        read_problem(sampleCount > 0 ? &labels[0] : NULL, sampleCount > 0 ? &features[0] : NULL, sampleCount, dimension);
+    }
+
+    // read in a problem (binary feature store or svmlight format)
     void read_problem(char* filename) {
-        // Reads and parses the specified file
-        read_documents(filename, &docs, &target, &totwords, &totdoc);
+        if (isFeatureStore(filename)) {
+            // Convert the memory-mapped features chunk-wise, dropping the already converted pages of the mapping
+            FeatureStoreMapping mapping;
+            if (!mapping.open(filename)) {
+                exit(EXIT_FAILURE);
+            }
+            allocateProblem(mapping.getCount(), mapping.getDimension());
+            for (long firstSample = 0; firstSample < totdoc; firstSample += FEATURESTORE_CHUNK_SAMPLES) {
+                const long chunkSamples = std::min((long) FEATURESTORE_CHUNK_SAMPLES, totdoc - firstSample);
+                fillProblem(firstSample, chunkSamples, mapping.getLabels() + firstSample, mapping.getSample(firstSample));
+                mapping.releaseSamples(firstSample, chunkSamples);
+            }
+        } else {
+            // Reads and parses the specified file
+            freeProblem();
+            LibraryLock lock(verbosityLevel);
+            read_documents(filename, &docs, &target, &totwords, &totdoc);
+        }
     }
 
-    // Calls the actual machine learning algorithm
+    // Calls the actual machine learning algorithm, a previously trained model is replaced
     void train() {
-        svm_learn_regression(docs, target, totdoc, totwords, learn_parm, kernel_parm, &kernel_cache, model);
+        freeModel();
+        model = (MODEL *) my_malloc(sizeof (MODEL));
+        if (kernel_cache) { // Left by a previous regression training with a non-linear kernel
+            kernel_cache_cleanup(kernel_cache);
+            kernel_cache = NULL;
+        }
+        LibraryLock lock(verbosityLevel);
+        if (learn_parm->type == CLASSIFICATION) {
+            free(alpha_in);
+            alpha_in = NULL;
+            if (!warmStartAlphas.empty()) {
+                alpha_in = (double *) my_malloc(sizeof (double) * totdoc);
+                for (long doc = 0; doc < totdoc; ++doc) {
+                    alpha_in[doc] = (doc < (long) warmStartAlphas.size()) ? warmStartAlphas[doc] : 0.0;
+                }
+                warmStartAlphas.clear();
+            }
+            svm_learn_classification(docs, target, totdoc, totwords, learn_parm, kernel_parm, kernel_cache, model, alpha_in);
+        } else {
+            svm_learn_regression(docs, target, totdoc, totwords, learn_parm, kernel_parm, &kernel_cache, model);
+        }
+        modelTrained = true;
     }
 
     /**
@@ -121,26 +441,54 @@ public:
      * @param singleDetectorVectorIndices dummy vector for this implementation
      */
     void getSingleDetectingVector(std::vector<float>& singleDetectorVector, std::vector<unsigned int>& singleDetectorVectorIndices) {
-        // Now we use the trained svm to retrieve the single detector vector
-        DOC** supveclist = model->supvec;
-        printf("Calculating single descriptor vector out of support vectors (may take some time)\n");
-        // Retrieve single detecting vector (v1) from returned ones by calculating vec1 = sum_1_n (alpha_y*x_i). (vec1 is a n x1 column vector. n = feature vector length)
         singleDetectorVector.clear();
-        singleDetectorVector.resize(model->totwords, 0.);
-        printf("Resulting vector size %lu\n", singleDetectorVector.size());
-        
-        // Walk over every support vector
-        for (long ssv = 1; ssv < model->sv_num; ++ssv) { // Don't know what's inside model->supvec[0] ?!
-            // Get a single support vector
-            DOC* singleSupportVector = supveclist[ssv]; // Get next support vector
-            SVECTOR* singleSupportVectorValues = singleSupportVector->fvec;
-            WORD singleSupportVectorComponent;
-            // Walk through components of the support vector and populate our detector vector
-            for (unsigned long singleFeature = 0; singleFeature < model->totwords; ++singleFeature) {
-                singleSupportVectorComponent = singleSupportVectorValues->words[singleFeature];
-                singleDetectorVector.at(singleSupportVectorComponent.wnum-1) += (singleSupportVectorComponent.weight * model->alpha[ssv]);
+        const long dimension = model->totwords;
+        // With a linear kernel SVMlight maintains vec1 itself as weight vector of the linear model
+        if (model->kernel_parm.kernel_type == LINEAR) {
+            if (model->lin_weights == NULL) {
+                add_weight_vector_to_linear_model(model);
+            }
+            singleDetectorVector.resize(dimension);
+            for (long feature = 0; feature < dimension; ++feature) {
+                singleDetectorVector[feature] = (float) model->lin_weights[feature + 1]; // lin_weights is indexed by feature number, starting at 1
+            }
+            printf("Resulting vector size %lu (from linear model weights)\n", singleDetectorVector.size());
+            return;
+        }
+        printf("Calculating single descriptor vector out of %ld support vectors (may take some time)\n", model->sv_num - 1);
+        // Retrieve single detecting vector (v1) from returned ones by calculating vec1 = sum_1_n (alpha_y*x_i). (vec1 is a n x1 column vector. n = feature vector length)
+        std::vector<double> detectorVector(dimension, 0.0);
+#ifdef _OPENMP
+        #pragma omp parallel
+#endif
+        {
+            // Every thread sums up its share of the support vectors, the partial sums are added up at the end
+            std::vector<double> partialSum(dimension, 0.0);
+#ifdef _OPENMP
+            #pragma omp for schedule(dynamic, 64) nowait
+#endif
+            for (long ssv = 1; ssv < model->sv_num; ++ssv) { // supvec[0] is unused, SVMlight indices start at 1
+                for (SVECTOR* singleSupportVectorValues = model->supvec[ssv]->fvec; singleSupportVectorValues != NULL; singleSupportVectorValues = singleSupportVectorValues->next) {
+                    addSupportVector(singleSupportVectorValues->words, model->alpha[ssv] * singleSupportVectorValues->factor, partialSum);
+                }
+            }
+#ifdef _OPENMP
+            #pragma omp critical
+#endif
+            for (long feature = 0; feature < dimension; ++feature) {
+                detectorVector[feature] += partialSum[feature];
             }
         }
+        singleDetectorVector.assign(detectorVector.begin(), detectorVector.end());
+        printf("Resulting vector size %lu\n", singleDetectorVector.size());
+    }
+
+    /**
+     * Sets the cost of constraint violation, e.g. as selected by cross-validation, must be called before train
+     * @param _C
+     */
+    void setC(double _C) {
+        learn_parm->svm_c = _C;
     }
 
     /**